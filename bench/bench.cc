@@ -0,0 +1,258 @@
+// Runs one Controller and N Nodes on threads of one process over the
+// in-memory transport and prints one JSON line per N:
+//   registration - time until the controller knows every node
+//   fanout_us    - delay from the server stamping a tick to a client
+//                  receiving it, over a few ticks with all nodes registered
+//   tick_us      - time the server spends on one tick
+//   failover_ms  - time from stopping the server to the first tick from its
+//                  successor
+//
+// Usage: task7_bench [-l <debug|info|error>] [-t <memory|unix|shm>]
+//                    [-p <connections|shm>] [-k <relay fanout>]
+//                    [-w <controller worker threads>] [N...]
+//
+// Only the in-memory transport can wake the nodes at the end of a run, with
+// the others every run ends with the nodes' wait timeouts.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "controller.h"
+#include "in_memory.h"
+#include "log.h"
+#include "metrics.h"
+#include "node.h"
+#include "shm.h"
+#include "unix_socket.h"
+
+#ifndef _WIN32
+#  include <sys/resource.h>
+#endif
+
+namespace {
+using namespace std::chrono_literals;
+using SteadyClock = std::chrono::steady_clock;
+
+const std::size_t kTicksToMeasure = 3;
+
+// Polls `is_done` until it holds or `timeout` passes.
+template <class Predicate>
+bool WaitFor(Predicate is_done, SteadyClock::duration timeout) {
+  auto deadline = SteadyClock::now() + timeout;
+  while (!is_done()) {
+    if (SteadyClock::now() >= deadline)
+      return false;
+    std::this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+double ToMilliseconds(SteadyClock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+double ToMicroseconds(std::uint64_t nanoseconds) {
+  return static_cast<double>(nanoseconds) / 1000.0;
+}
+
+std::string HistogramJson(const Histogram &histogram) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << "{\"count\":" << histogram.count()
+      << ",\"p50\":" << ToMicroseconds(histogram.Percentile(0.5))
+      << ",\"p99\":" << ToMicroseconds(histogram.Percentile(0.99))
+      << ",\"max\":" << ToMicroseconds(histogram.max()) << '}';
+  return out.str();
+}
+
+std::unique_ptr<IConnectionMethodFactory>
+MakeFactory(const std::string &transport) {
+  if (transport == "memory")
+    return std::make_unique<InMemoryFactory>();
+#ifndef _WIN32
+  if (transport == "unix")
+    return std::make_unique<UnixSocketFactory>();
+#endif
+#ifdef __linux__
+  if (transport == "shm")
+    return std::make_unique<ShmFactory>();
+#endif
+  return nullptr;
+}
+
+void RunBenchmark(const std::string &transport, TimePublication publication,
+                  std::size_t relay_fanout, std::size_t worker_threads,
+                  std::size_t node_count) {
+  Metrics &metrics = Metrics::Instance();
+  metrics.Reset();
+  Gauge &members = metrics.gauge("controller.members");
+  members.Set(0);
+  Counter &ticks_received = metrics.counter("node.ticks_received");
+  Counter &elections = metrics.counter("controller.elections");
+  Histogram &delivery = metrics.histogram("node.time_delivery");
+  Histogram &tick = metrics.histogram("node.send_time");
+
+  std::unique_ptr<IConnectionMethodFactory> factory_holder =
+      MakeFactory(transport);
+  IConnectionMethodFactory &factory = *factory_holder;
+  Controller controller(factory, Controller::kDefaultMaxNodes,
+                        FailureDetector::kDefaultThreshold, relay_fanout, "",
+                        worker_threads);
+  std::thread controller_thread([&controller] { controller.Run(); });
+
+  // Nodes register from their own threads, as a burst.
+  std::vector<std::unique_ptr<Node>> nodes(node_count);
+  std::vector<std::thread> node_threads;
+  std::atomic<std::size_t> started_count{0};
+  auto start = SteadyClock::now();
+  for (std::size_t i = 0; i < node_count; ++i) {
+    node_threads.emplace_back([&, i] {
+      nodes[i] = std::make_unique<Node>(factory, publication);
+      started_count.fetch_add(1, std::memory_order_release);
+      nodes[i]->Run();
+    });
+  }
+  bool is_registered = WaitFor(
+      [&] { return members.value() == static_cast<std::int64_t>(node_count); },
+      60s);
+  auto registration = SteadyClock::now() - start;
+  WaitFor(
+      [&] {
+        return started_count.load(std::memory_order_acquire) == node_count;
+      },
+      60s);
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << "{\"transport\":\"" << transport << "\",\"publication\":\""
+      << (publication == TimePublication::kSHARED_MEMORY ? "shm"
+                                                          : "connections")
+      << "\",\"relay_fanout\":" << relay_fanout
+      << ",\"controller_workers\":" << worker_threads
+      << ",\"nodes\":" << node_count;
+  if (is_registered) {
+    out << ",\"registration_ms\":" << ToMilliseconds(registration)
+        << ",\"registrations_per_s\":"
+        << static_cast<double>(node_count) /
+               std::chrono::duration<double>(registration).count();
+  } else {
+    out << ",\"registration_ms\":null,\"registrations_per_s\":null";
+  }
+
+  // fan-out over the next few ticks to every client
+  metrics.Reset();
+  std::size_t clients = node_count > 0 ? node_count - 1 : 0;
+  bool is_fanned_out = WaitFor(
+      [&] { return ticks_received.value() >= kTicksToMeasure * clients; },
+      kTicksToMeasure * 5s);
+  out << ",\"fanout_complete\":" << (is_fanned_out ? "true" : "false")
+      << ",\"fanout_us\":" << HistogramJson(delivery)
+      << ",\"tick_us\":" << HistogramJson(tick) << ",\"clock_round_trip_us\":"
+      << HistogramJson(metrics.histogram("node.clock_round_trip"));
+
+  // failover after the server stops without a word; it may complete while
+  // the server's thread is still being joined
+  metrics.Reset();
+  auto kill_time = SteadyClock::now();
+  for (std::size_t i = 0; i < node_count; ++i) {
+    if (!nodes[i] || !nodes[i]->is_server())
+      continue;
+    nodes[i]->Stop();
+    node_threads[i].join();
+    nodes[i].reset();
+  }
+  auto is_served_again = [&] {
+    return elections.value() > 0 && ticks_received.value() > 0;
+  };
+  bool is_failed_over = clients > 0 && WaitFor(is_served_again, 30s);
+  if (is_failed_over) {
+    out << ",\"failover_ms\":"
+        << ToMilliseconds(SteadyClock::now() - kill_time);
+  } else {
+    out << ",\"failover_ms\":null";
+  }
+  out << ",\"election_us\":"
+      << HistogramJson(metrics.histogram("controller.election")) << '}';
+
+  for (auto &node : nodes) {
+    if (node)
+      node->Stop();
+  }
+  controller.Stop();
+  if (auto *in_memory = dynamic_cast<InMemoryFactory *>(&factory))
+    in_memory->Shutdown();
+  for (auto &thread : node_threads) {
+    if (thread.joinable())
+      thread.join();
+  }
+  controller_thread.join();
+
+  std::cout << out.str() << std::endl;
+}
+} // namespace
+
+int main(int argc, const char **argv) {
+  Logger::Instance().set_level(kERRORS);
+#ifndef _WIN32
+  // every node holds connections to the controller and, as server, to all
+  // clients
+  rlimit files{};
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+#endif
+  std::string transport = "memory";
+  TimePublication publication = TimePublication::kCONNECTIONS;
+  std::size_t relay_fanout = 0;
+  std::size_t worker_threads = 0;
+  std::vector<std::size_t> node_counts;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      std::string level = argv[++i];
+      Logger::Instance().set_level(level == "debug"  ? kDEBUG
+                                   : level == "info" ? kINFO
+                                                     : kERRORS);
+      continue;
+    }
+    if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      publication = strcmp(argv[++i], "shm") == 0
+                         ? TimePublication::kSHARED_MEMORY
+                         : TimePublication::kCONNECTIONS;
+      continue;
+    }
+    if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      relay_fanout = std::strtoul(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      worker_threads = std::strtoul(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      transport = argv[++i];
+      continue;
+    }
+    node_counts.push_back(std::strtoul(argv[i], nullptr, 10));
+  }
+  if (node_counts.empty())
+    node_counts = {16, 64, 256};
+
+  if (!MakeFactory(transport)) {
+    std::cerr << "Transport " << transport << " is not supported" << std::endl;
+    return 1;
+  }
+  for (std::size_t node_count : node_counts)
+    RunBenchmark(transport, publication, relay_fanout, worker_threads,
+                 node_count);
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "broadcaster.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include "log.h"
+#include "wire_format.h"
+
+// Outlives Probe() if a task is still running when it returns.
+struct Broadcaster::State {
+  State(Targets targets, const Message &message,
+        std::chrono::steady_clock::time_point expires_at, std::size_t enough)
+      : targets(std::move(targets)),
+        results(this->targets.size(), Broadcaster::kNotProbed),
+        is_taken(this->targets.size(), false), pending(this->targets.size()),
+        enough(enough), expires_at(expires_at) {
+    is_encoded = EncodeMessage(message, encoded);
+  }
+  Targets targets;
+  // encoded once, every peer is sent the same bytes
+  EncodedMessage encoded;
+  bool is_encoded;
+  // next target to be taken by a task
+  std::atomic<std::size_t> next{0};
+  std::mutex mutex;
+  std::condition_variable done;
+  // written only until Probe() returns, so they are final then
+  std::vector<Broadcaster::Latency> results;
+  std::vector<bool> is_taken;
+  std::size_t pending;
+  std::size_t answered = 0;
+  std::size_t enough;
+  bool is_closed = false;
+  std::chrono::steady_clock::time_point expires_at;
+};
+
+Broadcaster::Broadcaster(IClient &client, std::size_t workers)
+    : client_(client), pool_(workers) {}
+
+std::vector<Broadcaster::Latency>
+Broadcaster::Probe(Targets targets, const Message &message,
+                   std::chrono::milliseconds deadline, std::size_t enough) {
+  auto state = std::make_shared<State>(
+      std::move(targets), message, std::chrono::steady_clock::now() + deadline,
+      enough);
+  if (!state->is_encoded) {
+    LOG(kERRORS) << "Broadcaster: message is too large";
+    return state->results;
+  }
+  // nothing to wait for
+  if (state->targets.empty())
+    return state->results;
+  std::size_t tasks = std::min(state->targets.size(), pool_.size());
+  for (std::size_t i = 0; i < tasks; ++i)
+    pool_.Submit([this, state] { Serve(*state); });
+  std::unique_lock<std::mutex> lock(state->mutex);
+  if (!state->done.wait_until(lock, state->expires_at, [&] {
+        return state->pending == 0 || state->answered >= state->enough;
+      })) {
+    LOG(kDEBUG) << "Broadcast deadline expired with " << state->pending
+                << " peers not served";
+    // the ones still under way missed it
+    for (std::size_t i = 0; i < state->targets.size(); ++i) {
+      if (state->is_taken[i] && state->results[i] == kNotProbed)
+        state->results[i] = kUnreachable;
+    }
+  }
+  state->is_closed = true;
+  return state->results;
+}
+
+void Broadcaster::Serve(State &state) {
+  using SteadyClock = std::chrono::steady_clock;
+  for (std::size_t i = state.next++; i < state.targets.size();
+       i = state.next++) {
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      // Probe() returns or is about to, nobody waits for the rest
+      if (state.is_closed || SteadyClock::now() >= state.expires_at)
+        return;
+      state.is_taken[i] = true;
+    }
+    Latency latency = kUnreachable;
+    auto started_at = SteadyClock::now();
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        state.expires_at - started_at);
+    if (remaining.count() > 0) {
+      int timeout = static_cast<int>(std::min<std::chrono::milliseconds::rep>(
+          kConnectTimeout, remaining.count()));
+      std::unique_ptr<IConnection> connection =
+          client_.Connect(*state.targets[i], timeout);
+      remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          state.expires_at - SteadyClock::now());
+      if (connection && remaining.count() > 0) {
+        connection->set_ack_timeout(static_cast<int>(remaining.count()));
+        if (connection->Write(state.encoded))
+          latency = SteadyClock::now() - started_at;
+        connection->set_ack_timeout(-1);
+      }
+      if (connection)
+        connection->Close();
+    }
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.is_closed)
+      return;
+    state.results[i] = latency;
+    if (latency != kUnreachable)
+      ++state.answered;
+    if (--state.pending == 0 || state.answered >= state.enough)
+      state.done.notify_one();
+  }
+}
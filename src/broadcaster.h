@@ -0,0 +1,47 @@
+#ifndef BROADCASTER_H_
+#define BROADCASTER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "i_connection_method.h"
+#include "thread_pool.h"
+
+// Probes many peers at once and measures how long each took to connect and
+// acknowledge a message. The peers are taken in order by the tasks of a
+// bounded worker pool, so a dead or slow peer holds up one worker, not the
+// others. Peers come resolved, e.g. from a MembershipTable, and the message
+// is encoded once for all of them.
+class Broadcaster {
+public:
+  using Latency = std::chrono::steady_clock::duration;
+  using Targets = std::vector<std::shared_ptr<const IAddress>>;
+  static constexpr Latency kUnreachable = Latency::max();
+  // a target Probe() did not wait for
+  static constexpr Latency kNotProbed = Latency::min();
+
+  Broadcaster(IClient &client, std::size_t workers);
+
+  // Writes `message` to the targets, in order, until `enough` of them
+  // answered or `deadline` expired. Returns for every target how long it took
+  // to connect and have the write acknowledged, kUnreachable if that failed
+  // or did not finish before the deadline, kNotProbed if it was not tried or
+  // still under way when enough had answered. Connect and ack timeouts are
+  // clipped to the deadline, so the call returns within it.
+  std::vector<Latency> Probe(Targets targets, const Message &message,
+                             std::chrono::milliseconds deadline,
+                             std::size_t enough = SIZE_MAX);
+
+private:
+  struct State;
+  // Serves the peers of `state` no other task took yet.
+  void Serve(State &state);
+  static constexpr int kConnectTimeout = 100;
+  IClient &client_;
+  ThreadPool pool_;
+};
+
+#endif // BROADCASTER_H_
@@ -1,33 +1,57 @@
-#ifndef COMMON_H_
-#define COMMON_H_
-
-#include <chrono>
-#include <iostream>
-
-#include "windows.h"
-
-using Clock = std::chrono::system_clock;
-using TimePoint = std::chrono::time_point<Clock>;
-
-std::string SerializeTimePoint(const TimePoint &time,
-                               const std::string &format);
-
-int RandomNumber();
-
-inline void WriteLastErrorMessage(const char *proc_name = nullptr,
-                                  const char *object = nullptr) {
-  LPTSTR buffer{};
-  auto error_code = GetLastError();
-  FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS |
-                     FORMAT_MESSAGE_ALLOCATE_BUFFER,
-                 nullptr, error_code, 0, (LPTSTR)&buffer, 0, nullptr);
-  if (object)
-    std::cerr << object << ": ";
-  if (proc_name)
-    std::cerr << proc_name << ": ";
-  std::cerr << "Error (code " << error_code << "):\n";
-  std::cerr << '\t' << buffer;
-  LocalFree(buffer);
-}
-
-#endif // COMMON_H_
+#ifndef COMMON_H_
+#define COMMON_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "log.h"
+
+#ifdef _WIN32
+#  include "windows.h"
+#else
+#  include <cerrno>
+#  include <cstring>
+#endif
+
+using Clock = std::chrono::system_clock;
+using TimePoint = std::chrono::time_point<Clock>;
+
+std::string SerializeTimePoint(const TimePoint &time,
+                               const std::string &format);
+
+int RandomNumber();
+
+// Index of the highest set bit, 0 for 0 and 1.
+inline int HighestBit(std::uint64_t value) {
+  int bit = 0;
+  while (value >>= 1)
+    ++bit;
+  return bit;
+}
+
+#ifdef _WIN32
+inline void WriteLastErrorMessage(const char *proc_name = nullptr,
+                                  const char *object = nullptr) {
+  LPTSTR buffer{};
+  auto error_code = GetLastError();
+  FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS |
+                     FORMAT_MESSAGE_ALLOCATE_BUFFER,
+                 nullptr, error_code, 0, (LPTSTR)&buffer, 0, nullptr);
+  LOG(kERRORS) << (object ? object : "") << (object ? ": " : "")
+               << (proc_name ? proc_name : "") << (proc_name ? ": " : "")
+               << "Error (code " << error_code << "): " << buffer;
+  LocalFree(buffer);
+}
+#else
+inline void WriteLastErrorMessage(const char *proc_name = nullptr,
+                                  const char *object = nullptr) {
+  auto error_code = errno;
+  LOG(kERRORS) << (object ? object : "") << (object ? ": " : "")
+               << (proc_name ? proc_name : "") << (proc_name ? ": " : "")
+               << "Error (code " << error_code
+               << "): " << std::strerror(error_code);
+}
+#endif
+
+#endif // COMMON_H_
@@ -0,0 +1,174 @@
+#include "connection_pool.h"
+
+#include <utility>
+
+#include "log.h"
+#include "metrics.h"
+
+namespace {
+class RawAddress : public IAddress {
+public:
+  explicit RawAddress(const std::string &address) : address_(address) {}
+  const std::string &raw() const override { return address_; }
+
+private:
+  const std::string &address_;
+};
+} // namespace
+
+// PooledClient
+
+PooledClient::PooledClient(std::unique_ptr<IClient> client)
+    : client_(std::move(client)) {}
+
+std::unique_ptr<IConnection> PooledClient::Connect(const IAddress &address,
+                                                   int timeout) {
+  std::unique_ptr<IConnection> connection;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = idle_.find(address.raw());
+    if (it != idle_.end()) {
+      connection = std::move(it->second);
+      idle_.erase(it);
+    }
+  }
+  bool is_reused = static_cast<bool>(connection);
+  if (!connection) {
+    connection = Dial(address.raw(), timeout);
+    if (!connection)
+      return nullptr;
+  }
+  return std::make_unique<PooledConnection>(
+      *this, address.raw(), std::move(connection), is_reused, timeout);
+}
+
+std::unique_ptr<IConnection> PooledClient::Dial(const std::string &address,
+                                                int timeout) {
+  static Histogram &connect_latency =
+      Metrics::Instance().histogram("client.connect");
+  static Counter &connect_failures =
+      Metrics::Instance().counter("client.connect_failures");
+  std::unique_ptr<IConnection> connection;
+  {
+    ScopedLatency latency(connect_latency);
+    connection = client_->Connect(RawAddress(address), timeout);
+  }
+  if (!connection)
+    connect_failures.Increment();
+  return connection;
+}
+
+void PooledClient::Release(const std::string &address,
+                           std::unique_ptr<IConnection> connection) {
+  if (!connection->is_reusable()) {
+    connection->Close();
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  // keep the first released connection if two leases raced for an address
+  auto inserted = idle_.emplace(address, nullptr);
+  if (inserted.second) {
+    inserted.first->second = std::move(connection);
+  } else {
+    connection->Close();
+  }
+}
+
+// PooledConnection
+
+PooledConnection::PooledConnection(PooledClient &pool, std::string address,
+                                   std::unique_ptr<IConnection> connection,
+                                   bool is_reused, int timeout)
+    : pool_(pool), address_(std::move(address)),
+      connection_(std::move(connection)), is_reused_(is_reused),
+      timeout_(timeout) {}
+
+PooledConnection::~PooledConnection() { Close(); }
+
+template <class WriteFunction>
+bool PooledConnection::WriteOrRedial(WriteFunction write) {
+  if (!connection_)
+    return false;
+  if (write(*connection_))
+    return true;
+  bool is_sent = connection_->is_last_write_sent();
+  connection_->Close();
+  connection_.reset();
+  if (!is_reused_ || is_sent) {
+    is_healthy_ = false;
+    is_last_write_sent_ = is_sent;
+    return false;
+  }
+  LOG(kDEBUG) << "Cached connection to " << address_ << " is broken, redialing";
+  is_reused_ = false;
+  connection_ = pool_.Dial(address_, timeout_);
+  if (connection_) {
+    connection_->set_ack_window(ack_window_);
+    connection_->set_ack_timeout(ack_timeout_);
+  }
+  if (!connection_ || !write(*connection_)) {
+    is_healthy_ = false;
+    is_last_write_sent_ = connection_ && connection_->is_last_write_sent();
+    return false;
+  }
+  return true;
+}
+
+bool PooledConnection::Write(Message &message) {
+  return WriteOrRedial(
+      [&](IConnection &connection) { return connection.Write(message); });
+}
+
+bool PooledConnection::Write(const EncodedMessage &message) {
+  return WriteOrRedial(
+      [&](IConnection &connection) { return connection.Write(message); });
+}
+
+Message PooledConnection::Read(int timeout) {
+  if (!connection_)
+    return Message{};
+  Message message = connection_->Read(timeout);
+  is_healthy_ = is_healthy_ && message.is_succeed;
+  return message;
+}
+
+bool PooledConnection::Read(Message &message, int timeout) {
+  if (!connection_) {
+    message = Message{};
+    return false;
+  }
+  is_healthy_ = connection_->Read(message, timeout) && is_healthy_;
+  return message.is_succeed;
+}
+
+bool PooledConnection::Flush() {
+  if (!connection_)
+    return false;
+  is_healthy_ = is_healthy_ && connection_->Flush();
+  return is_healthy_;
+}
+
+void PooledConnection::set_ack_window(std::size_t frames) {
+  ack_window_ = frames;
+  if (connection_)
+    connection_->set_ack_window(frames);
+}
+
+void PooledConnection::set_ack_timeout(int timeout) {
+  ack_timeout_ = timeout;
+  if (connection_)
+    connection_->set_ack_timeout(timeout);
+}
+
+void PooledConnection::Close() {
+  if (!connection_)
+    return;
+  // Unacknowledged frames stay with the connection, the next user collects
+  // their acks once its ack window fills up.
+  if (is_healthy_) {
+    pool_.Release(address_, std::move(connection_));
+  } else {
+    connection_->Close();
+    connection_.reset();
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef CONNECTION_POOL_H_
+#define CONNECTION_POOL_H_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "i_connection_method.h"
+
+// IClient decorator that keeps connections open between Connect() calls.
+//
+// Connect() returns a lease on a cached connection to the address, dialing
+// only when there is none. Closing the lease puts a healthy connection back
+// into the cache. A connection that failed a Write() or Read() is evicted.
+// A Write() on a reused connection that failed before sending anything is
+// retried once on a fresh one, as the peer may have restarted since it was
+// cached; one that was sent may have arrived and is not repeated.
+// Connections whose transport cannot be reused are closed as before.
+class PooledClient : public IClient {
+public:
+  explicit PooledClient(std::unique_ptr<IClient> client);
+  PooledClient(const PooledClient &) = delete;
+  PooledClient &operator=(const PooledClient &) = delete;
+
+  std::unique_ptr<IConnection> Connect(const IAddress &address,
+                                       int timeout) override;
+
+private:
+  friend class PooledConnection;
+  std::unique_ptr<IConnection> Dial(const std::string &address, int timeout);
+  void Release(const std::string &address,
+               std::unique_ptr<IConnection> connection);
+  std::unique_ptr<IClient> client_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::unique_ptr<IConnection>> idle_;
+};
+
+class PooledConnection : public IConnection {
+public:
+  PooledConnection(PooledClient &pool, std::string address,
+                   std::unique_ptr<IConnection> connection, bool is_reused,
+                   int timeout);
+  ~PooledConnection() override;
+
+  bool Write(Message &message) override;
+  bool Write(const EncodedMessage &message) override;
+  using IConnection::Read;
+  Message Read(int timeout) override;
+  bool Read(Message &message, int timeout) override;
+  void Close() override;
+  bool is_server() const override { return false; }
+  bool is_last_write_sent() const override { return is_last_write_sent_; }
+  // whether the connection leased is, so that a user may keep the lease
+  bool is_reusable() const override {
+    return connection_ && connection_->is_reusable();
+  }
+  bool Flush() override;
+  void set_ack_window(std::size_t frames) override;
+  void set_ack_timeout(int timeout) override;
+
+private:
+  // Writes with `write`, redialing once if a cached connection turned out
+  // to be broken before the message went out.
+  template <class WriteFunction> bool WriteOrRedial(WriteFunction write);
+  PooledClient &pool_;
+  std::string address_;
+  std::unique_ptr<IConnection> connection_;
+  bool is_reused_;
+  bool is_healthy_ = true;
+  bool is_last_write_sent_ = true;
+  int timeout_;
+  // applied again to a redialed connection
+  std::size_t ack_window_ = 1;
+  int ack_timeout_ = -1;
+};
+
+#endif // CONNECTION_POOL_H_
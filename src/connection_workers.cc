@@ -0,0 +1,106 @@
+#include "connection_workers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+ConnectionWorkers::ConnectionWorkers(IServer &server,
+                                     ConnectionHandler handler,
+                                     std::size_t workers,
+                                     std::size_t max_in_flight)
+    : server_(server), handler_(std::move(handler)),
+      worker_count_(std::max<std::size_t>(workers, 1)),
+      queued_(max_in_flight), returned_(max_in_flight) {}
+
+ConnectionWorkers::~ConnectionWorkers() { Stop(); }
+
+void ConnectionWorkers::Start() {
+  for (std::size_t i = 0; i < worker_count_; ++i)
+    workers_.emplace_back(&ConnectionWorkers::WorkerLoop, this);
+  acceptor_ = std::thread(&ConnectionWorkers::AcceptLoop, this);
+}
+
+void ConnectionWorkers::Stop() {
+  is_stopped_ = true;
+  server_.Interrupt();
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    has_work_.notify_all();
+  }
+  for (auto &worker : workers_)
+    worker.join();
+  workers_.clear();
+  if (acceptor_.joinable())
+    acceptor_.join();
+  std::unique_ptr<IConnection> connection;
+  while (queued_.TryPop(connection) || returned_.TryPop(connection))
+    connection->Close();
+}
+
+void ConnectionWorkers::AcceptLoop() {
+  using namespace std::chrono_literals;
+  // the queues hold every connection in flight, so pushes cannot fail
+  std::size_t capacity = std::min(queued_.capacity(), returned_.capacity());
+  while (!is_stopped_) {
+    CloseReturned();
+    std::size_t room = capacity - in_flight_.load(std::memory_order_acquire);
+    if (room == 0) {
+      // the workers are behind, the server holds the rest back
+      std::this_thread::sleep_for(1ms);
+      continue;
+    }
+    std::vector<std::unique_ptr<IConnection>> connections =
+        server_.WaitForConnections(kAcceptTimeout,
+                                   std::min(room, kAcceptBatch));
+    if (connections.empty())
+      continue;
+    in_flight_.fetch_add(connections.size(), std::memory_order_relaxed);
+    // counted first, a worker never takes the count below zero
+    queued_count_.fetch_add(connections.size());
+    for (auto &connection : connections)
+      queued_.TryPush(connection);
+    if (sleeping_.load() != 0) {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      if (connections.size() == 1)
+        has_work_.notify_one();
+      else
+        has_work_.notify_all();
+    }
+  }
+}
+
+void ConnectionWorkers::CloseReturned() {
+  is_return_signalled_.store(false);
+  std::unique_ptr<IConnection> connection;
+  while (returned_.TryPop(connection)) {
+    connection->Close();
+    connection.reset();
+    in_flight_.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+void ConnectionWorkers::WorkerLoop() {
+  std::unique_ptr<IConnection> connection;
+  while (Take(connection)) {
+    handler_(*connection);
+    returned_.TryPush(connection);
+    // one interrupt until the acceptor got to the returned connections
+    if (!is_return_signalled_.exchange(true))
+      server_.Interrupt();
+  }
+}
+
+bool ConnectionWorkers::Take(std::unique_ptr<IConnection> &connection) {
+  while (!is_stopped_) {
+    if (queued_.TryPop(connection)) {
+      queued_count_.fetch_sub(1);
+      return true;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleeping_.fetch_add(1);
+    has_work_.wait(lock,
+                   [this] { return queued_count_.load() != 0 || is_stopped_; });
+    sleeping_.fetch_sub(1);
+  }
+  return false;
+}
@@ -0,0 +1,72 @@
+#ifndef CONNECTION_WORKERS_H_
+#define CONNECTION_WORKERS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "i_connection_method.h"
+#include "mpmc_queue.h"
+
+// Serves the connections of an IServer on a pool of threads. An acceptor
+// thread takes batches of connections off the server and hands them to the
+// workers over a lock-free queue; a worker that finds it empty sleeps until
+// the acceptor hands out more.
+//
+// Servers are not thread safe and take connections back on Close(), so a
+// worker does not close its connection: it returns it over a second queue,
+// and the acceptor closes it. The handler must not close it either.
+class ConnectionWorkers {
+public:
+  using ConnectionHandler = std::function<void(IConnection &)>;
+  // Connections handed out and not yet returned, the acceptor leaves the
+  // rest waiting in the server.
+  static constexpr std::size_t kDefaultMaxInFlight = 4096;
+
+  ConnectionWorkers(IServer &server, ConnectionHandler handler,
+                    std::size_t workers,
+                    std::size_t max_in_flight = kDefaultMaxInFlight);
+  ~ConnectionWorkers();
+  ConnectionWorkers(const ConnectionWorkers &) = delete;
+  ConnectionWorkers &operator=(const ConnectionWorkers &) = delete;
+
+  void Start();
+  // Returns once the threads are gone; connections still queued are
+  // dropped. Not from a handler.
+  void Stop();
+
+private:
+  // the acceptor's wait for connections, so that it gets to returned ones
+  static constexpr int kAcceptTimeout = 100;
+  static constexpr std::size_t kAcceptBatch = 64;
+  void AcceptLoop();
+  void WorkerLoop();
+  void CloseReturned();
+  // Blocks until a connection is queued. Returns false on Stop().
+  bool Take(std::unique_ptr<IConnection> &connection);
+  IServer &server_;
+  ConnectionHandler handler_;
+  std::size_t worker_count_;
+  MpmcQueue<std::unique_ptr<IConnection>> queued_;
+  MpmcQueue<std::unique_ptr<IConnection>> returned_;
+  std::atomic<std::size_t> in_flight_{0};
+  // Workers announce that they are about to sleep before they check the
+  // queue once more, the acceptor counts queued connections before it looks
+  // for sleepers: one of the two sees the other.
+  std::atomic<std::size_t> queued_count_{0};
+  std::atomic<std::size_t> sleeping_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable has_work_;
+  // set while an interrupt for returned connections is pending
+  std::atomic<bool> is_return_signalled_{false};
+  std::atomic<bool> is_stopped_{false};
+  std::thread acceptor_;
+  std::vector<std::thread> workers_;
+};
+
+#endif // CONNECTION_WORKERS_H_
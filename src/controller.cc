@@ -1,140 +1,543 @@
-#include "controller.h"
-
-#include <iostream>
-#include <memory>
-
-using namespace std::chrono_literals;
-const Clock::duration Controller::max_server_response = 6s;
-
-Controller::Controller(IConnectionMethodFactory &factory)
-    : connection_factory_(factory),
-      connection_server_(factory.NewServer(*factory.ControllerAddress())),
-      connection_client_(factory.NewClient()) {}
-
-void Controller::Run() {
-  LOG(kINFO) << "Controller is running...";
-  while (true) {
-    std::unique_ptr<IConnection> connection =
-        connection_server_->WaitForConnection(5000);
-    if (!connection) {
-      ChooseNewServer();
-      if (connected_nodes_addresses_.empty())
-        return;
-      else
-        continue;
-    }
-    Message m = connection->Read();
-    connection->Close();
-    if (!m.is_succeed) {
-      continue;
-      // error
-    }
-    if (m.type == MessageType::kTEST_CONTROLLER) {
-      continue;
-    }
-    switch (m.client_role) {
-    case ClientRole::kCLIENT: {
-      switch (m.type) {
-      case MessageType::kNEW_CLIENT: {
-        LOG(kINFO) << "Got NEW_CLIENT from " << m.addresses[0];
-        if (connected_nodes_addresses_.size() + 1 > kMaxNodes)
-          LOG(kINFO) << "Too many nodes. Rejected!";
-        connected_nodes_addresses_.emplace(m.addresses[0]);
-      } break;
-      default:
-        LOG(kDEBUG) << "Protocol error: got incorrect message type from client";
-        continue;
-      }
-
-    } break;
-    case ClientRole::kSERVER: {
-      switch (m.type) {
-      case MessageType::kNEW_TIME: {
-        last_server_response_ = Clock::now();
-        LOG(kINFO) << "Got new time: "
-                   << SerializeTimePoint(last_server_response_,
-                                         "UTC: %Y-%m-%d %H:%M:%S");
-        continue;
-      } break;
-      default:
-        LOG(kDEBUG) << "Protocol error: got incorrect message type from server";
-        continue;
-      }
-    } break;
-    case ClientRole::kCONTROLLER: {
-      LOG(kDEBUG) << "Error: got controller message in controller";
-      continue;
-    } break;
-    }
-    // if we are here, we got message NEW_CLIENT from CLIENT
-    if (Clock::now() - last_server_response_ > max_server_response) {
-      // server was not responding too many time
-      ChooseNewServer();
-      if (connected_nodes_addresses_.empty()) {
-        return;
-      }
-    }
-    // send message to server to add new client to it
-    bool was_server_acknowledgment_succeed = false;
-    while (!was_server_acknowledgment_succeed &&
-           !connected_nodes_addresses_.empty()) {
-      std::unique_ptr<IConnection> server_connection =
-          connection_client_->Connect(*server_address_, 1000);
-
-      if (!server_connection) {
-        // could not make connection to server
-        ChooseNewServer();
-        continue;
-      }
-
-      m.client_role = role;
-      if (!server_connection->Write(m)) {
-        // connection to server lost
-        server_connection->Close();
-        ChooseNewServer();
-        continue;
-      }
-      was_server_acknowledgment_succeed = true;
-      server_connection->Close();
-    }
-    if (!was_server_acknowledgment_succeed)
-      return;
-  }
-}
-
-void Controller::ChooseNewServer() {
-  LOG(kINFO) << "Server died or not set yet. Choosing new server...";
-  while (!connected_nodes_addresses_.empty()) {
-    auto supposed_new_server_it = connected_nodes_addresses_.begin();
-    server_address_ = connection_factory_.NewAddress(*supposed_new_server_it);
-    LOG(kINFO) << "Attempt to make " << server_address_->raw()
-               << " to be a server";
-    Message m;
-    m.client_role = role;
-    m.type = MessageType::kSET_SERVER;
-
-    int i = 0;
-    for (auto &client_address : connected_nodes_addresses_) {
-      LOG(kINFO) << "Copying " << client_address << " to message";
-      client_address.copy(m.addresses[i++], kMaxAddressLength);
-    }
-    m.addresses_count = i;
-
-    {
-      LOG(kINFO) << "Attempt to connect to " << server_address_->raw();
-      std::unique_ptr<IConnection> new_server_connection =
-          connection_client_->Connect(*server_address_, 100);
-      if (!new_server_connection) {
-        connected_nodes_addresses_.erase(supposed_new_server_it);
-        continue;
-      }
-      if (!new_server_connection->Write(m)) {
-        connected_nodes_addresses_.erase(supposed_new_server_it);
-        continue;
-      }
-      LOG(kINFO) << "Successfully made " << server_address_->raw()
-                 << " a server";
-      return;
-    }
-  }
-}
\ No newline at end of file
+#include "controller.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "connection_pool.h"
+#include "metrics.h"
+
+Controller::Controller(IConnectionMethodFactory &factory,
+                       std::size_t max_nodes, double failure_threshold,
+                       std::size_t relay_fanout,
+                       const std::string &journal_path,
+                       std::size_t worker_threads)
+    : members_gauge_(Metrics::Instance().gauge("controller.members")),
+      connection_factory_(factory), max_nodes_(max_nodes),
+      connected_nodes_addresses_(&factory),
+      server_detector_(kHeartbeatInterval, kHeartbeatInterval / 4,
+                       failure_threshold),
+      relay_fanout_(relay_fanout), relay_tree_(relay_fanout),
+      connection_server_(factory.NewServer(*factory.ControllerAddress())),
+      connection_client_(
+          std::make_unique<PooledClient>(factory.NewClient())),
+      loop_(worker_threads == 0 ? connection_server_.get() : nullptr,
+            [this](std::unique_ptr<IConnection> connection) {
+              HandleConnection(std::move(connection));
+            }),
+      prober_(*connection_client_, kProbeWorkers), pusher_(1) {
+  if (worker_threads != 0)
+    workers_ = std::make_unique<ConnectionWorkers>(
+        *connection_server_,
+        [this](IConnection &connection) { ServeConnection(connection); },
+        worker_threads);
+  if (!journal_path.empty())
+    Restore(journal_path);
+}
+
+void Controller::Restore(const std::string &journal_path) {
+  static Histogram &restore_latency =
+      Metrics::Instance().histogram("controller.restore");
+  ScopedLatency latency(restore_latency);
+  ControllerState state;
+  journal_ = ControllerJournal::Open(journal_path, state);
+  if (!journal_) {
+    LOG(kERRORS) << "Running without a journal";
+    return;
+  }
+  connected_nodes_addresses_.Restore(state.members, state.epoch,
+                                     state.last_id);
+  // known already, nothing to admit
+  for (auto &member : state.members)
+    registrations_.Insert(member.address, SIZE_MAX);
+  registrations_.Drain([](const std::string &) {});
+  const MembershipTable &members = connected_nodes_addresses_.table();
+  members_gauge_.Set(members.size());
+  if (members.empty())
+    return;
+  // The server kept serving meanwhile and gets the time it takes to reach
+  // us again. If it went away too, it is replaced as usual.
+  std::size_t server = members.position(state.server);
+  if (server != members.size()) {
+    server_address_ = members.at(server).resolved;
+    server_id_ = state.server;
+    server_epoch_ = state.server_epoch;
+    last_server_response_ = SteadyClock::now();
+    server_detector_.Reset(last_server_response_);
+  }
+  LOG(kINFO) << "Restored " << members.size() << " members at epoch "
+             << state.epoch << " from " << journal_path << ", server "
+             << (server_address_ ? server_address_->raw() : "none");
+}
+
+bool Controller::InsertMember(const std::string &address) {
+  NodeId id = connected_nodes_addresses_.Insert(address);
+  if (id == kNoNode)
+    return false;
+  if (journal_ &&
+      !journal_->Join(connected_nodes_addresses_.epoch(), id, address))
+    DropJournal();
+  return true;
+}
+
+void Controller::EraseMember(NodeId id) {
+  const MembershipTable &members = connected_nodes_addresses_.table();
+  std::size_t position = members.position(id);
+  if (position == members.size())
+    return;
+  registrations_.Erase(members.at(position).address);
+  connected_nodes_addresses_.Erase(id);
+  missed_probes_.erase(id);
+  if (journal_ && !journal_->Leave(connected_nodes_addresses_.epoch(), id))
+    DropJournal();
+}
+
+void Controller::JournalServer() {
+  if (journal_ && !journal_->SetServer(server_epoch_, server_id_))
+    DropJournal();
+}
+
+void Controller::MaintainJournal() {
+  static Counter &compactions =
+      Metrics::Instance().counter("controller.journal_compactions");
+  if (!journal_)
+    return;
+  const MembershipTable &members = connected_nodes_addresses_.table();
+  if (journal_->is_compaction_due(members.size())) {
+    compactions.Increment();
+    if (!journal_->Compact(members, connected_nodes_addresses_.epoch(),
+                           connected_nodes_addresses_.last_id(), server_id_,
+                           server_epoch_)) {
+      DropJournal();
+      return;
+    }
+  }
+  if (!journal_->Flush())
+    DropJournal();
+}
+
+void Controller::DropJournal() {
+  LOG(kERRORS) << "Journal failed, the state is no longer kept";
+  journal_.reset();
+}
+
+void Controller::Run() {
+  LOG(kINFO) << "Controller is running...";
+  loop_.RunEvery(kWatchPeriod, [this] { WatchServer(); });
+  loop_.RunEvery(kWatchPeriod, [this] { SyncIfDue(); });
+  loop_.RunEvery(kIdleTimeout, [this] { CheckIdle(); });
+  if (journal_)
+    loop_.RunEvery(kJournalPeriod, [this] { MaintainJournal(); });
+  if (workers_)
+    workers_->Start();
+  loop_.Run();
+  if (workers_)
+    workers_->Stop();
+}
+
+void Controller::HandleConnection(std::unique_ptr<IConnection> connection) {
+  Message m = connection->Read(kReadTimeout);
+  if (m.type == MessageType::kGET_STATS)
+    ReplyStats(*connection);
+  connection->Close();
+  OnMessage(m);
+}
+
+void Controller::ServeConnection(IConnection &connection) {
+  Message m = connection.Read(kReadTimeout);
+  if (m.type == MessageType::kGET_STATS)
+    ReplyStats(connection);
+  if (!m.is_succeed || m.client_role != ClientRole::kCLIENT ||
+      m.type != MessageType::kNEW_CLIENT || m.addresses.empty()) {
+    loop_.Post([this, m = std::move(m)] { OnMessage(m); });
+    return;
+  }
+  Register(m);
+  // one admission for all the registrations that come in until it runs
+  if (is_admission_posted_.exchange(true))
+    return;
+  loop_.Post([this] {
+    is_admission_posted_ = false;
+    last_message_at_ = SteadyClock::now();
+    AdmitRegistrations();
+    SyncIfFull(last_message_at_);
+  });
+}
+
+void Controller::OnMessage(const Message &m) {
+  last_message_at_ = SteadyClock::now();
+  HandleMessage(m);
+  SyncIfFull(last_message_at_);
+}
+
+void Controller::SyncIfFull(SteadyClock::time_point now) {
+  // a registration storm is flushed without waiting for the window
+  if (server_address_ && IsSyncDue(now)) {
+    SyncServer();
+    SyncRelays();
+  }
+}
+
+void Controller::WatchServer() {
+  auto now = SteadyClock::now();
+  bool is_late = now - last_watch_at_ > 2 * kWatchPeriod;
+  last_watch_at_ = now;
+  if (!server_address_ || is_late || !server_detector_.IsSuspected(now))
+    return;
+  LOG(kINFO) << "Server " << server_address_->raw()
+             << " is suspected, phi " << server_detector_.Phi(now);
+  ChooseNewServer();
+  SyncRelays();
+}
+
+void Controller::SyncIfDue() {
+  if (connected_nodes_addresses_.table().empty())
+    return;
+  if (!server_address_) {
+    ChooseNewServer();
+    SyncRelays();
+  } else if (IsSyncDue(SteadyClock::now())) {
+    SyncServer();
+    SyncRelays();
+  }
+}
+
+void Controller::CheckIdle() {
+  if (connected_nodes_addresses_.table().empty() &&
+      SteadyClock::now() - last_message_at_ >= kIdleTimeout)
+    Stop();
+}
+
+bool Controller::is_from_server(const Message &m) const {
+  return server_address_ && m.node_id == server_id_;
+}
+
+void Controller::HandleMessage(const Message &m) {
+  if (!m.is_succeed) {
+    return;
+    // error
+  }
+  if (m.type == MessageType::kTEST_CONTROLLER ||
+      m.type == MessageType::kGET_STATS) {
+    return;
+  }
+  switch (m.client_role) {
+  case ClientRole::kCLIENT: {
+    switch (m.type) {
+    case MessageType::kNEW_CLIENT: {
+      if (m.addresses.empty()) {
+        LOG(kDEBUG) << "Protocol error: NEW_CLIENT without address";
+        return;
+      }
+      Register(m);
+      AdmitRegistrations();
+    } break;
+    default:
+      LOG(kDEBUG) << "Protocol error: got incorrect message type from client";
+    }
+  } break;
+  case ClientRole::kSERVER: {
+    switch (m.type) {
+    case MessageType::kNEW_TIME:
+    case MessageType::kHEARTBEAT: {
+      // a replaced server that still believes in itself
+      if (!is_from_server(m)) {
+        LOG(kDEBUG) << "Ignoring server message from a node that is not the "
+                       "server";
+        return;
+      }
+      last_server_response_ = SteadyClock::now();
+      server_detector_.Heartbeat(last_server_response_);
+      if (m.type == MessageType::kNEW_TIME)
+        LOG(kINFO) << "Got new time: "
+                   << SerializeTimePoint(Clock::now(),
+                                         "UTC: %Y-%m-%d %H:%M:%S");
+      // a server behind what we sent lost an update, resend from its epoch
+      if (m.epoch < server_epoch_) {
+        LOG(kDEBUG) << "Server is at epoch " << m.epoch << ", expected "
+                    << server_epoch_;
+        server_epoch_ = m.epoch;
+        JournalServer();
+      }
+    } break;
+    case MessageType::kMEMBERSHIP_DELTA:
+      DropUnreachable(m);
+      break;
+    default:
+      LOG(kDEBUG) << "Protocol error: got incorrect message type from server";
+    }
+  } break;
+  case ClientRole::kRELAY: {
+    if (m.type != MessageType::kMEMBERSHIP_DELTA) {
+      LOG(kDEBUG) << "Protocol error: got incorrect message type from relay";
+      return;
+    }
+    DropUnreachable(m);
+  } break;
+  case ClientRole::kCONTROLLER: {
+    LOG(kDEBUG) << "Error: got controller message in controller";
+  } break;
+  }
+}
+
+void Controller::Register(const Message &m) {
+  // one frame may register several nodes
+  for (auto &address : m.addresses) {
+    LOG(kINFO) << "Got NEW_CLIENT from " << address;
+    if (registrations_.Insert(address, max_nodes_) ==
+        ShardedMembership::InsertResult::kFULL)
+      LOG(kINFO) << "Too many nodes. Rejected!";
+  }
+}
+
+void Controller::AdmitRegistrations() {
+  registrations_.Drain(
+      [this](const std::string &address) { InsertMember(address); });
+  members_gauge_.Set(connected_nodes_addresses_.table().size());
+}
+
+void Controller::DropUnreachable(const Message &m) {
+  // the relay tree is laid out again without them
+  for (NodeId id : m.removed_ids) {
+    LOG(kINFO) << "Dropping unreachable node " << id;
+    EraseMember(id);
+  }
+  members_gauge_.Set(connected_nodes_addresses_.table().size());
+}
+
+void Controller::SyncRelays() {
+  const MembershipTable &members = connected_nodes_addresses_.table();
+  if (relay_fanout_ == 0 || !server_address_ || !members.Contains(server_id_))
+    return;
+  if (relay_epoch_ == connected_nodes_addresses_.epoch() &&
+      relay_root_ == server_id_)
+    return;
+  relay_epoch_ = connected_nodes_addresses_.epoch();
+  relay_root_ = server_id_;
+  std::vector<RelayTree::Assignment> changes =
+      relay_tree_.Update(members, relay_root_);
+  LOG(kINFO) << "Relay tree changed for " << changes.size() << " nodes";
+  std::vector<RelayPush> pushes;
+  pushes.reserve(changes.size());
+  for (auto &[id, children] : changes) {
+    Message m;
+    m.client_role = role;
+    m.type = MessageType::kSET_RELAY;
+    // the node resolves its children once, from their addresses
+    m.addresses.reserve(children.size());
+    for (NodeId child : children)
+      m.addresses.push_back(members.at(members.position(child)).address);
+    m.node_ids = std::move(children);
+    pushes.push_back(
+        RelayPush{id, members.at(members.position(id)).resolved, std::move(m)});
+  }
+  pusher_.Submit([this, pushes = std::move(pushes)]() mutable {
+    std::vector<NodeId> unreachable;
+    for (RelayPush &push : pushes) {
+      std::unique_ptr<IConnection> connection =
+          connection_client_->Connect(*push.address, 100);
+      if (!connection || !connection->Write(push.message))
+        unreachable.push_back(push.id);
+    }
+    if (!unreachable.empty())
+      loop_.Post([this, unreachable] { DropMembers(unreachable); });
+  });
+}
+
+void Controller::DropMembers(const std::vector<NodeId> &ids) {
+  // caught on the next sync, the erases bump the epoch
+  for (NodeId id : ids)
+    EraseMember(id);
+  members_gauge_.Set(connected_nodes_addresses_.table().size());
+}
+
+bool Controller::IsSyncDue(SteadyClock::time_point now) {
+  std::uint64_t epoch = connected_nodes_addresses_.epoch();
+  if (server_epoch_ == epoch) {
+    sync_pending_since_ = {};
+    return false;
+  }
+  if (sync_pending_since_ == SteadyClock::time_point{})
+    sync_pending_since_ = now;
+  return epoch - server_epoch_ >= kSyncBatch ||
+         now - sync_pending_since_ >= kSyncWindow;
+}
+
+void Controller::SyncServer() {
+  static Counter &syncs = Metrics::Instance().counter("controller.syncs");
+  sync_pending_since_ = {};
+  if (!server_address_ || server_epoch_ == connected_nodes_addresses_.epoch())
+    return;
+  syncs.Increment();
+  Message m;
+  m.client_role = role;
+  bool is_delta = connected_nodes_addresses_.MakeDelta(server_epoch_, m);
+  if (is_delta) {
+    LOG(kINFO) << "Sending " << m.node_ids.size() << " joins and "
+               << m.removed_ids.size() << " leaves to the server";
+  } else {
+    const MembershipTable &members = connected_nodes_addresses_.table();
+    m.type = MessageType::kSET_SERVER;
+    m.epoch = connected_nodes_addresses_.epoch();
+    m.node_id = server_id_;
+    m.node_ids.reserve(members.size());
+    m.addresses.reserve(members.size());
+    members.ForEach([&](const Member &member) {
+      m.node_ids.push_back(member.id);
+      m.addresses.push_back(member.address);
+    });
+    LOG(kINFO) << "Sending " << members.size() << " addresses to the server";
+  }
+  // Taken as done. A server that missed it reports its older epoch with the
+  // next heartbeat and gets the changes again from there.
+  server_epoch_ = connected_nodes_addresses_.epoch();
+  JournalServer();
+  pusher_.Submit([this, address = server_address_, id = server_id_,
+                  m = std::move(m)]() mutable {
+    std::unique_ptr<IConnection> server_connection =
+        connection_client_->Connect(*address, 1000);
+    bool is_written =
+        server_connection && WriteChunked(*server_connection, std::move(m));
+    if (server_connection)
+      server_connection->Close();
+    if (!is_written)
+      loop_.Post([this, id] { OnSyncFailed(id); });
+  });
+}
+
+void Controller::OnSyncFailed(NodeId server) {
+  // replaced meanwhile
+  if (server != server_id_)
+    return;
+  // connection to server lost
+  ChooseNewServer();
+  SyncRelays();
+}
+
+void Controller::ReplyStats(IConnection &connection) {
+  Message m;
+  m.client_role = role;
+  m.type = MessageType::kSTATS;
+  m.text = Metrics::Instance().DumpJson();
+  connection.Write(m);
+}
+
+void Controller::ChooseNewServer() {
+  static Histogram &election_latency =
+      Metrics::Instance().histogram("controller.election");
+  static Histogram &failover_latency =
+      Metrics::Instance().histogram("controller.failover");
+  static Counter &elections =
+      Metrics::Instance().counter("controller.elections");
+  ScopedLatency latency(election_latency);
+  elections.Increment();
+  bool had_server = last_server_response_ != SteadyClock::time_point{};
+  LOG(kINFO) << "Server died or not set yet. Choosing new server...";
+  const MembershipTable &members = connected_nodes_addresses_.table();
+  // Nodes that did not answer are skipped, not erased: a live node may just
+  // be busy. They are erased once they missed kMaxMissedProbes in a row.
+  // All candidates share one probe timeout, the ones that missed probes
+  // last, so that stale entries do not hold up the live ones. The probe ends
+  // once kElectionCandidates answered.
+  auto missed_probes = [this](NodeId id) {
+    auto it = missed_probes_.find(id);
+    return it == missed_probes_.end() ? 0u : it->second;
+  };
+  std::vector<Member> candidates;
+  candidates.reserve(members.size());
+  members.ForEach(
+      [&](const Member &member) { candidates.push_back(member); });
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [&](const Member &a, const Member &b) {
+                     return missed_probes(a.id) < missed_probes(b.id);
+                   });
+  Broadcaster::Targets targets;
+  targets.reserve(candidates.size());
+  for (const Member &candidate : candidates)
+    targets.push_back(candidate.resolved);
+  Message probe;
+  probe.client_role = role;
+  probe.type = MessageType::kPROBE;
+  std::vector<Broadcaster::Latency> latencies =
+      prober_.Probe(std::move(targets), probe, kProbeTimeout,
+                    kElectionCandidates);
+
+  std::vector<NodeId> missed;
+  std::vector<std::size_t> alive;
+  for (std::size_t i = 0; i < candidates.size(); ++i) {
+    if (latencies[i] == Broadcaster::kNotProbed)
+      continue;
+    if (latencies[i] == Broadcaster::kUnreachable) {
+      missed.push_back(candidates[i].id);
+    } else {
+      alive.push_back(i);
+      missed_probes_.erase(candidates[i].id);
+    }
+  }
+  LOG(kINFO) << alive.size() << " of " << candidates.size()
+             << " candidates answered the probe";
+  std::sort(alive.begin(), alive.end(), [&](std::size_t a, std::size_t b) {
+    return latencies[a] < latencies[b];
+  });
+
+  bool is_elected = false;
+  for (std::size_t i : alive) {
+    if (!Promote(candidates[i])) {
+      missed.push_back(candidates[i].id);
+      continue;
+    }
+    // time since the old server was last heard of
+    if (had_server)
+      failover_latency.Record(SteadyClock::now() - last_server_response_);
+    last_server_response_ = SteadyClock::now();
+    is_elected = true;
+    break;
+  }
+  for (NodeId id : missed) {
+    if (++missed_probes_[id] >= kMaxMissedProbes) {
+      LOG(kINFO) << "Dropping node " << id << ", it missed "
+                 << kMaxMissedProbes << " probes";
+      EraseMember(id);
+    }
+  }
+  members_gauge_.Set(members.size());
+  if (is_elected)
+    return;
+  server_address_.reset();
+  server_id_ = kNoNode;
+  JournalServer();
+  if (!members.empty()) {
+    // SyncIfDue() tries again
+    LOG(kINFO) << "No candidate could be made the server";
+    return;
+  }
+  LOG(kINFO) << "No node is left to serve";
+  Stop();
+}
+
+bool Controller::Promote(const Member &member) {
+  const MembershipTable &members = connected_nodes_addresses_.table();
+  server_address_ = member.resolved;
+  server_id_ = member.id;
+  LOG(kINFO) << "Attempt to make " << server_address_->raw()
+             << " to be a server";
+  Message m;
+  m.client_role = role;
+  m.type = MessageType::kSET_SERVER;
+  m.epoch = connected_nodes_addresses_.epoch();
+  // the node learns its id
+  m.node_id = member.id;
+  LOG(kINFO) << "Sending " << members.size() << " addresses to the new server";
+  std::unique_ptr<IConnection> new_server_connection =
+      connection_client_->Connect(*server_address_, 100);
+  if (!new_server_connection ||
+      !WriteChunked(*new_server_connection, m, members))
+    return false;
+  LOG(kINFO) << "Successfully made " << server_address_->raw() << " a server";
+  server_epoch_ = connected_nodes_addresses_.epoch();
+  server_detector_.Reset(SteadyClock::now());
+  JournalServer();
+  return true;
+}
@@ -1,35 +1,168 @@
-#ifndef CONTROLLER_H_
-#define CONTROLLER_H_
-
-#include <chrono>
-#include <memory>
-#include <string>
-#include <unordered_set>
-
-#include "common.h"
-#include "log.h"
-#include "pipe.h"
-
-class Controller {
-public:
-  Controller(IConnectionMethodFactory &factory);
-  Controller(Controller &&) = delete;
-  Controller(const Controller &) = delete;
-  Controller &operator=(Controller &&) = delete;
-  Controller &operator=(const Controller &) = delete;
-
-  void Run();
-
-private:
-  static const Clock::duration max_server_response;
-  static constexpr ClientRole role = ClientRole::kCONTROLLER;
-  void ChooseNewServer();
-  IConnectionMethodFactory &connection_factory_;
-  std::unordered_set<std::string> connected_nodes_addresses_;
-  std::unique_ptr<IAddress> server_address_;
-  TimePoint last_server_response_{};
-  std::unique_ptr<IServer> connection_server_;
-  std::unique_ptr<IClient> connection_client_;
-};
-
-#endif // CONTROLLER_H_
+#ifndef CONTROLLER_H_
+#define CONTROLLER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "broadcaster.h"
+#include "common.h"
+#include "connection_workers.h"
+#include "controller_journal.h"
+#include "event_loop.h"
+#include "failure_detector.h"
+#include "log.h"
+#include "membership.h"
+#include "metrics.h"
+#include "i_connection_method.h"
+#include "relay_tree.h"
+#include "thread_pool.h"
+
+class Controller {
+public:
+  // Guards memory against runaway registrations, not a protocol limit.
+  static constexpr std::size_t kDefaultMaxNodes = 1 << 16;
+  // `failure_threshold` is the phi at which the server is given up on, see
+  // failure_detector.h. With a `relay_fanout` the nodes are arranged into a
+  // relay tree of that degree, see relay_tree.h; 0 leaves the server to send
+  // to every client itself. With a `journal_path` the members and the server
+  // are kept in a journal there and taken up again from it on start, see
+  // controller_journal.h. With `worker_threads`, connections are read on
+  // that many threads and registrations taken concurrently, while elections
+  // and syncs go on; 0 serves everything on the thread of Run().
+  explicit Controller(
+      IConnectionMethodFactory &factory,
+      std::size_t max_nodes = kDefaultMaxNodes,
+      double failure_threshold = FailureDetector::kDefaultThreshold,
+      std::size_t relay_fanout = 0, const std::string &journal_path = "",
+      std::size_t worker_threads = 0);
+  Controller(Controller &&) = delete;
+  Controller(const Controller &) = delete;
+  Controller &operator=(Controller &&) = delete;
+  Controller &operator=(const Controller &) = delete;
+
+  void Run();
+  // Makes Run() return after the handler in progress. Safe to call from any
+  // thread.
+  void Stop() { loop_.Stop(); }
+
+private:
+  using SteadyClock = FailureDetector::SteadyClock;
+  static constexpr ClientRole role = ClientRole::kCONTROLLER;
+  // how often the failure detector is asked, and pending syncs are checked
+  static constexpr std::chrono::milliseconds kWatchPeriod{10};
+  // without members and messages for that long the controller quits
+  static constexpr std::chrono::seconds kIdleTimeout{5};
+  // Workers probing the candidates of an election, all within kProbeTimeout.
+  static constexpr std::size_t kProbeWorkers = 32;
+  static constexpr std::chrono::milliseconds kProbeTimeout{100};
+  // answers an election waits for, the fastest is promoted first
+  static constexpr std::size_t kElectionCandidates = 4;
+  // election probes in a row a node may miss before it is erased
+  static constexpr unsigned kMaxMissedProbes = 3;
+  // Membership changes are held back for up to kSyncWindow, or until
+  // kSyncBatch of them piled up, and reach the server as one delta.
+  static constexpr std::chrono::milliseconds kSyncWindow{20};
+  static constexpr std::uint64_t kSyncBatch = 1024;
+  // how often the journal is written to disk and checked for compaction
+  static constexpr std::chrono::seconds kJournalPeriod{1};
+  // Takes up the state a previous controller left in the journal.
+  void Restore(const std::string &journal_path);
+  // Membership and server changes go through these, to be journaled.
+  bool InsertMember(const std::string &address);
+  void EraseMember(NodeId id);
+  void JournalServer();
+  void MaintainJournal();
+  // Goes on without the journal once it failed.
+  void DropJournal();
+  void HandleConnection(std::unique_ptr<IConnection> connection);
+  // Runs on the workers. Registrations go to the sharded set, everything
+  // else is posted to the loop.
+  void ServeConnection(IConnection &connection);
+  void OnMessage(const Message &m);
+  void HandleMessage(const Message &m);
+  // Adds the addresses of a kNEW_CLIENT to `registrations_`. Any thread.
+  void Register(const Message &m);
+  // Makes members of the registrations that came in since the last call.
+  void AdmitRegistrations();
+  // Sends the pending changes at once when enough of them piled up.
+  void SyncIfFull(SteadyClock::time_point now);
+  void ReplyStats(IConnection &connection);
+  // Probes candidates in batches and promotes the fastest one that answers.
+  // Leaves the server unset if none did.
+  void ChooseNewServer();
+  // Sends the membership snapshot that makes `member` the server.
+  bool Promote(const Member &member);
+  // Brings the server up to the current epoch, with a delta when the
+  // membership log still reaches back to the server's epoch. The write runs
+  // on pusher_.
+  void SyncServer();
+  // Elects a new server when a sync could not reach `server`.
+  void OnSyncFailed(NodeId server);
+  // Whether the changes since the last sync are due to be sent.
+  bool IsSyncDue(SteadyClock::time_point now);
+  // Sends kSET_RELAY to the nodes whose children changed since the last
+  // call, on pusher_. Nodes that do not take it leave the membership.
+  void SyncRelays();
+  void DropMembers(const std::vector<NodeId> &ids);
+  // Elects a new server as soon as the failure detector suspects the
+  // current one.
+  void WatchServer();
+  // Elects the first server, or sends the pending changes once they are due.
+  void SyncIfDue();
+  void CheckIdle();
+  bool is_from_server(const Message &m) const;
+  // Erases the members a server or relay could not reach.
+  void DropUnreachable(const Message &m);
+  Gauge &members_gauge_;
+  IConnectionMethodFactory &connection_factory_;
+  std::size_t max_nodes_;
+  // Nodes register here first, from any thread; the loop takes them over
+  // into `connected_nodes_addresses_`, which it alone touches.
+  ShardedMembership registrations_;
+  std::atomic<bool> is_admission_posted_{false};
+  VersionedMembership connected_nodes_addresses_;
+  // election probes in a row each node missed, see ChooseNewServer()
+  std::unordered_map<NodeId, unsigned> missed_probes_;
+  // both set while there is a server
+  std::shared_ptr<const IAddress> server_address_;
+  NodeId server_id_ = kNoNode;
+  // membership epoch last sent to the server, lowered again when the server
+  // reports an older one
+  std::uint64_t server_epoch_ = 0;
+  // when the oldest change the server has not seen was noticed
+  SteadyClock::time_point sync_pending_since_{};
+  SteadyClock::time_point last_server_response_{};
+  FailureDetector server_detector_;
+  std::size_t relay_fanout_;
+  RelayTree relay_tree_;
+  // epoch and server the relay tree was last laid out for
+  std::uint64_t relay_epoch_ = 0;
+  NodeId relay_root_ = kNoNode;
+  // Heartbeats wait in the backlog while a handler blocks the loop, so a
+  // watch that comes late skips judging the server once.
+  SteadyClock::time_point last_watch_at_{};
+  SteadyClock::time_point last_message_at_ = SteadyClock::now();
+  std::unique_ptr<ControllerJournal> journal_;
+  std::unique_ptr<IServer> connection_server_;
+  std::unique_ptr<IClient> connection_client_;
+  EventLoop loop_;
+  Broadcaster prober_;
+  // A kSET_RELAY for one node, as SyncRelays() hands it to pusher_.
+  struct RelayPush {
+    NodeId id;
+    std::shared_ptr<const IAddress> address;
+    Message message;
+  };
+  // Writes syncs and relay assignments to the nodes in the order they were
+  // made, so that a slow node holds up neither the loop nor the failure
+  // detector. Elections still write on the loop, they wait for the answer.
+  ThreadPool pusher_;
+  std::unique_ptr<ConnectionWorkers> workers_;
+};
+
+#endif // CONTROLLER_H_
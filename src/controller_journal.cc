@@ -0,0 +1,430 @@
+#include "controller_journal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "common.h"
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+// Writable mapping of a whole file. Resize() maps the file again, pointers
+// into data() do not survive it.
+class MappedFile {
+public:
+  explicit MappedFile(std::string path) : path_(std::move(path)) {}
+  ~MappedFile() { Close(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Creates the file if missing. All return false after logging the error.
+  bool Open();
+  bool Resize(std::size_t size);
+  bool Flush();
+  void Close();
+  char *data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+private:
+  bool Map();
+  void Unmap();
+  std::string path_;
+#ifdef _WIN32
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+  char *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+#ifdef _WIN32
+
+bool MappedFile::Open() {
+  file_ = CreateFileA(path_.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                      OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  LARGE_INTEGER size{};
+  if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size)) {
+    WriteLastErrorMessage("MappedFile::Open", path_.c_str());
+    Close();
+    return false;
+  }
+  size_ = static_cast<std::size_t>(size.QuadPart);
+  return Map();
+}
+
+bool MappedFile::Resize(std::size_t size) {
+  Unmap();
+  LARGE_INTEGER position{};
+  position.QuadPart = static_cast<LONGLONG>(size);
+  if (!SetFilePointerEx(file_, position, nullptr, FILE_BEGIN) ||
+      !SetEndOfFile(file_)) {
+    WriteLastErrorMessage("MappedFile::Resize", path_.c_str());
+    return false;
+  }
+  size_ = size;
+  return Map();
+}
+
+bool MappedFile::Flush() {
+  if ((data_ && !FlushViewOfFile(data_, 0)) || !FlushFileBuffers(file_)) {
+    WriteLastErrorMessage("MappedFile::Flush", path_.c_str());
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::Close() {
+  Unmap();
+  if (file_ != INVALID_HANDLE_VALUE)
+    CloseHandle(file_);
+  file_ = INVALID_HANDLE_VALUE;
+}
+
+bool MappedFile::Map() {
+  if (size_ == 0)
+    return true;
+  auto size = static_cast<unsigned long long>(size_);
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE,
+                                static_cast<DWORD>(size >> 32),
+                                static_cast<DWORD>(size), nullptr);
+  if (mapping_)
+    data_ = static_cast<char *>(
+        MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, size_));
+  if (!data_) {
+    WriteLastErrorMessage("MappedFile::Map", path_.c_str());
+    Unmap();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::Unmap() {
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mapping_)
+    CloseHandle(mapping_);
+  data_ = nullptr;
+  mapping_ = nullptr;
+}
+
+namespace {
+bool RenameOver(const std::string &from, const std::string &to) {
+  if (!MoveFileExA(from.c_str(), to.c_str(),
+                   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    WriteLastErrorMessage("RenameOver::MoveFileEx", to.c_str());
+    return false;
+  }
+  return true;
+}
+
+// MOVEFILE_WRITE_THROUGH has written the rename already.
+bool SyncDirectoryOf(const std::string &) { return true; }
+} // namespace
+
+#else
+
+bool MappedFile::Open() {
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  struct stat file_stat {};
+  if (fd_ < 0 || fstat(fd_, &file_stat) != 0) {
+    WriteLastErrorMessage("MappedFile::Open", path_.c_str());
+    Close();
+    return false;
+  }
+  size_ = static_cast<std::size_t>(file_stat.st_size);
+  return Map();
+}
+
+bool MappedFile::Resize(std::size_t size) {
+  Unmap();
+  if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+    WriteLastErrorMessage("MappedFile::Resize", path_.c_str());
+    return false;
+  }
+  size_ = size;
+  return Map();
+}
+
+bool MappedFile::Flush() {
+  // fsync for the size, which grows with the journal
+  if ((data_ && msync(data_, size_, MS_SYNC) != 0) || fsync(fd_) != 0) {
+    WriteLastErrorMessage("MappedFile::Flush", path_.c_str());
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::Close() {
+  Unmap();
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+}
+
+bool MappedFile::Map() {
+  if (size_ == 0)
+    return true;
+  void *memory =
+      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (memory == MAP_FAILED) {
+    WriteLastErrorMessage("MappedFile::Map", path_.c_str());
+    return false;
+  }
+  data_ = static_cast<char *>(memory);
+  return true;
+}
+
+void MappedFile::Unmap() {
+  if (data_)
+    munmap(data_, size_);
+  data_ = nullptr;
+}
+
+namespace {
+bool RenameOver(const std::string &from, const std::string &to) {
+  if (std::rename(from.c_str(), to.c_str()) != 0) {
+    WriteLastErrorMessage("RenameOver::rename", to.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Writes the directory entries of the directory holding `path` to disk, the
+// rename of a file in it included.
+bool SyncDirectoryOf(const std::string &path) {
+  std::size_t slash = path.rfind('/');
+  std::string directory = slash == std::string::npos ? "."
+                          : slash == 0               ? "/"
+                                                     : path.substr(0, slash);
+  int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0 || fsync(fd) != 0) {
+    WriteLastErrorMessage("SyncDirectoryOf", directory.c_str());
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  close(fd);
+  return true;
+}
+} // namespace
+
+#endif // _WIN32
+
+namespace {
+const char kMagic[8] = {'t', '7', 'j', 'o', 'u', 'r', 'n', '2'};
+// size and checksum
+const std::size_t kRecordHeaderSize = 8;
+// kind, epoch and id, the address follows
+const std::size_t kRecordFixedSize = 13;
+const std::size_t kInitialSize = 64 * 1024;
+// Journals smaller than that are not worth compacting.
+const std::size_t kMinCompactedRecords = 1024;
+
+// FNV-1a. Catches records torn by a host crash, which may reach the disk
+// partly and in any order; the journal is never read on another host, so
+// integers are stored in host order.
+std::uint32_t Checksum(const char *data, std::size_t size) {
+  std::uint32_t hash = 2166136261u;
+  for (std::size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+} // namespace
+
+ControllerJournal::ControllerJournal(std::string path)
+    : path_(std::move(path)), file_(std::make_unique<MappedFile>(path_)) {}
+
+ControllerJournal::~ControllerJournal() = default;
+
+std::unique_ptr<ControllerJournal>
+ControllerJournal::Open(const std::string &path, ControllerState &state) {
+  std::unique_ptr<ControllerJournal> journal(new ControllerJournal(path));
+  if (!journal->file_->Open() || !journal->Load(state))
+    return nullptr;
+  return journal;
+}
+
+bool ControllerJournal::Load(ControllerState &state) {
+  const char *data = file_->data();
+  std::size_t size = file_->size();
+  if (size < sizeof(kMagic) ||
+      std::memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+    if (size != 0)
+      LOG(kERRORS) << path_ << " is not a controller journal, starting over";
+    if (!file_->Resize(0) || !file_->Resize(kInitialSize))
+      return false;
+    std::memcpy(file_->data(), kMagic, sizeof(kMagic));
+    end_ = sizeof(kMagic);
+    is_dirty_ = true;
+    return true;
+  }
+
+  MembershipTable members;
+  std::size_t position = sizeof(kMagic);
+  bool is_torn = false;
+  while (position + kRecordHeaderSize + kRecordFixedSize <= size) {
+    std::uint32_t record_size;
+    std::uint32_t checksum;
+    std::memcpy(&record_size, data + position, sizeof(record_size));
+    std::memcpy(&checksum, data + position + 4, sizeof(checksum));
+    if (record_size == 0)
+      break;
+    const char *body = data + position + kRecordHeaderSize;
+    if (record_size < kRecordFixedSize ||
+        record_size > size - position - kRecordHeaderSize ||
+        Checksum(body, record_size) != checksum) {
+      is_torn = true;
+      break;
+    }
+    auto kind = static_cast<RecordKind>(body[0]);
+    std::uint64_t epoch;
+    NodeId id;
+    std::memcpy(&epoch, body + 1, sizeof(epoch));
+    std::memcpy(&id, body + 1 + sizeof(epoch), sizeof(id));
+    switch (kind) {
+    case RecordKind::kJOIN:
+      if (id == kNoNode) {
+        is_torn = true;
+        break;
+      }
+      members.Insert(id, std::string(body + kRecordFixedSize,
+                                     record_size - kRecordFixedSize));
+      state.last_id = std::max(state.last_id, id);
+      state.epoch = epoch;
+      break;
+    case RecordKind::kLEAVE:
+      members.Erase(id);
+      state.epoch = epoch;
+      break;
+    case RecordKind::kSERVER:
+      state.server = id;
+      state.server_epoch = epoch;
+      break;
+    case RecordKind::kLAST_ID:
+      state.last_id = std::max(state.last_id, id);
+      break;
+    default:
+      is_torn = true;
+    }
+    if (is_torn)
+      break;
+    position += kRecordHeaderSize + record_size;
+    ++record_count_;
+  }
+  end_ = position;
+  // whatever follows the last good record must not pass for one later
+  if (is_torn) {
+    LOG(kERRORS) << path_ << ": dropping a torn record at " << position;
+    std::memset(file_->data() + position, 0, size - position);
+    is_dirty_ = true;
+  }
+  state.members.clear();
+  state.members.reserve(members.size());
+  members.ForEach(
+      [&](const Member &member) { state.members.push_back(member); });
+  return true;
+}
+
+bool ControllerJournal::Join(std::uint64_t epoch, NodeId id,
+                             const std::string &address) {
+  return Append(RecordKind::kJOIN, epoch, id, address);
+}
+
+bool ControllerJournal::Leave(std::uint64_t epoch, NodeId id) {
+  return Append(RecordKind::kLEAVE, epoch, id);
+}
+
+bool ControllerJournal::SetServer(std::uint64_t epoch, NodeId server) {
+  return Append(RecordKind::kSERVER, epoch, server);
+}
+
+bool ControllerJournal::Append(RecordKind kind, std::uint64_t epoch,
+                               NodeId id, const std::string &address) {
+  std::size_t record_size = kRecordFixedSize + address.size();
+  std::size_t needed = end_ + kRecordHeaderSize + record_size;
+  if (needed > file_->size() &&
+      !file_->Resize(std::max(file_->size() * 2, needed)))
+    return false;
+  char *record = file_->data() + end_;
+  char *body = record + kRecordHeaderSize;
+  body[0] = static_cast<char>(kind);
+  std::memcpy(body + 1, &epoch, sizeof(epoch));
+  std::memcpy(body + 1 + sizeof(epoch), &id, sizeof(id));
+  std::memcpy(body + kRecordFixedSize, address.data(), address.size());
+  std::uint32_t checksum = Checksum(body, record_size);
+  std::memcpy(record + 4, &checksum, sizeof(checksum));
+  // the size makes the record visible, it goes last
+  std::atomic_signal_fence(std::memory_order_release);
+  auto size_field = static_cast<std::uint32_t>(record_size);
+  std::memcpy(record, &size_field, sizeof(size_field));
+  end_ = needed;
+  ++record_count_;
+  is_dirty_ = true;
+  return true;
+}
+
+bool ControllerJournal::Compact(const MembershipTable &members,
+                                std::uint64_t epoch, NodeId last_id,
+                                NodeId server, std::uint64_t server_epoch) {
+  // The old journal stays in place until the new one is complete on disk.
+  std::string new_path = path_ + ".new";
+  ControllerJournal compacted(new_path);
+  ControllerState ignored;
+  bool is_written = compacted.file_->Open() && compacted.file_->Resize(0) &&
+                    compacted.Load(ignored) &&
+                    compacted.Append(RecordKind::kLAST_ID, 0, last_id);
+  members.ForEach([&](const Member &member) {
+    is_written =
+        is_written && compacted.Join(epoch, member.id, member.address);
+  });
+  is_written = is_written && compacted.SetServer(server_epoch, server) &&
+               compacted.Flush();
+  compacted.file_->Close();
+  if (!is_written) {
+    CompactionFailed();
+    return true;
+  }
+
+  file_->Close();
+  bool is_replaced = RenameOver(new_path, path_);
+  if (!file_->Open())
+    return false;
+  if (!is_replaced) {
+    CompactionFailed();
+    return true;
+  }
+  end_ = compacted.end_;
+  record_count_ = compacted.record_count_;
+  failed_at_ = 0;
+  // the new journal is on disk, its name has to be too
+  return SyncDirectoryOf(path_);
+}
+
+void ControllerJournal::CompactionFailed() {
+  LOG(kERRORS) << path_ << ": compaction failed, the old journal goes on";
+  failed_at_ = record_count_;
+}
+
+bool ControllerJournal::Flush() {
+  if (!is_dirty_)
+    return true;
+  is_dirty_ = false;
+  return file_->Flush();
+}
+
+bool ControllerJournal::is_compaction_due(std::size_t member_count) const {
+  return record_count_ > kMinCompactedRecords &&
+         record_count_ > 2 * (member_count + 1) &&
+         record_count_ > 2 * failed_at_;
+}
@@ -0,0 +1,95 @@
+#ifndef CONTROLLER_JOURNAL_H_
+#define CONTROLLER_JOURNAL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "membership.h"
+
+// Crash-safe record of the controller's state, so that a restarted
+// controller carries on with the same members and server instead of having
+// every node register again and a new server elected.
+//
+// The journal is a memory-mapped file: a magic, then records appended back
+// to back. A record is a u32 size, a u32 checksum of the rest, a u8 kind, a
+// u64 epoch, a u32 node id and an address:
+//   kJOIN, kLEAVE  membership change, `epoch` is the membership epoch after
+//                  it; a kLEAVE has no address
+//   kSERVER        current server, `epoch` the one it acknowledged; kNoNode
+//                  when there is none, and no address
+//   kLAST_ID       highest id assigned so far, no epoch and no address
+// The size is stored last, so a record cut short by the process dying reads
+// as the end of the journal. Stores into the mapping are in the page cache
+// as soon as they are made and survive the process; Flush() writes them to
+// disk against host crashes.
+//
+// Once most records are outdated, Compact() writes the current state to a
+// new file, a kLAST_ID and one kJOIN per member, and renames it over the
+// journal. The kLAST_ID keeps the ids of members that left from being handed
+// out again.
+
+struct ControllerState {
+  std::uint64_t epoch = 0;
+  // unresolved
+  std::vector<Member> members;
+  // highest id ever assigned, members that left included
+  NodeId last_id = kNoNode;
+  NodeId server = kNoNode;
+  std::uint64_t server_epoch = 0;
+};
+
+class MappedFile;
+
+class ControllerJournal {
+public:
+  // Opens the journal at `path`, creating it if missing, and fills `state`
+  // from it. A journal that is not ours is started over. Returns nullptr
+  // after logging the error.
+  static std::unique_ptr<ControllerJournal> Open(const std::string &path,
+                                                 ControllerState &state);
+  ~ControllerJournal();
+  ControllerJournal(const ControllerJournal &) = delete;
+  ControllerJournal &operator=(const ControllerJournal &) = delete;
+
+  // All return false after logging the error, the journal is unusable then.
+  bool Join(std::uint64_t epoch, NodeId id, const std::string &address);
+  bool Leave(std::uint64_t epoch, NodeId id);
+  // `server` is kNoNode when there is none.
+  bool SetServer(std::uint64_t epoch, NodeId server);
+  // Replaces the journal by the state given. If that fails, the old journal
+  // goes on and compaction is not tried again before it doubles; false means
+  // the journal itself can no longer be written.
+  bool Compact(const MembershipTable &members, std::uint64_t epoch,
+               NodeId last_id, NodeId server, std::uint64_t server_epoch);
+  // Writes the records appended since the last call to disk.
+  bool Flush();
+
+  // Whether outdated records make up most of the journal.
+  bool is_compaction_due(std::size_t member_count) const;
+
+private:
+  enum class RecordKind : std::uint8_t {
+    kJOIN = 1,
+    kLEAVE,
+    kSERVER,
+    kLAST_ID
+  };
+  explicit ControllerJournal(std::string path);
+  bool Load(ControllerState &state);
+  void CompactionFailed();
+  bool Append(RecordKind kind, std::uint64_t epoch, NodeId id,
+              const std::string &address = "");
+  std::string path_;
+  std::unique_ptr<MappedFile> file_;
+  // where the next record goes
+  std::size_t end_ = 0;
+  std::size_t record_count_ = 0;
+  // record count when compaction last failed
+  std::size_t failed_at_ = 0;
+  bool is_dirty_ = false;
+};
+
+#endif // CONTROLLER_JOURNAL_H_
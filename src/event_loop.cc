@@ -0,0 +1,110 @@
+#include "event_loop.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+// wait limit without timers, in case an interrupt goes astray
+const int kIdleTimeout = 1000;
+} // namespace
+
+EventLoop::EventLoop(IServer *server, ConnectionHandler on_connection,
+                     std::size_t accept_batch)
+    : server_(server), on_connection_(std::move(on_connection)),
+      accept_batch_(accept_batch) {}
+
+EventLoop::TimerId EventLoop::RunAfter(SteadyClock::duration delay,
+                                       Task task) {
+  return timers_.Schedule(SteadyClock::now() + delay,
+                          SteadyClock::duration::zero(), std::move(task));
+}
+
+EventLoop::TimerId EventLoop::RunEvery(SteadyClock::duration period,
+                                       Task task) {
+  return timers_.Schedule(SteadyClock::now() + period, period,
+                          std::move(task));
+}
+
+void EventLoop::Cancel(TimerId id) { timers_.Cancel(id); }
+
+void EventLoop::Post(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex_);
+    posted_.push_back(std::move(task));
+  }
+  Wake();
+}
+
+void EventLoop::Stop() {
+  is_stopped_ = true;
+  Wake();
+}
+
+void EventLoop::Wake() {
+  if (server_) {
+    server_->Interrupt();
+    return;
+  }
+  // under the mutex, so that a waiter between its check and its wait does
+  // not miss it
+  std::lock_guard<std::mutex> lock(posted_mutex_);
+  has_posted_.notify_one();
+}
+
+void EventLoop::Run() {
+  while (!is_stopped_) {
+    if (server_)
+      AcceptConnections();
+    else
+      WaitForPosted();
+    RunPosted();
+    RunDueTimers();
+  }
+}
+
+void EventLoop::AcceptConnections() {
+  std::vector<std::unique_ptr<IConnection>> connections =
+      server_->WaitForConnections(NextTimeout(), accept_batch_);
+  for (auto &connection : connections) {
+    if (is_stopped_)
+      return;
+    on_connection_(std::move(connection));
+  }
+}
+
+void EventLoop::WaitForPosted() {
+  auto timeout = std::chrono::milliseconds(NextTimeout());
+  std::unique_lock<std::mutex> lock(posted_mutex_);
+  has_posted_.wait_for(lock, timeout,
+                       [this] { return !posted_.empty() || is_stopped_; });
+}
+
+void EventLoop::RunPosted() {
+  std::vector<Task> posted;
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex_);
+    posted.swap(posted_);
+  }
+  for (auto &task : posted) {
+    if (is_stopped_)
+      return;
+    task();
+  }
+}
+
+void EventLoop::RunDueTimers() { timers_.Advance(SteadyClock::now()); }
+
+int EventLoop::NextTimeout() {
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex_);
+    if (!posted_.empty())
+      return 0;
+  }
+  if (timers_.empty())
+    return kIdleTimeout;
+  auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+      timers_.next_due() - SteadyClock::now());
+  // round up, so the wait does not end just before the timer is due
+  return static_cast<int>(std::clamp<std::chrono::milliseconds::rep>(
+      remaining.count() + 1, 0, kIdleTimeout));
+}
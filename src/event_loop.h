@@ -0,0 +1,82 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "i_connection_method.h"
+#include "timer_wheel.h"
+
+// Single threaded reactor around an IServer. Run() serves accepted
+// connections, due timers and posted tasks one after another on the calling
+// thread. The wait for connections lasts only until the next timer is due,
+// and Post() and Stop() interrupt it, so no path waits for another one to
+// time out. Handlers must not block for long; slow work runs elsewhere and
+// posts its result back.
+//
+// Without a server, Run() serves timers and posted tasks only, for owners
+// that take connections on other threads, see ConnectionWorkers.
+//
+// Only Post() and Stop() may be called from other threads. Timers may also
+// be set up before Run().
+class EventLoop {
+public:
+  using SteadyClock = TimerWheel::SteadyClock;
+  using Task = TimerWheel::Task;
+  using ConnectionHandler = std::function<void(std::unique_ptr<IConnection>)>;
+  using TimerId = TimerWheel::TimerId;
+  static constexpr std::size_t kDefaultAcceptBatch = 64;
+
+  EventLoop(IServer &server, ConnectionHandler on_connection,
+            std::size_t accept_batch = kDefaultAcceptBatch)
+      : EventLoop(&server, std::move(on_connection), accept_batch) {}
+  // `server` may be null.
+  EventLoop(IServer *server, ConnectionHandler on_connection,
+            std::size_t accept_batch = kDefaultAcceptBatch);
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  TimerId RunAfter(SteadyClock::duration delay, Task task);
+  // First runs one `period` from now, then keeps the cadence, see
+  // TimerWheel::Schedule().
+  TimerId RunEvery(SteadyClock::duration period, Task task);
+  // Unknown or fired ids are ignored.
+  void Cancel(TimerId id);
+  void Post(Task task);
+
+  void Run();
+  // Makes Run() return after the handler in progress.
+  void Stop();
+  bool is_stopped() const { return is_stopped_; }
+
+private:
+  // Connections that piled up while a handler ran are served before the
+  // timers, so that a timer does not judge them late.
+  void AcceptConnections();
+  // Stands in for AcceptConnections() without a server.
+  void WaitForPosted();
+  // Makes the wait for connections or posted tasks return.
+  void Wake();
+  void RunPosted();
+  void RunDueTimers();
+  // until the next timer is due, in ms for IServer
+  int NextTimeout();
+  IServer *server_;
+  ConnectionHandler on_connection_;
+  std::size_t accept_batch_;
+  TimerWheel timers_;
+  std::mutex posted_mutex_;
+  std::vector<Task> posted_;
+  std::condition_variable has_posted_;
+  std::atomic<bool> is_stopped_{false};
+};
+
+#endif // EVENT_LOOP_H_
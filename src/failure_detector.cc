@@ -0,0 +1,59 @@
+#include "failure_detector.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+double ToMilliseconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+} // namespace
+
+FailureDetector::FailureDetector(SteadyClock::duration expected_interval,
+                                 SteadyClock::duration min_deviation,
+                                 double threshold, std::size_t window)
+    : expected_interval_(ToMilliseconds(expected_interval)),
+      min_deviation_(ToMilliseconds(min_deviation)), threshold_(threshold),
+      window_(std::max<std::size_t>(window, 2)) {
+  Reset(SteadyClock::now());
+}
+
+void FailureDetector::Reset(SteadyClock::time_point now) {
+  intervals_.clear();
+  sum_ = 0;
+  squares_sum_ = 0;
+  // two samples around the expected interval give it a plausible spread
+  AddInterval(expected_interval_ * 0.75);
+  AddInterval(expected_interval_ * 1.25);
+  last_heartbeat_ = now;
+}
+
+void FailureDetector::Heartbeat(SteadyClock::time_point now) {
+  AddInterval(ToMilliseconds(now - last_heartbeat_));
+  last_heartbeat_ = now;
+}
+
+void FailureDetector::AddInterval(double interval) {
+  intervals_.push_back(interval);
+  sum_ += interval;
+  squares_sum_ += interval * interval;
+  if (intervals_.size() > window_) {
+    sum_ -= intervals_.front();
+    squares_sum_ -= intervals_.front() * intervals_.front();
+    intervals_.pop_front();
+  }
+}
+
+double FailureDetector::Phi(SteadyClock::time_point now) const {
+  double count = static_cast<double>(intervals_.size());
+  double mean = sum_ / count;
+  double variance = std::max(squares_sum_ / count - mean * mean, 0.0);
+  double deviation = std::max(std::sqrt(variance), min_deviation_);
+  double elapsed = ToMilliseconds(now - last_heartbeat_);
+  // logistic approximation of the normal distribution's tail
+  double y = (elapsed - mean) / deviation;
+  double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+  if (elapsed > mean)
+    return -std::log10(e / (1.0 + e));
+  return -std::log10(1.0 - 1.0 / (1.0 + e));
+}
@@ -0,0 +1,52 @@
+#ifndef FAILURE_DETECTOR_H_
+#define FAILURE_DETECTOR_H_
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+
+// Phi accrual failure detector. Instead of a fixed timeout it keeps the
+// recent intervals between heartbeats and turns the time since the last one
+// into a suspicion level phi: the peer is late with probability 10^-phi if
+// it is alive. A threshold of 8 therefore tolerates one false suspicion in
+// 10^8 checks, lower values detect sooner and err more often.
+//
+// Not thread safe.
+class FailureDetector {
+public:
+  using SteadyClock = std::chrono::steady_clock;
+  static constexpr double kDefaultThreshold = 8.0;
+  static constexpr std::size_t kDefaultWindow = 100;
+
+  // `expected_interval` seeds the history until real heartbeats arrive.
+  // `min_deviation` keeps a very regular peer from being suspected after a
+  // tiny delay.
+  FailureDetector(SteadyClock::duration expected_interval,
+                  SteadyClock::duration min_deviation,
+                  double threshold = kDefaultThreshold,
+                  std::size_t window = kDefaultWindow);
+
+  // Forgets the history of the previous peer, as if it sent a heartbeat at
+  // `now`.
+  void Reset(SteadyClock::time_point now);
+  void Heartbeat(SteadyClock::time_point now);
+  double Phi(SteadyClock::time_point now) const;
+  bool IsSuspected(SteadyClock::time_point now) const {
+    return Phi(now) >= threshold_;
+  }
+  double threshold() const { return threshold_; }
+
+private:
+  void AddInterval(double interval);
+  double expected_interval_;
+  double min_deviation_;
+  double threshold_;
+  std::size_t window_;
+  // in milliseconds, with running sums for the mean and the variance
+  std::deque<double> intervals_;
+  double sum_ = 0;
+  double squares_sum_ = 0;
+  SteadyClock::time_point last_heartbeat_{};
+};
+
+#endif // FAILURE_DETECTOR_H_
@@ -0,0 +1,24 @@
+#include "frame_pool.h"
+
+#include <utility>
+
+#include "wire_format.h"
+
+FramePool &FramePool::Instance() {
+  static FramePool pool;
+  return pool;
+}
+
+std::vector<char> FramePool::Acquire() {
+  std::vector<char> buffer;
+  buffers_.TryPop(buffer);
+  return buffer;
+}
+
+void FramePool::Release(std::vector<char> &&buffer) {
+  // only what a frame may need, a pooled buffer is never shrunk
+  if (buffer.capacity() == 0 || buffer.capacity() > kMaxFrameSize)
+    return;
+  buffer.clear();
+  buffers_.TryPush(buffer);
+}
@@ -0,0 +1,28 @@
+#ifndef FRAME_POOL_H_
+#define FRAME_POOL_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "mpmc_queue.h"
+
+// Frame buffers for reuse across the connections of a process. A buffer
+// keeps its capacity while it is pooled, so once the pool is warm a frame
+// costs no allocation. Lock-free, see mpmc_queue.h.
+class FramePool {
+public:
+  static constexpr std::size_t kDefaultCapacity = 1024;
+  static FramePool &Instance();
+  explicit FramePool(std::size_t capacity = kDefaultCapacity)
+      : buffers_(capacity) {}
+
+  // An empty buffer, with the capacity of a pooled one if there is one.
+  std::vector<char> Acquire();
+  // Takes `buffer` back, or frees it if the pool is full.
+  void Release(std::vector<char> &&buffer);
+
+private:
+  MpmcQueue<std::vector<char>> buffers_;
+};
+
+#endif // FRAME_POOL_H_
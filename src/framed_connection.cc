@@ -0,0 +1,177 @@
+#include "framed_connection.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "frame_pool.h"
+#include "log.h"
+#include "metrics.h"
+#include "wire_format.h"
+
+namespace {
+// Sequence numbers wrap around, compare them by distance.
+bool IsBefore(std::uint32_t lhs, std::uint32_t rhs) {
+  return static_cast<std::int32_t>(lhs - rhs) < 0;
+}
+} // namespace
+
+FramedConnection::FramedConnection()
+    : frame_(FramePool::Instance().Acquire()),
+      received_(FramePool::Instance().Acquire()) {}
+
+FramedConnection::~FramedConnection() {
+  FramePool::Instance().Release(std::move(frame_));
+  FramePool::Instance().Release(std::move(received_));
+}
+
+bool FramedConnection::Write(Message &message) {
+  static Histogram &write_latency =
+      Metrics::Instance().histogram("connection.write");
+  static Counter &write_failures =
+      Metrics::Instance().counter("connection.write_failures");
+  ScopedLatency latency(write_latency);
+  if (!WriteFrame(message)) {
+    write_failures.Increment();
+    return false;
+  }
+  return true;
+}
+
+bool FramedConnection::Write(const EncodedMessage &message) {
+  static Histogram &write_latency =
+      Metrics::Instance().histogram("connection.write");
+  static Counter &write_failures =
+      Metrics::Instance().counter("connection.write_failures");
+  ScopedLatency latency(write_latency);
+  is_last_write_sent_ = false;
+  if (!is_healthy_) {
+    write_failures.Increment();
+    return false;
+  }
+  // frame_ holds only the prefix, the fields go out from the caller's buffer
+  EncodeFramePrefix(message, NextSequence(), frame_);
+  FramePart parts[] = {{frame_.data(), frame_.size()},
+                       {message.fields.data(), message.fields.size()}};
+  if (!SendFrame(parts, 2)) {
+    is_healthy_ = false;
+    write_failures.Increment();
+    return false;
+  }
+  // the transports move whole frames, a failed send sent nothing
+  is_last_write_sent_ = true;
+  if (!AwaitWindow()) {
+    write_failures.Increment();
+    return false;
+  }
+  return true;
+}
+
+bool FramedConnection::WriteFrame(Message &message) {
+  is_last_write_sent_ = false;
+  if (!is_healthy_)
+    return false;
+  message.sequence = NextSequence();
+  if (!EncodeMessage(message, frame_)) {
+    LOG(kERRORS) << "FramedConnection::Write: message is too large";
+    return false;
+  }
+  if (!SendFrame(frame_)) {
+    is_healthy_ = false;
+    return false;
+  }
+  is_last_write_sent_ = true;
+  return AwaitWindow();
+}
+
+bool FramedConnection::SendFrame(const std::vector<char> &frame) {
+  FramePart part{frame.data(), frame.size()};
+  return SendFrame(&part, 1);
+}
+
+std::uint32_t FramedConnection::NextSequence() {
+  if (++last_sent_ == 0)
+    ++last_sent_; // zero means "no ack requested"
+  return last_sent_;
+}
+
+bool FramedConnection::AwaitWindow() {
+  if (last_sent_ - last_acked_ < ack_window_)
+    return true;
+  return AwaitAck(last_sent_ - static_cast<std::uint32_t>(ack_window_) + 1);
+}
+
+Message FramedConnection::Read(int timeout) {
+  Message message;
+  Read(message, timeout);
+  return message;
+}
+
+bool FramedConnection::Read(Message &message, int timeout) {
+  static Histogram &read_latency =
+      Metrics::Instance().histogram("connection.read");
+  ScopedLatency latency(read_latency);
+  if (!pending_.empty()) {
+    message = std::move(pending_.front());
+    pending_.pop_front();
+    return true;
+  }
+  do {
+    ResetMessage(message);
+    message.is_succeed = ReceiveMessage(message, timeout);
+  } while (message.is_succeed && message.type == MessageType::kACK);
+  return message.is_succeed;
+}
+
+bool FramedConnection::Flush() { return AwaitAck(last_sent_); }
+
+void FramedConnection::set_ack_window(std::size_t frames) {
+  ack_window_ = std::max<std::size_t>(frames, 1);
+}
+
+void FramedConnection::set_ack_timeout(int timeout) {
+  ack_timeout_ = timeout < 0 ? kAckTimeout : timeout;
+}
+
+bool FramedConnection::ReceiveMessage(Message &message, int timeout) {
+  std::size_t size = 0;
+  if (!ReceiveFrame(received_, size, timeout)) {
+    is_healthy_ = false;
+    return false;
+  }
+  if (!DecodeMessage(received_.data(), size, message)) {
+    LOG(kDEBUG) << "FramedConnection::Read: malformed frame";
+    is_healthy_ = false;
+    return false;
+  }
+  if (message.type == MessageType::kACK) {
+    if (IsBefore(last_acked_, message.sequence))
+      last_acked_ = message.sequence;
+    return true;
+  }
+  if (message.sequence != 0) {
+    Message ack;
+    ack.type = MessageType::kACK;
+    ack.sequence = message.sequence;
+    if (!EncodeMessage(ack, frame_) || !SendFrame(frame_)) {
+      is_healthy_ = false;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FramedConnection::AwaitAck(std::uint32_t sequence) {
+  while (is_healthy_ && IsBefore(last_acked_, sequence)) {
+    Message message;
+    if (!ReceiveMessage(message, ack_timeout_)) {
+      LOG(kDEBUG) << "FramedConnection: frame " << sequence
+                  << " was not acknowledged";
+      return false;
+    }
+    if (message.type != MessageType::kACK) {
+      message.is_succeed = true;
+      pending_.push_back(std::move(message));
+    }
+  }
+  return is_healthy_;
+}
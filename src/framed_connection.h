@@ -0,0 +1,77 @@
+#ifndef FRAMED_CONNECTION_H_
+#define FRAMED_CONNECTION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "i_connection_method.h"
+#include "wire_format.h"
+
+// Bytes of a frame that is sent from several buffers.
+struct FramePart {
+  const char *data;
+  std::size_t size;
+};
+
+// IConnection on top of a transport that moves whole frames.
+//
+// Every frame written gets a sequence number and the peer answers it with a
+// kACK frame from Read(). Write() returns once fewer than ack_window frames
+// are unacknowledged; with the default window of one it returns when the
+// peer has confirmed the frame. Acks are cumulative. Data frames that arrive
+// while waiting for an ack are acknowledged at once and kept for Read().
+// Close() does not wait for outstanding acks; call Flush() for that.
+class FramedConnection : public IConnection {
+public:
+  FramedConnection();
+  ~FramedConnection() override;
+
+  bool Write(Message &message) override;
+  bool Write(const EncodedMessage &message) override;
+  using IConnection::Read;
+  Message Read(int timeout) override;
+  bool Read(Message &message, int timeout) override;
+  bool Flush() override;
+  void set_ack_window(std::size_t frames) override;
+  void set_ack_timeout(int timeout) override;
+  bool is_last_write_sent() const override { return is_last_write_sent_; }
+
+protected:
+  static constexpr int kAckTimeout = 1000;
+  // most parts SendFrame() is given
+  static constexpr std::size_t kMaxFrameParts = 2;
+  // Sends the concatenation of `parts` as one frame, without copying it
+  // where the transport allows.
+  virtual bool SendFrame(const FramePart *parts, std::size_t count) = 0;
+  // Waits up to `timeout` ms, or forever if negative, for the next frame and
+  // reads it into the first `size` bytes of `buffer`. The buffer is grown as
+  // needed and not shrunk, so that the frames that follow reuse it. Returns
+  // false on error, timeout or hang-up.
+  virtual bool ReceiveFrame(std::vector<char> &buffer, std::size_t &size,
+                            int timeout) = 0;
+  // False once a frame was lost or not acknowledged in time.
+  bool is_healthy() const { return is_healthy_; }
+
+private:
+  bool WriteFrame(Message &message);
+  bool SendFrame(const std::vector<char> &frame);
+  std::uint32_t NextSequence();
+  // Waits for acks once the window is full.
+  bool AwaitWindow();
+  bool ReceiveMessage(Message &message, int timeout);
+  bool AwaitAck(std::uint32_t sequence);
+  std::uint32_t last_sent_ = 0;
+  std::uint32_t last_acked_ = 0;
+  std::size_t ack_window_ = 1;
+  int ack_timeout_ = kAckTimeout;
+  bool is_healthy_ = true;
+  bool is_last_write_sent_ = false;
+  std::deque<Message> pending_;
+  // leased from the FramePool for the life of the connection
+  std::vector<char> frame_;
+  std::vector<char> received_;
+};
+
+#endif // FRAMED_CONNECTION_H_
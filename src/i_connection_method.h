@@ -1,71 +1,174 @@
-#ifndef I_CONNECTION_METHOD_H_
-#define I_CONNECTION_METHOD_H_
-
-#include <cstddef>
-#include <memory>
-#include <string>
-
-#include "common.h"
-
-const int kMaxAddressLength = 256;
-const int kMaxNodes = 16;
-
-enum class ClientRole { kCLIENT, kSERVER, kCONTROLLER };
-
-enum class MessageType {
-  kNEW_CLIENT,
-  kNEW_TIME,
-  kSET_SERVER,
-  kTEST_CONTROLLER
-};
-
-struct Message {
-  ClientRole client_role;
-  MessageType type;
-  TimePoint time;
-  char addresses[kMaxAddressLength][kMaxNodes];
-  int addresses_count;
-  bool is_succeed;
-};
-
-class IAddress {
-public:
-  virtual ~IAddress() = default;
-  virtual const std::string &raw() const = 0;
-};
-
-class IConnection {
-public:
-  virtual ~IConnection() = default;
-  virtual bool Write(Message &) = 0;
-  virtual Message Read() = 0;
-  virtual void Close() = 0;
-  virtual bool is_server() const = 0;
-};
-
-class IServer {
-public:
-  virtual ~IServer() = default;
-  virtual std::unique_ptr<IConnection> WaitForConnection(int timeout) = 0;
-  virtual const IAddress &address() const = 0;
-  virtual const std::string &address_str() const = 0;
-};
-
-class IClient {
-public:
-  virtual ~IClient() = default;
-  virtual std::unique_ptr<IConnection> Connect(const IAddress &address,
-                                               int timeout) = 0;
-};
-
-class IConnectionMethodFactory {
-public:
-  virtual ~IConnectionMethodFactory() = default;
-  virtual std::unique_ptr<IAddress> NewAddress(std::string address) = 0;
-  virtual std::unique_ptr<IAddress> GenerateAddress() = 0;
-  virtual std::unique_ptr<IServer> NewServer(const IAddress &address) = 0;
-  virtual std::unique_ptr<IClient> NewClient() = 0;
-  virtual std::unique_ptr<IAddress> ControllerAddress() = 0;
-};
-
-#endif // I_CONNECTION_METHOD_H_
+#ifndef I_CONNECTION_METHOD_H_
+#define I_CONNECTION_METHOD_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+const int kMaxAddressLength = 256;
+
+// Assigned by the controller when a node registers; membership is kept and
+// sent by id, the address is needed only to connect.
+using NodeId = std::uint32_t;
+const NodeId kNoNode = 0;
+
+// A relay is a client that passes ticks on to its children, see
+// relay_tree.h.
+enum class ClientRole { kCLIENT, kSERVER, kCONTROLLER, kRELAY };
+
+enum class MessageType {
+  kNEW_CLIENT,
+  kNEW_TIME,
+  kSET_SERVER,
+  kTEST_CONTROLLER,
+  kACK,
+  // asks the controller for its metrics, answered with kSTATS in `text`
+  kGET_STATS,
+  kSTATS,
+  // joins in `node_ids` and `addresses` and leaves in `removed_ids` that take
+  // the server from `base_epoch` to `epoch`; from a server or relay to the
+  // controller, the children it could not reach in `removed_ids`
+  kMEMBERSHIP_DELTA,
+  // server to controller every kHeartbeatInterval, with its id, address and
+  // epoch like a tick
+  kHEARTBEAT,
+  // controller to election candidates, a live node just reads it
+  kPROBE,
+  // controller to a node, its children in the relay tree in `node_ids` and
+  // `addresses`
+  kSET_RELAY,
+  // client to the server that ticked, `time` is when it was sent; answered
+  // on the same connection, see time_sync.h
+  kTIME_REQUEST,
+  kTIME_RESPONSE
+};
+
+const std::chrono::milliseconds kHeartbeatInterval{100};
+// How long, in ms, the receiving side waits for a message once a peer
+// connected, and for each further frame of a run. A peer that stalls longer
+// is dropped instead of holding up the loop that serves everyone else. The
+// writer waits as long for its ack, so a shorter wait would drop peers that
+// are merely descheduled on a loaded host.
+const int kReadTimeout = 1000;
+
+// In-memory form of a frame. Only the fields that are set are put on the
+// wire, see wire_format.h.
+struct Message {
+  ClientRole client_role{};
+  MessageType type{};
+  TimePoint time{};
+  // of a kTIME_RESPONSE: the `time` of the request, and when it arrived
+  TimePoint origin_time{};
+  TimePoint receive_time{};
+  std::vector<std::string> addresses;
+  // of a membership transfer or kSET_RELAY: node_ids[i] is at addresses[i]
+  std::vector<NodeId> node_ids;
+  std::vector<NodeId> removed_ids;
+  // the server that sent a tick or heartbeat; the node a kSET_SERVER makes
+  // the server
+  NodeId node_id = kNoNode;
+  // membership version: of a snapshot or delta, or the one a server applied
+  std::uint64_t epoch = 0;
+  std::uint64_t base_epoch = 0;
+  std::string text;
+  // set by IConnection::Write, the peer acknowledges it; 0 asks for no ack
+  std::uint32_t sequence = 0;
+  // more frames of the same type follow with the rest of `addresses`, see
+  // membership.h
+  bool has_more = false;
+  // filled by IConnection::Read, never sent
+  bool is_succeed = false;
+};
+
+// see wire_format.h
+struct EncodedMessage;
+
+class IAddress {
+public:
+  virtual ~IAddress() = default;
+  virtual const std::string &raw() const = 0;
+};
+
+class IConnection {
+public:
+  virtual ~IConnection() = default;
+  virtual bool Write(Message &) = 0;
+  // Writes a message encoded beforehand, so that a broadcast encodes it once
+  // for all peers.
+  virtual bool Write(const EncodedMessage &) = 0;
+  // Waits up to `timeout` ms, or forever if negative, for the next message.
+  virtual Message Read(int timeout) = 0;
+  Message Read() { return Read(-1); }
+  // Same, into `message`, whose vectors keep their capacity for the next
+  // read. Returns message.is_succeed.
+  virtual bool Read(Message &message, int timeout) {
+    message = Read(timeout);
+    return message.is_succeed;
+  }
+  virtual void Close() = 0;
+  virtual bool is_server() const = 0;
+  // Waits until the peer acknowledged everything written so far.
+  virtual bool Flush() { return true; }
+  // Number of frames Write() may leave unacknowledged before it blocks.
+  virtual void set_ack_window(std::size_t frames) {}
+  // Longest Write() and Flush() wait for an acknowledgment, in ms; negative
+  // for the connection's default.
+  virtual void set_ack_timeout(int timeout) {}
+  // Whether the last Write() got its message out before it failed, so that
+  // the peer may have it. One that sent nothing is safe to repeat elsewhere.
+  virtual bool is_last_write_sent() const { return true; }
+  // True if the connection may stay open between messages, so that a client
+  // can send several messages over it. The server side must then keep
+  // reading it after Close().
+  virtual bool is_reusable() const { return false; }
+};
+
+class IServer {
+public:
+  virtual ~IServer() = default;
+  virtual std::unique_ptr<IConnection> WaitForConnection(int timeout) = 0;
+  // Waits up to `timeout` for the first connection, then also takes up to
+  // `max_count` - 1 more that are already pending. Servers that listen on
+  // several instances at once override this to accept a burst in one call.
+  virtual std::vector<std::unique_ptr<IConnection>>
+  WaitForConnections(int timeout, std::size_t max_count) {
+    std::vector<std::unique_ptr<IConnection>> connections;
+    auto connection = WaitForConnection(timeout);
+    while (connection) {
+      connections.push_back(std::move(connection));
+      if (connections.size() >= max_count)
+        break;
+      connection = WaitForConnection(0);
+    }
+    return connections;
+  }
+  // Makes the wait in progress, or the next one if none is, return at once,
+  // with whatever connections are ready. Safe to call from any thread.
+  virtual void Interrupt() = 0;
+  virtual const IAddress &address() const = 0;
+  virtual const std::string &address_str() const = 0;
+};
+
+class IClient {
+public:
+  virtual ~IClient() = default;
+  virtual std::unique_ptr<IConnection> Connect(const IAddress &address,
+                                               int timeout) = 0;
+};
+
+class IConnectionMethodFactory {
+public:
+  virtual ~IConnectionMethodFactory() = default;
+  virtual std::unique_ptr<IAddress> NewAddress(std::string address) = 0;
+  virtual std::unique_ptr<IAddress> GenerateAddress() = 0;
+  virtual std::unique_ptr<IServer> NewServer(const IAddress &address) = 0;
+  virtual std::unique_ptr<IClient> NewClient() = 0;
+  virtual std::unique_ptr<IAddress> ControllerAddress() = 0;
+};
+
+#endif // I_CONNECTION_METHOD_H_
@@ -0,0 +1,306 @@
+#include "in_memory.h"
+
+#include <chrono>
+#include <utility>
+
+#include "frame_pool.h"
+#include "log.h"
+
+// FrameQueue
+
+bool FrameQueue::Push(const FramePart *parts, std::size_t count) {
+  std::vector<char> frame = FramePool::Instance().Acquire();
+  for (std::size_t i = 0; i < count; ++i)
+    frame.insert(frame.end(), parts[i].data, parts[i].data + parts[i].size);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (is_closed_) {
+      FramePool::Instance().Release(std::move(frame));
+      return false;
+    }
+    frames_.push_back(std::move(frame));
+  }
+  has_frame_.notify_one();
+  NotifyWatcher();
+  return true;
+}
+
+bool FrameQueue::Pop(std::vector<char> &frame, int timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto is_ready = [this] { return !frames_.empty() || is_closed_; };
+  if (timeout < 0) {
+    has_frame_.wait(lock, is_ready);
+  } else {
+    has_frame_.wait_for(lock, std::chrono::milliseconds(timeout), is_ready);
+  }
+  if (frames_.empty())
+    return false;
+  FramePool::Instance().Release(std::move(frame));
+  frame = std::move(frames_.front());
+  frames_.pop_front();
+  return true;
+}
+
+void FrameQueue::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+  }
+  has_frame_.notify_all();
+  NotifyWatcher();
+}
+
+bool FrameQueue::has_frame() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !frames_.empty();
+}
+
+bool FrameQueue::is_closed() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return is_closed_;
+}
+
+void FrameQueue::set_watcher(std::weak_ptr<InMemoryListener> listener) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  watcher_ = std::move(listener);
+}
+
+void FrameQueue::NotifyWatcher() {
+  std::shared_ptr<InMemoryListener> listener;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    listener = watcher_.lock();
+  }
+  // not under mutex_, the listener locks queues while it scans them
+  if (listener)
+    listener->Notify();
+}
+
+// InMemoryListener
+
+bool InMemoryListener::Enqueue(InMemoryEndpoint endpoint) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (is_closed_)
+      return false;
+    pending_.push_back(std::move(endpoint));
+  }
+  has_connection_.notify_all();
+  return true;
+}
+
+bool InMemoryListener::Accept(int timeout, InMemoryEndpoint &endpoint) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!TakeReady(endpoint)) {
+    if (is_closed_)
+      return false;
+    if (is_interrupted_) {
+      is_interrupted_ = false;
+      return false;
+    }
+    if (timeout < 0) {
+      has_connection_.wait(lock);
+    } else if (has_connection_.wait_until(lock, deadline) ==
+               std::cv_status::timeout) {
+      return TakeReady(endpoint);
+    }
+  }
+  return true;
+}
+
+bool InMemoryListener::TakeReady(InMemoryEndpoint &endpoint) {
+  if (!pending_.empty()) {
+    endpoint = std::move(pending_.front());
+    pending_.pop_front();
+    return true;
+  }
+  for (std::size_t i = 0; i < idle_.size();) {
+    if (idle_[i].in->has_frame()) {
+      endpoint = std::move(idle_[i]);
+      idle_.erase(idle_.begin() + i);
+      endpoint.in->set_watcher({});
+      return true;
+    }
+    if (idle_[i].in->is_closed()) {
+      // the peer has closed its end
+      idle_[i].out->Close();
+      idle_.erase(idle_.begin() + i);
+      continue;
+    }
+    ++i;
+  }
+  return false;
+}
+
+void InMemoryListener::Park(InMemoryEndpoint endpoint) {
+  endpoint.in->set_watcher(weak_from_this());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!is_closed_) {
+      idle_.push_back(std::move(endpoint));
+      endpoint = {};
+    }
+  }
+  if (endpoint.in) {
+    endpoint.in->Close();
+    endpoint.out->Close();
+    return;
+  }
+  // a frame may have arrived before the connection was parked
+  has_connection_.notify_all();
+}
+
+void InMemoryListener::Notify() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  has_connection_.notify_all();
+}
+
+void InMemoryListener::Interrupt() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_interrupted_ = true;
+  has_connection_.notify_all();
+}
+
+void InMemoryListener::Close() {
+  std::deque<InMemoryEndpoint> pending;
+  std::vector<InMemoryEndpoint> idle;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+    pending.swap(pending_);
+    idle.swap(idle_);
+  }
+  has_connection_.notify_all();
+  for (auto &endpoint : pending) {
+    endpoint.in->Close();
+    endpoint.out->Close();
+  }
+  for (auto &endpoint : idle) {
+    endpoint.in->Close();
+    endpoint.out->Close();
+  }
+}
+
+// InMemoryNetwork
+
+std::shared_ptr<InMemoryListener>
+InMemoryNetwork::Bind(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &slot = listeners_[name];
+  if (slot.lock())
+    return nullptr;
+  auto listener = std::make_shared<InMemoryListener>();
+  if (is_shut_down_)
+    listener->Close();
+  slot = listener;
+  return listener;
+}
+
+void InMemoryNetwork::Unbind(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  listeners_.erase(name);
+}
+
+std::shared_ptr<InMemoryListener>
+InMemoryNetwork::Find(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = listeners_.find(name);
+  if (it == listeners_.end())
+    return nullptr;
+  return it->second.lock();
+}
+
+void InMemoryNetwork::Shutdown() {
+  std::vector<std::shared_ptr<InMemoryListener>> listeners;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_shut_down_ = true;
+    for (auto &entry : listeners_) {
+      if (auto listener = entry.second.lock())
+        listeners.push_back(std::move(listener));
+    }
+  }
+  for (auto &listener : listeners)
+    listener->Close();
+}
+
+// InMemoryConnection
+
+InMemoryConnection::InMemoryConnection(
+    InMemoryEndpoint endpoint, std::shared_ptr<InMemoryListener> listener)
+    : endpoint_(std::move(endpoint)), listener_(std::move(listener)) {}
+
+InMemoryConnection::~InMemoryConnection() { Close(); }
+
+bool InMemoryConnection::SendFrame(const FramePart *parts,
+                                   std::size_t count) {
+  if (!endpoint_.out->Push(parts, count)) {
+    LOG(kDEBUG) << "InMemoryConnection::SendFrame: peer closed connection";
+    return false;
+  }
+  return true;
+}
+
+bool InMemoryConnection::ReceiveFrame(std::vector<char> &buffer,
+                                      std::size_t &size, int timeout) {
+  // the queued frame takes the place of the buffer
+  if (!endpoint_.in->Pop(buffer, timeout))
+    return false;
+  size = buffer.size();
+  return true;
+}
+
+void InMemoryConnection::Close() {
+  if (is_closed_)
+    return;
+  is_closed_ = true;
+  if (listener_ && is_healthy()) {
+    listener_->Park(std::move(endpoint_));
+  } else {
+    endpoint_.in->Close();
+    endpoint_.out->Close();
+  }
+}
+
+// InMemoryServer
+
+InMemoryServer::InMemoryServer(std::shared_ptr<InMemoryNetwork> network,
+                               const IAddress &address)
+    : network_(std::move(network)), address_(address.raw()),
+      listener_(network_->Bind(address_.raw())) {
+  if (!listener_) {
+    LOG(kERRORS) << address_.raw() << ": InMemoryServer: address is in use";
+    exit(1);
+  }
+}
+
+InMemoryServer::~InMemoryServer() {
+  listener_->Close();
+  network_->Unbind(address_.raw());
+}
+
+std::unique_ptr<IConnection> InMemoryServer::WaitForConnection(int timeout) {
+  InMemoryEndpoint endpoint;
+  if (!listener_->Accept(timeout, endpoint))
+    return nullptr;
+  return std::make_unique<InMemoryConnection>(std::move(endpoint), listener_);
+}
+
+// InMemoryClient
+
+std::unique_ptr<IConnection> InMemoryClient::Connect(const IAddress &address,
+                                                     int timeout) {
+  // There is no backlog to wait for, a missing peer is reported at once.
+  std::shared_ptr<InMemoryListener> listener = network_->Find(address.raw());
+  auto to_server = std::make_shared<FrameQueue>();
+  auto to_client = std::make_shared<FrameQueue>();
+  if (!listener || !listener->Enqueue({to_server, to_client})) {
+    LOG(kERRORS) << address.raw()
+                 << ": InMemoryClient::Connect: connection refused";
+    return nullptr;
+  }
+  return std::make_unique<InMemoryConnection>(
+      InMemoryEndpoint{to_client, to_server});
+}
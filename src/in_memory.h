@@ -0,0 +1,186 @@
+#ifndef IN_MEMORY_H_
+#define IN_MEMORY_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "framed_connection.h"
+#include "i_connection_method.h"
+
+// Loopback transport for nodes and a controller that share one process, e.g.
+// in benchmarks. Frames are moved through in-process queues, so the cost of
+// the node and controller logic can be measured without the kernel.
+
+class InMemoryAddress : public IAddress {
+public:
+  explicit InMemoryAddress(std::string name) : name_(std::move(name)) {}
+  const std::string &raw() const override { return name_; }
+
+private:
+  std::string name_;
+};
+
+class InMemoryListener;
+
+// One direction of a connection. Frames pushed before Close() can still be
+// popped. Frames live in FramePool buffers, which go back and forth between
+// the peers instead of being allocated per frame.
+class FrameQueue {
+public:
+  // Returns false once either side closed the queue.
+  bool Push(const FramePart *parts, std::size_t count);
+  // Waits up to `timeout` ms, or forever if negative, for the next frame.
+  // The buffer `frame` had goes back to the FramePool.
+  bool Pop(std::vector<char> &frame, int timeout);
+  void Close();
+  bool has_frame();
+  bool is_closed();
+  // `listener` is woken on every Push() and Close() while it parks the
+  // connection this queue belongs to.
+  void set_watcher(std::weak_ptr<InMemoryListener> listener);
+
+private:
+  void NotifyWatcher();
+  std::mutex mutex_;
+  std::condition_variable has_frame_;
+  std::deque<std::vector<char>> frames_;
+  bool is_closed_ = false;
+  std::weak_ptr<InMemoryListener> watcher_;
+};
+
+// Both queues of a connection as seen from one of its ends.
+struct InMemoryEndpoint {
+  std::shared_ptr<FrameQueue> in;
+  std::shared_ptr<FrameQueue> out;
+};
+
+// Accept queue of an InMemoryServer. Like UnixSocketServer it parks accepted
+// connections after Close() and hands them out again once the client writes
+// to them.
+class InMemoryListener
+    : public std::enable_shared_from_this<InMemoryListener> {
+public:
+  // Returns false if the listener is closed.
+  bool Enqueue(InMemoryEndpoint endpoint);
+  // Waits up to `timeout` ms, or forever if negative, for a new connection or
+  // a parked one with a frame to read.
+  bool Accept(int timeout, InMemoryEndpoint &endpoint);
+  void Park(InMemoryEndpoint endpoint);
+  void Notify();
+  // Makes the current or next Accept() return, see IServer::Interrupt().
+  void Interrupt();
+  void Close();
+
+private:
+  bool TakeReady(InMemoryEndpoint &endpoint);
+  std::mutex mutex_;
+  std::condition_variable has_connection_;
+  std::deque<InMemoryEndpoint> pending_;
+  std::vector<InMemoryEndpoint> idle_;
+  bool is_closed_ = false;
+  bool is_interrupted_ = false;
+};
+
+// Name to listener map shared by everything created by one InMemoryFactory.
+class InMemoryNetwork {
+public:
+  // Returns nullptr if the name is taken by a live server.
+  std::shared_ptr<InMemoryListener> Bind(const std::string &name);
+  void Unbind(const std::string &name);
+  std::shared_ptr<InMemoryListener> Find(const std::string &name);
+  // Closes every listener, so that all waiting servers return at once.
+  void Shutdown();
+
+private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::weak_ptr<InMemoryListener>> listeners_;
+  bool is_shut_down_ = false;
+};
+
+class InMemoryConnection : public FramedConnection {
+public:
+  InMemoryConnection(InMemoryEndpoint endpoint,
+                     std::shared_ptr<InMemoryListener> listener = nullptr);
+  ~InMemoryConnection() override;
+  InMemoryConnection(const InMemoryConnection &) = delete;
+  InMemoryConnection &operator=(const InMemoryConnection &) = delete;
+
+  void Close() override;
+  bool is_server() const override { return static_cast<bool>(listener_); }
+  bool is_reusable() const override { return !listener_; }
+
+protected:
+  bool SendFrame(const FramePart *parts, std::size_t count) override;
+  bool ReceiveFrame(std::vector<char> &buffer, std::size_t &size,
+                    int timeout) override;
+
+private:
+  InMemoryEndpoint endpoint_;
+  // listener that accepted this connection, it takes it back on Close()
+  std::shared_ptr<InMemoryListener> listener_;
+  bool is_closed_ = false;
+};
+
+class InMemoryServer : public IServer {
+public:
+  InMemoryServer(std::shared_ptr<InMemoryNetwork> network,
+                 const IAddress &address);
+  ~InMemoryServer() override;
+  InMemoryServer(const InMemoryServer &) = delete;
+  InMemoryServer &operator=(const InMemoryServer &) = delete;
+
+  std::unique_ptr<IConnection> WaitForConnection(int timeout) override;
+  void Interrupt() override { listener_->Interrupt(); }
+  const IAddress &address() const override { return address_; }
+  const std::string &address_str() const override { return address_.raw(); }
+
+private:
+  std::shared_ptr<InMemoryNetwork> network_;
+  InMemoryAddress address_;
+  std::shared_ptr<InMemoryListener> listener_;
+};
+
+class InMemoryClient : public IClient {
+public:
+  explicit InMemoryClient(std::shared_ptr<InMemoryNetwork> network)
+      : network_(std::move(network)) {}
+  std::unique_ptr<IConnection> Connect(const IAddress &address,
+                                       int timeout) override;
+
+private:
+  std::shared_ptr<InMemoryNetwork> network_;
+};
+
+class InMemoryFactory : public IConnectionMethodFactory {
+public:
+  InMemoryFactory() : network_(std::make_shared<InMemoryNetwork>()) {}
+  std::unique_ptr<IAddress> GenerateAddress() override {
+    return NewAddress("node-" + std::to_string(generated_count_++));
+  }
+  std::unique_ptr<IAddress> NewAddress(std::string address) override {
+    return std::make_unique<InMemoryAddress>(std::move(address));
+  }
+  std::unique_ptr<IServer> NewServer(const IAddress &address) override {
+    return std::make_unique<InMemoryServer>(network_, address);
+  }
+  std::unique_ptr<IClient> NewClient() override {
+    return std::make_unique<InMemoryClient>(network_);
+  }
+  std::unique_ptr<IAddress> ControllerAddress() override {
+    return NewAddress("controller");
+  }
+  // Wakes every server waiting for a connection, see InMemoryNetwork.
+  void Shutdown() { network_->Shutdown(); }
+
+private:
+  std::shared_ptr<InMemoryNetwork> network_;
+  std::atomic<int> generated_count_{0};
+};
+
+#endif // IN_MEMORY_H_
@@ -0,0 +1,113 @@
+#include "log.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+const char *Label(typelog type) {
+  switch (type) {
+  case kDEBUG:
+    return "[DEBUG:]";
+  case kINFO:
+    return "[SYSTEM ANNOUNCEMENT:]";
+  case kERRORS:
+    return "[ERROR:]";
+  }
+  return "";
+}
+} // namespace
+
+// Logger
+
+Logger &Logger::Instance() {
+  static Logger logger;
+  return logger;
+}
+
+Logger::Logger() {
+  for (std::size_t i = 0; i < kCapacity; ++i)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  drainer_ = std::thread(&Logger::DrainLoop, this);
+}
+
+Logger::~Logger() {
+  is_stopping_ = true;
+  has_lines_.notify_one();
+  drainer_.join();
+}
+
+void Logger::Push(const char *text, std::size_t size) {
+  // bounded MPMC queue of D. Vyukov, every slot carries its turn number
+  std::size_t position = enqueue_position_.load(std::memory_order_relaxed);
+  Slot *slot;
+  while (true) {
+    slot = &slots_[position & (kCapacity - 1)];
+    std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    auto distance = static_cast<std::intptr_t>(sequence) -
+                    static_cast<std::intptr_t>(position);
+    if (distance == 0) {
+      if (enqueue_position_.compare_exchange_weak(position, position + 1,
+                                                  std::memory_order_relaxed))
+        break;
+    } else if (distance < 0) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = enqueue_position_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->size = size < kMaxLineLength ? size : kMaxLineLength;
+  std::memcpy(slot->text, text, slot->size);
+  slot->sequence.store(position + 1, std::memory_order_release);
+  if (is_drainer_waiting_.load(std::memory_order_relaxed))
+    has_lines_.notify_one();
+}
+
+bool Logger::Pop(Slot *&slot) {
+  slot = &slots_[dequeue_position_ & (kCapacity - 1)];
+  return slot->sequence.load(std::memory_order_acquire) ==
+         dequeue_position_ + 1;
+}
+
+void Logger::DrainLoop() {
+  using namespace std::chrono_literals;
+  std::uint64_t reported_dropped = 0;
+  while (true) {
+    Slot *slot;
+    bool has_written = false;
+    while (Pop(slot)) {
+      std::fwrite(slot->text, 1, slot->size, stderr);
+      std::fputc('\n', stderr);
+      slot->sequence.store(dequeue_position_ + kCapacity,
+                           std::memory_order_release);
+      ++dequeue_position_;
+      has_written = true;
+    }
+    std::uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped) {
+      std::fprintf(stderr, "%s%llu log lines dropped\n", Label(kERRORS),
+                   static_cast<unsigned long long>(dropped - reported_dropped));
+      reported_dropped = dropped;
+      has_written = true;
+    }
+    if (has_written)
+      std::fflush(stderr);
+    if (is_stopping_)
+      return;
+
+    // A producer notifies only while we wait, so a line pushed just before
+    // the flag is set waits at most one timeout.
+    std::unique_lock<std::mutex> lock(mutex_);
+    is_drainer_waiting_ = true;
+    if (!Pop(slot))
+      has_lines_.wait_for(lock, 50ms);
+    is_drainer_waiting_ = false;
+  }
+}
+
+// LogLine
+
+LogLine::LogLine(typelog type) : stream_(&buffer_) { stream_ << Label(type); }
+
+LogLine::~LogLine() { Logger::Instance().Push(buffer_.data(), buffer_.size()); }
@@ -1,52 +1,104 @@
-#ifndef LOG_H_
-#define LOG_H_
-
-#include <iostream>
-#include <sstream>
-
-using namespace std;
-
-enum typelog { kDEBUG, kINFO, kERRORS };
-
-class LOG {
-public:
-  LOG() { msglevel = kDEBUG; }
-  LOG(typelog type) {
-    msglevel = type;
-    operator<<("[" + getLabel(type) + "]");
-  }
-
-  ~LOG() {
-    if (opened) {
-      cerr << endl;
-    }
-    opened = false;
-  }
-
-  template <class T> LOG &operator<<(const T &msg) {
-    cerr << msg;
-    opened = true;
-    return *this;
-  }
-
-private:
-  bool opened = false;
-  typelog msglevel = kDEBUG;
-  inline string getLabel(typelog type) {
-    string label;
-    switch (type) {
-    case kDEBUG:
-      label = "DEBUG:";
-      break;
-    case kINFO:
-      label = "SYSTEM ANNOUNCEMENT:";
-      break;
-    case kERRORS:
-      label = "ERROR:";
-      break;
-    }
-    return label;
-  }
-};
-
-#endif // LOG_H_
\ No newline at end of file
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+
+enum typelog { kDEBUG, kINFO, kERRORS };
+
+// Lines below this level are compiled out. Release builds drop kDEBUG.
+#ifndef LOG_MIN_LEVEL
+#  ifdef NDEBUG
+#    define LOG_MIN_LEVEL kINFO
+#  else
+#    define LOG_MIN_LEVEL kDEBUG
+#  endif
+#endif
+
+// Process-wide log backend. Producers copy finished lines into a bounded
+// lock-free ring and never wait; a background thread writes them to stderr.
+// When the ring is full the line is dropped and counted.
+class Logger {
+public:
+  static constexpr std::size_t kMaxLineLength = 256;
+  static constexpr std::size_t kCapacity = 1024; // lines, a power of two
+
+  static Logger &Instance();
+
+  bool IsEnabled(typelog type) const {
+    return type >= level_.load(std::memory_order_relaxed);
+  }
+  void set_level(typelog type) { level_.store(type); }
+  void Push(const char *text, std::size_t size);
+  std::uint64_t dropped() const { return dropped_.load(); }
+
+private:
+  struct Slot {
+    std::atomic<std::size_t> sequence;
+    std::size_t size;
+    char text[kMaxLineLength];
+  };
+  Logger();
+  ~Logger();
+  bool Pop(Slot *&slot);
+  void DrainLoop();
+  Slot slots_[kCapacity];
+  std::atomic<std::size_t> enqueue_position_{0};
+  std::size_t dequeue_position_ = 0;
+  std::atomic<typelog> level_{LOG_MIN_LEVEL};
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<bool> is_drainer_waiting_{false};
+  std::atomic<bool> is_stopping_{false};
+  std::mutex mutex_;
+  std::condition_variable has_lines_;
+  std::thread drainer_;
+};
+
+// One log line, formatted into a fixed buffer and handed to the Logger when
+// the statement ends. Text beyond Logger::kMaxLineLength is cut off.
+class LogLine {
+public:
+  explicit LogLine(typelog type);
+  ~LogLine();
+  LogLine(const LogLine &) = delete;
+  LogLine &operator=(const LogLine &) = delete;
+
+  template <class T> LogLine &operator<<(const T &msg) {
+    stream_ << msg;
+    return *this;
+  }
+
+private:
+  class Buffer : public std::streambuf {
+  public:
+    Buffer() { setp(data_, data_ + sizeof(data_)); }
+    const char *data() const { return data_; }
+    std::size_t size() const { return pptr() - pbase(); }
+
+  private:
+    char data_[Logger::kMaxLineLength];
+  };
+  Buffer buffer_;
+  std::ostream stream_;
+};
+
+// Turns the streamed LogLine into void, so LOG() can be the branch of ?:.
+class LogVoidify {
+public:
+  void operator&(const LogLine &) {}
+};
+
+// Disabled levels cost one comparison, or nothing below LOG_MIN_LEVEL. The
+// ?: form keeps LOG() safe inside an unbraced if/else.
+#define LOG(type)                                                              \
+  !((type) >= LOG_MIN_LEVEL && Logger::Instance().IsEnabled(type))             \
+      ? (void)0                                                                \
+      : LogVoidify() & LogLine(type)
+
+#endif // LOG_H_
@@ -1,85 +1,258 @@
-
-#include <iostream>
-#include <random>
-
-#include "common.h"
-#include "controller.h"
-#include "node.h"
-#include "pipe.h"
-
-namespace {
-void run_controller_in_separate_process() {
-  LOG(kINFO) << "Starting controller in separate thread...";
-  STARTUPINFO si{};
-  si.cb = sizeof(si);
-  PROCESS_INFORMATION pi{};
-  char current_file_path[1024];
-  GetModuleFileNameA(nullptr, current_file_path, 1024);
-  char command_line[] = "-C";
-  if (!CreateProcessA(current_file_path, command_line, nullptr, nullptr, false,
-                      CREATE_NEW_CONSOLE, nullptr, nullptr, &si, &pi)) {
-    WriteLastErrorMessage("Main::CreateProcess");
-  }
-}
-
-bool test_controller_pipe(IConnectionMethodFactory &factory) {
-  LOG(kINFO) << "Testing controller for existence...";
-  std::unique_ptr<IClient> client = factory.NewClient();
-  // Connection implemented taking into account RAII principle and factory
-  // pattern
-  std::unique_ptr<IConnection> connection =
-      client->Connect(*factory.ControllerAddress(), 500);
-  if (!connection) {
-    LOG(kINFO) << "Failed!";
-    return false;
-  }
-  Message m;
-  m.type = MessageType::kTEST_CONTROLLER;
-  if (!connection->Write(m)) {
-    LOG(kINFO) << "Failed!";
-    return false;
-  }
-  return true;
-}
-} // namespace
-
-int main(int argc, const char **argv) {
-
-  LOG(kINFO) << "Got " << argc << " arguments:";
-  for (int i = 0; i < argc; ++i) {
-    LOG(kINFO) << '\t' << argv[i];
-  }
-  LOG(kINFO) << '\n';
-  std::random_device rd;
-  std::mt19937 rng(rd());
-  std::uniform_int_distribution<int> uni(1, 9999);
-  uni(rng);
-
-  // Abstract factory was used. To make program use another ipc method it's
-  // needed to implement new group of classes and pass new factory to the
-  // constructors
-  PipeFactory factory;
-
-  for (int i = 0; i < argc; ++i) {
-    if (strcmp(argv[i], "-C") == 0) {
-      LOG(kINFO) << "Attempt to run controller...";
-      Controller controller(factory);
-      controller.Run();
-      LOG(kINFO) << "END";
-      char c;
-      std::cin >> c;
-      return 0;
-    }
-  }
-
-  if (!test_controller_pipe(factory)) {
-    run_controller_in_separate_process();
-    // sleep for giving the controller time to initialize
-    Sleep(200);
-  }
-  LOG(kINFO) << "Attempt to run node...";
-  Node node(factory);
-  node.Run();
-
-  return 0;
-}
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "controller.h"
+#include "metrics.h"
+#include "node.h"
+#include "pipe.h"
+#include "shm.h"
+#include "unix_socket.h"
+
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+const char *const kDefaultTransport = "pipe";
+#else
+const char *const kDefaultTransport = "unix";
+#endif
+
+typelog parse_log_level(const std::string &level) {
+  if (level == "debug")
+    return kDEBUG;
+  if (level == "error")
+    return kERRORS;
+  return kINFO;
+}
+
+TimePublication parse_time_publication(const std::string &publication) {
+  if (publication == "shm")
+    return TimePublication::kSHARED_MEMORY;
+  return TimePublication::kCONNECTIONS;
+}
+
+std::unique_ptr<IConnectionMethodFactory>
+make_factory(const std::string &transport) {
+#ifdef _WIN32
+  if (transport == "pipe")
+    return std::make_unique<PipeFactory>();
+#else
+  if (transport == "unix")
+    return std::make_unique<UnixSocketFactory>();
+#  ifdef __linux__
+  if (transport == "shm")
+    return std::make_unique<ShmFactory>();
+#  endif
+#endif
+  return nullptr;
+}
+
+// Next to the controller's socket, so that every cluster on the host has its
+// own. Named pipes are not files, there it goes to the working directory.
+std::string default_journal_path(IConnectionMethodFactory &factory) {
+#ifdef _WIN32
+  return "task7-controller.journal";
+#else
+  return factory.ControllerAddress()->raw() + ".journal";
+#endif
+}
+
+// `controller_options` are the controller flags given to this node, passed
+// on as they are.
+void run_controller_in_separate_process(
+    const std::string &transport,
+    const std::vector<std::string> &controller_options) {
+  LOG(kINFO) << "Starting controller in separate thread...";
+#ifdef _WIN32
+  STARTUPINFO si{};
+  si.cb = sizeof(si);
+  PROCESS_INFORMATION pi{};
+  char current_file_path[1024];
+  GetModuleFileNameA(nullptr, current_file_path, 1024);
+  std::string command_line = "-C -t " + transport;
+  for (auto &option : controller_options)
+    command_line += " " + option;
+  if (!CreateProcessA(current_file_path, command_line.data(), nullptr, nullptr,
+                      false, CREATE_NEW_CONSOLE, nullptr, nullptr, &si, &pi)) {
+    WriteLastErrorMessage("Main::CreateProcess");
+  }
+#else
+  pid_t pid = fork();
+  if (pid < 0) {
+    WriteLastErrorMessage("Main::fork");
+  } else if (pid == 0) {
+    // detach from the node's session so the controller outlives it
+    setsid();
+    std::vector<const char *> arguments{"task7", "-C", "-t",
+                                        transport.c_str()};
+    for (auto &option : controller_options)
+      arguments.push_back(option.c_str());
+    arguments.push_back(nullptr);
+    execv("/proc/self/exe", const_cast<char *const *>(arguments.data()));
+    WriteLastErrorMessage("Main::execv");
+    _exit(1);
+  }
+#endif
+}
+
+bool test_controller_pipe(IConnectionMethodFactory &factory) {
+  LOG(kINFO) << "Testing controller for existence...";
+  std::unique_ptr<IClient> client = factory.NewClient();
+  // Connection implemented taking into account RAII principle and factory
+  // pattern
+  std::unique_ptr<IConnection> connection =
+      client->Connect(*factory.ControllerAddress(), 500);
+  if (!connection) {
+    LOG(kINFO) << "Failed!";
+    return false;
+  }
+  Message m;
+  m.type = MessageType::kTEST_CONTROLLER;
+  if (!connection->Write(m)) {
+    LOG(kINFO) << "Failed!";
+    return false;
+  }
+  return true;
+}
+bool query_controller_stats(IConnectionMethodFactory &factory) {
+  std::unique_ptr<IClient> client = factory.NewClient();
+  std::unique_ptr<IConnection> connection =
+      client->Connect(*factory.ControllerAddress(), 500);
+  if (!connection)
+    return false;
+  Message m;
+  m.type = MessageType::kGET_STATS;
+  if (!connection->Write(m))
+    return false;
+  Message reply = connection->Read();
+  if (!reply.is_succeed || reply.type != MessageType::kSTATS)
+    return false;
+  std::cout << reply.text << std::endl;
+  return true;
+}
+
+// Polls until the freshly started controller listens. Connects to a missing
+// peer fail at once, so there is no point in a fixed startup delay.
+void wait_for_controller(IConnectionMethodFactory &factory) {
+  using namespace std::chrono_literals;
+  std::unique_ptr<IClient> client = factory.NewClient();
+  auto deadline = std::chrono::steady_clock::now() + 5s;
+  while (std::chrono::steady_clock::now() < deadline) {
+    std::unique_ptr<IConnection> connection =
+        client->Connect(*factory.ControllerAddress(), 100);
+    if (connection) {
+      Message m;
+      m.type = MessageType::kTEST_CONTROLLER;
+      if (connection->Write(m))
+        return;
+    }
+    std::this_thread::sleep_for(10ms);
+  }
+}
+} // namespace
+
+int main(int argc, const char **argv) {
+
+  LOG(kINFO) << "Got " << argc << " arguments:";
+  for (int i = 0; i < argc; ++i) {
+    LOG(kINFO) << '\t' << argv[i];
+  }
+  LOG(kINFO) << '\n';
+  std::random_device rd;
+  std::mt19937 rng(rd());
+  std::uniform_int_distribution<int> uni(1, 9999);
+  uni(rng);
+
+  std::string transport = kDefaultTransport;
+  TimePublication publication = TimePublication::kCONNECTIONS;
+  double failure_threshold = FailureDetector::kDefaultThreshold;
+  std::size_t relay_fanout = 0;
+  std::size_t worker_threads = 0;
+  // "none" runs the controller without a journal
+  std::string journal_path;
+  std::vector<std::string> controller_options;
+  bool is_stats_query = false;
+  for (int i = 0; i < argc; ++i) {
+    if (strcmp(argv[i], "-S") == 0)
+      is_stats_query = true;
+  }
+  for (int i = 0; i + 1 < argc; ++i) {
+    if (strcmp(argv[i], "-t") == 0)
+      transport = argv[i + 1];
+    if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "-k") == 0 ||
+        strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "-w") == 0) {
+      controller_options.push_back(argv[i]);
+      controller_options.push_back(argv[i + 1]);
+    }
+    if (strcmp(argv[i], "-f") == 0)
+      failure_threshold = std::atof(argv[i + 1]);
+    if (strcmp(argv[i], "-k") == 0)
+      relay_fanout = std::strtoul(argv[i + 1], nullptr, 10);
+    if (strcmp(argv[i], "-j") == 0)
+      journal_path = argv[i + 1];
+    if (strcmp(argv[i], "-w") == 0)
+      worker_threads = std::strtoul(argv[i + 1], nullptr, 10);
+    if (strcmp(argv[i], "-p") == 0)
+      publication = parse_time_publication(argv[i + 1]);
+    if (strcmp(argv[i], "-l") == 0)
+      Logger::Instance().set_level(parse_log_level(argv[i + 1]));
+    if (strcmp(argv[i], "-m") == 0)
+      Metrics::Instance().StartPeriodicDump(
+          std::chrono::seconds(std::atoi(argv[i + 1])), false);
+    if (strcmp(argv[i], "-M") == 0)
+      Metrics::Instance().StartPeriodicDump(
+          std::chrono::seconds(std::atoi(argv[i + 1])), true);
+  }
+
+  // Abstract factory was used. To make program use another ipc method it's
+  // needed to implement new group of classes and pass new factory to the
+  // constructors
+  std::unique_ptr<IConnectionMethodFactory> factory = make_factory(transport);
+  if (!factory) {
+    LOG(kERRORS) << "Transport " << transport
+                 << " is not supported on this platform";
+    return 1;
+  }
+
+  if (is_stats_query)
+    return query_controller_stats(*factory) ? 0 : 1;
+
+  for (int i = 0; i < argc; ++i) {
+    if (strcmp(argv[i], "-C") == 0) {
+      LOG(kINFO) << "Attempt to run controller...";
+      if (journal_path.empty())
+        journal_path = default_journal_path(*factory);
+      else if (journal_path == "none")
+        journal_path.clear();
+      Controller controller(*factory, Controller::kDefaultMaxNodes,
+                            failure_threshold, relay_fanout, journal_path,
+                            worker_threads);
+      controller.Run();
+      LOG(kINFO) << "END";
+#ifdef _WIN32
+      // keep the controller's console open
+      char c;
+      std::cin >> c;
+#endif
+      return 0;
+    }
+  }
+
+  if (!test_controller_pipe(*factory)) {
+    run_controller_in_separate_process(transport, controller_options);
+    wait_for_controller(*factory);
+  }
+  LOG(kINFO) << "Attempt to run node...";
+  Node node(*factory, publication);
+  node.Run();
+
+  return 0;
+}
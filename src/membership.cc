@@ -0,0 +1,304 @@
+#include "membership.h"
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_set>
+#include <utility>
+
+#include "log.h"
+#include "wire_format.h"
+
+namespace {
+// Payload budget for the members of one frame, well below kMaxFrameSize so
+// that the other fields always fit.
+const std::size_t kChunkBytes = 32 * 1024;
+// Frames of a run in flight before the writer waits for acks.
+const std::size_t kChunkAckWindow = 8;
+// tag and length of a field
+const std::size_t kFieldOverhead = 3;
+
+// Cuts a run of frames as members are added.
+class ChunkWriter {
+public:
+  ChunkWriter(IConnection &connection, Message message)
+      : connection_(connection), message_(std::move(message)) {
+    connection_.set_ack_window(kChunkAckWindow);
+    Clear();
+    message_.has_more = true;
+  }
+
+  void Add(NodeId id, const std::string &address) {
+    std::size_t size = kFieldOverhead + address.size() + sizeof(id);
+    if (chunk_bytes_ + size > kChunkBytes)
+      WriteChunk();
+    message_.node_ids.push_back(id);
+    message_.addresses.push_back(address);
+    chunk_bytes_ += size;
+  }
+
+  void AddRemoved(NodeId id) {
+    if (chunk_bytes_ + sizeof(id) > kChunkBytes)
+      WriteChunk();
+    message_.removed_ids.push_back(id);
+    chunk_bytes_ += sizeof(id);
+  }
+
+  bool Finish() {
+    message_.has_more = false;
+    WriteChunk();
+    is_written_ = is_written_ && connection_.Flush();
+    connection_.set_ack_window(1);
+    return is_written_;
+  }
+
+private:
+  void WriteChunk() {
+    if (is_written_ && !connection_.Write(message_))
+      is_written_ = false;
+    Clear();
+  }
+
+  void Clear() {
+    message_.addresses.clear();
+    message_.node_ids.clear();
+    message_.removed_ids.clear();
+    // the id fields are packed, a few bytes of overhead
+    chunk_bytes_ = 2 * kFieldOverhead;
+  }
+
+  IConnection &connection_;
+  Message message_;
+  std::size_t chunk_bytes_ = 0;
+  bool is_written_ = true;
+};
+
+template <class T> void Append(std::vector<T> &to, std::vector<T> &from) {
+  to.insert(to.end(), std::make_move_iterator(from.begin()),
+            std::make_move_iterator(from.end()));
+}
+
+// Fibonacci hashing, spreads the sequential ids over the table.
+std::size_t HashId(NodeId id, std::size_t mask) {
+  return (static_cast<std::size_t>(id) * 0x9E3779B97F4A7C15ull >> 32) & mask;
+}
+} // namespace
+
+// MembershipTable
+
+bool MembershipTable::Insert(NodeId id, const std::string &address) {
+  if (2 * (dense_.size() + 1) > slots_.size())
+    Grow();
+  Slot &slot = slots_[Probe(id)];
+  if (slot.id == id)
+    return false;
+  slot.id = id;
+  slot.position = static_cast<std::uint32_t>(dense_.size());
+  Member member{id, address, nullptr};
+  if (resolver_)
+    member.resolved = resolver_->NewAddress(address);
+  dense_.push_back(std::move(member));
+  return true;
+}
+
+bool MembershipTable::Erase(NodeId id) {
+  if (slots_.empty())
+    return false;
+  std::size_t hole = Probe(id);
+  if (slots_[hole].id != id)
+    return false;
+  // move the last member into the gap in the dense array
+  std::size_t position = slots_[hole].position;
+  if (position + 1 != dense_.size()) {
+    dense_[position] = std::move(dense_.back());
+    slots_[Probe(dense_[position].id)].position =
+        static_cast<std::uint32_t>(position);
+  }
+  dense_.pop_back();
+  // Backward shift: later entries of the probe run move up into the hole,
+  // so lookups need no tombstones.
+  std::size_t mask = slots_.size() - 1;
+  for (std::size_t next = (hole + 1) & mask; slots_[next].id != kNoNode;
+       next = (next + 1) & mask) {
+    std::size_t home = HashId(slots_[next].id, mask);
+    // whether `home` lies cyclically in (hole, next]
+    bool stays = hole <= next ? hole < home && home <= next
+                              : hole < home || home <= next;
+    if (stays)
+      continue;
+    slots_[hole] = slots_[next];
+    hole = next;
+  }
+  slots_[hole] = Slot{};
+  return true;
+}
+
+void MembershipTable::Clear() {
+  dense_.clear();
+  std::fill(slots_.begin(), slots_.end(), Slot{});
+}
+
+std::size_t MembershipTable::position(NodeId id) const {
+  if (slots_.empty() || id == kNoNode)
+    return size();
+  const Slot &slot = slots_[Probe(id)];
+  return slot.id == id ? slot.position : size();
+}
+
+std::size_t MembershipTable::Probe(NodeId id) const {
+  std::size_t mask = slots_.size() - 1;
+  std::size_t index = HashId(id, mask);
+  while (slots_[index].id != kNoNode && slots_[index].id != id)
+    index = (index + 1) & mask;
+  return index;
+}
+
+void MembershipTable::Grow() {
+  std::vector<Slot> slots(std::max<std::size_t>(16, 2 * slots_.size()));
+  slots_.swap(slots);
+  for (const Slot &slot : slots) {
+    if (slot.id != kNoNode)
+      slots_[Probe(slot.id)] = slot;
+  }
+}
+
+// VersionedMembership
+
+NodeId VersionedMembership::Insert(const std::string &address) {
+  auto [it, is_inserted] = ids_.emplace(address, last_id_ + 1);
+  if (!is_inserted)
+    return kNoNode;
+  NodeId id = ++last_id_;
+  table_.Insert(id, address);
+  Log(id);
+  return id;
+}
+
+bool VersionedMembership::Erase(NodeId id) {
+  std::size_t position = table_.position(id);
+  if (position == table_.size())
+    return false;
+  ids_.erase(table_.at(position).address);
+  table_.Erase(id);
+  Log(id);
+  return true;
+}
+
+void VersionedMembership::Restore(const std::vector<Member> &members,
+                                  std::uint64_t epoch, NodeId last_id) {
+  table_.Clear();
+  ids_.clear();
+  last_id_ = last_id;
+  for (auto &member : members) {
+    table_.Insert(member.id, member.address);
+    ids_.emplace(member.address, member.id);
+    last_id_ = std::max(last_id_, member.id);
+  }
+  log_.clear();
+  epoch_ = epoch;
+}
+
+void VersionedMembership::Log(NodeId id) {
+  log_.push_back({++epoch_, id});
+  if (log_.size() > log_size_)
+    log_.pop_front();
+}
+
+bool VersionedMembership::MakeDelta(std::uint64_t base_epoch,
+                                    Message &delta) const {
+  if (base_epoch > epoch_)
+    return false;
+  std::uint64_t oldest_logged = log_.empty() ? epoch_ + 1 : log_.front().epoch;
+  if (base_epoch + 1 < oldest_logged)
+    return false;
+
+  std::unordered_set<NodeId> changed;
+  for (auto it = log_.rbegin(); it != log_.rend() && it->epoch > base_epoch;
+       ++it) {
+    changed.insert(it->id);
+    if (changed.size() > table_.size())
+      return false;
+  }
+  delta.type = MessageType::kMEMBERSHIP_DELTA;
+  delta.base_epoch = base_epoch;
+  delta.epoch = epoch_;
+  delta.addresses.clear();
+  delta.node_ids.clear();
+  delta.removed_ids.clear();
+  for (NodeId id : changed) {
+    std::size_t position = table_.position(id);
+    if (position == table_.size()) {
+      delta.removed_ids.push_back(id);
+      continue;
+    }
+    delta.node_ids.push_back(id);
+    delta.addresses.push_back(table_.at(position).address);
+  }
+  return true;
+}
+
+// ShardedMembership
+
+ShardedMembership::ShardedMembership(std::size_t shards)
+    : shard_count_(shards), shards_(std::make_unique<Shard[]>(shards)) {}
+
+ShardedMembership::InsertResult
+ShardedMembership::Insert(const std::string &address, std::size_t max_size) {
+  Shard &shard = ShardOf(address);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.members.count(address) != 0)
+    return InsertResult::kPRESENT;
+  if (size() >= max_size)
+    return InsertResult::kFULL;
+  shard.members.insert(address);
+  shard.inserted.push_back(address);
+  size_.fetch_add(1, std::memory_order_relaxed);
+  return InsertResult::kINSERTED;
+}
+
+bool ShardedMembership::Erase(const std::string &address) {
+  Shard &shard = ShardOf(address);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.members.erase(address) == 0)
+    return false;
+  size_.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+// Chunked transfer
+
+bool WriteChunked(IConnection &connection, Message message,
+                  const MembershipTable &members) {
+  ChunkWriter writer(connection, std::move(message));
+  members.ForEach(
+      [&](const Member &member) { writer.Add(member.id, member.address); });
+  return writer.Finish();
+}
+
+bool WriteChunked(IConnection &connection, Message message) {
+  std::vector<std::string> addresses = std::move(message.addresses);
+  std::vector<NodeId> ids = std::move(message.node_ids);
+  std::vector<NodeId> removed = std::move(message.removed_ids);
+  if (ids.size() != addresses.size())
+    return false;
+  ChunkWriter writer(connection, std::move(message));
+  for (std::size_t i = 0; i < ids.size(); ++i)
+    writer.Add(ids[i], addresses[i]);
+  for (NodeId id : removed)
+    writer.AddRemoved(id);
+  return writer.Finish();
+}
+
+bool ReadChunked(IConnection &connection, Message &message) {
+  Message next;
+  while (message.has_more) {
+    if (!connection.Read(next, kReadTimeout) || next.type != message.type) {
+      LOG(kDEBUG) << "ReadChunked: membership transfer broke off";
+      return false;
+    }
+    Append(message.addresses, next.addresses);
+    Append(message.node_ids, next.node_ids);
+    Append(message.removed_ids, next.removed_ids);
+    message.has_more = next.has_more;
+  }
+  return true;
+}
@@ -0,0 +1,184 @@
+#ifndef MEMBERSHIP_H_
+#define MEMBERSHIP_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "i_connection_method.h"
+
+struct Member {
+  NodeId id = kNoNode;
+  std::string address;
+  // set if the table resolves addresses, see MembershipTable
+  std::shared_ptr<const IAddress> resolved;
+};
+
+// Set of nodes by id. Members sit in a dense array, for cheap iteration and
+// positional access, and an open-addressing index maps ids to positions, so
+// Insert, Erase and Contains are O(1) and hash no strings. A table built with
+// a factory resolves every address once, on Insert, so that sending to the
+// members allocates no addresses.
+class MembershipTable {
+public:
+  explicit MembershipTable(IConnectionMethodFactory *resolver = nullptr)
+      : resolver_(resolver) {}
+  MembershipTable(const MembershipTable &) = delete;
+  MembershipTable &operator=(const MembershipTable &) = delete;
+
+  // Return false if nothing changed. `id` must not be kNoNode.
+  bool Insert(NodeId id, const std::string &address);
+  bool Erase(NodeId id);
+  void Clear();
+  bool Contains(NodeId id) const { return position(id) != size(); }
+  std::size_t size() const { return dense_.size(); }
+  bool empty() const { return dense_.empty(); }
+  // Order is arbitrary and changes on Erase().
+  const Member &at(std::size_t position) const { return dense_[position]; }
+  // Position of `id` for at(), size() if it is not a member.
+  std::size_t position(NodeId id) const;
+
+  template <class Function> void ForEach(Function function) const {
+    for (const Member &member : dense_)
+      function(member);
+  }
+
+private:
+  struct Slot {
+    NodeId id = kNoNode;
+    std::uint32_t position = 0;
+  };
+  // slot `id` is in or would go to
+  std::size_t Probe(NodeId id) const;
+  void Grow();
+  IConnectionMethodFactory *resolver_;
+  std::vector<Member> dense_;
+  // linear probing, at most half full; the size is a power of two
+  std::vector<Slot> slots_;
+};
+
+// MembershipTable that assigns the ids, with an epoch that every change
+// bumps, and a log of the latest changes, so that a peer at an older epoch
+// can catch up with a delta proportional to the churn instead of the cluster
+// size.
+class VersionedMembership {
+public:
+  static constexpr std::size_t kDefaultLogSize = 4096;
+  explicit VersionedMembership(IConnectionMethodFactory *resolver = nullptr,
+                               std::size_t log_size = kDefaultLogSize)
+      : table_(resolver), log_size_(log_size) {}
+
+  // Returns the id of the new member, kNoNode if `address` is one already.
+  NodeId Insert(const std::string &address);
+  bool Erase(NodeId id);
+  // kNoNode if `address` is not a member.
+  NodeId Find(const std::string &address) const {
+    auto it = ids_.find(address);
+    return it == ids_.end() ? kNoNode : it->second;
+  }
+  // Replaces the members and the epoch, as after a restart. New ids start
+  // after `last_id` and the ids of `members`. The log starts out empty, so
+  // the next MakeDelta() asks for a snapshot.
+  void Restore(const std::vector<Member> &members, std::uint64_t epoch,
+               NodeId last_id);
+  const MembershipTable &table() const { return table_; }
+  std::uint64_t epoch() const { return epoch_; }
+  // Highest id handed out so far.
+  NodeId last_id() const { return last_id_; }
+
+  // Turns `delta` into a kMEMBERSHIP_DELTA from `base_epoch` to epoch(). A
+  // node changed several times appears once, with its current state, so the
+  // delta can also be applied on top of any epoch after `base_epoch`.
+  // Returns false if a snapshot is due instead: the log does not reach back
+  // to `base_epoch`, or the delta would be larger than the table.
+  bool MakeDelta(std::uint64_t base_epoch, Message &delta) const;
+
+private:
+  struct Change {
+    std::uint64_t epoch;
+    NodeId id;
+  };
+  void Log(NodeId id);
+  MembershipTable table_;
+  // for registrations, which come by address
+  std::unordered_map<std::string, NodeId> ids_;
+  NodeId last_id_ = kNoNode;
+  std::uint64_t epoch_ = 0;
+  std::size_t log_size_;
+  std::deque<Change> log_;
+};
+
+// Set of addresses that many threads register into at once. It is split
+// into shards with a lock each, so that registrations of different addresses
+// rarely wait for each other. New members also queue up in their shard until
+// the single consumer of the set takes them with Drain().
+class ShardedMembership {
+public:
+  static constexpr std::size_t kDefaultShards = 64;
+  enum class InsertResult { kINSERTED, kPRESENT, kFULL };
+  explicit ShardedMembership(std::size_t shards = kDefaultShards);
+  ShardedMembership(const ShardedMembership &) = delete;
+  ShardedMembership &operator=(const ShardedMembership &) = delete;
+
+  // kFULL once there are `max_size` members. Inserts that race may overshoot
+  // it by one each.
+  InsertResult Insert(const std::string &address, std::size_t max_size);
+  bool Erase(const std::string &address);
+  std::size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  // Calls `function` on every address inserted since the last call that is
+  // still a member, shard by shard, under the lock of its shard.
+  template <class Function> void Drain(Function function) {
+    std::vector<std::string> inserted;
+    for (std::size_t i = 0; i < shard_count_; ++i) {
+      Shard &shard = shards_[i];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      inserted.swap(shard.inserted);
+      for (auto &address : inserted) {
+        if (shard.members.count(address) != 0)
+          function(address);
+      }
+      inserted.clear();
+    }
+  }
+
+private:
+  // own cache lines, the locks of neighbouring shards do not false share
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::unordered_set<std::string> members;
+    std::vector<std::string> inserted;
+  };
+  Shard &ShardOf(const std::string &address) {
+    return shards_[std::hash<std::string>{}(address) % shard_count_];
+  }
+  std::size_t shard_count_;
+  std::unique_ptr<Shard[]> shards_;
+  std::atomic<std::size_t> size_{0};
+};
+
+// Membership transfers do not fit into one frame once the cluster grows, so
+// they are split into runs of frames of the same type. All frames but the
+// last have Message::has_more set.
+
+// Writes `message` with `members` spread over as many frames as needed.
+// Leaves the connection with an ack window of one.
+bool WriteChunked(IConnection &connection, Message message,
+                  const MembershipTable &members);
+// Same for the members and removed_ids that `message` carries.
+bool WriteChunked(IConnection &connection, Message message);
+
+// Completes `message`, the first frame of a run, with the members and
+// removed_ids of the frames that follow it. Returns false if the run breaks
+// off, or a frame takes longer than kReadTimeout.
+bool ReadChunked(IConnection &connection, Message &message);
+
+#endif // MEMBERSHIP_H_
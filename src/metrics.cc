@@ -0,0 +1,172 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+#include "common.h"
+
+namespace {
+double ToMicroseconds(std::uint64_t nanoseconds) {
+  return static_cast<double>(nanoseconds) / 1000.0;
+}
+} // namespace
+
+// Histogram
+
+std::size_t Histogram::BucketOf(std::uint64_t value) {
+  if (value < kSubBuckets)
+    return static_cast<std::size_t>(value);
+  // the top kSubBucketBits + 1 bits select the bucket
+  int shift = HighestBit(value) - kSubBucketBits;
+  std::size_t sub_bucket = (value >> shift) - kSubBuckets;
+  return static_cast<std::size_t>(shift + 1) * kSubBuckets + sub_bucket;
+}
+
+std::uint64_t Histogram::LowestValueOf(std::size_t bucket) {
+  if (bucket < kSubBuckets)
+    return bucket;
+  std::size_t shift = bucket / kSubBuckets - 1;
+  std::uint64_t sub_bucket = bucket % kSubBuckets;
+  return (kSubBuckets + sub_bucket) << shift;
+}
+
+void Histogram::Record(std::chrono::nanoseconds latency) {
+  auto value = static_cast<std::uint64_t>(std::max<std::int64_t>(
+      0, static_cast<std::int64_t>(latency.count())));
+  buckets_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  std::uint64_t current_max = max_.load(std::memory_order_relaxed);
+  while (value > current_max &&
+         !max_.compare_exchange_weak(current_max, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+std::uint64_t Histogram::Percentile(double q) const {
+  std::uint64_t total = count();
+  if (total == 0)
+    return 0;
+  auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total));
+  rank = std::min(std::max<std::uint64_t>(rank, 1), total);
+  std::uint64_t seen = 0;
+  for (std::size_t bucket = 0; bucket < kBuckets; ++bucket) {
+    seen += buckets_[bucket].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      // middle of the bucket, never above the exact maximum
+      std::uint64_t low = LowestValueOf(bucket);
+      std::uint64_t high =
+          bucket + 1 < kBuckets ? LowestValueOf(bucket + 1) : low;
+      return std::min(low + (high - low) / 2, max());
+    }
+  }
+  return max();
+}
+
+void Histogram::Reset() {
+  for (auto &bucket : buckets_)
+    bucket.store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+// Metrics
+
+Metrics &Metrics::Instance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+Counter &Metrics::counter(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &metric = counters_[name];
+  if (!metric)
+    metric = std::make_unique<Counter>();
+  return *metric;
+}
+
+Gauge &Metrics::gauge(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &metric = gauges_[name];
+  if (!metric)
+    metric = std::make_unique<Gauge>();
+  return *metric;
+}
+
+Histogram &Metrics::histogram(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &metric = histograms_[name];
+  if (!metric)
+    metric = std::make_unique<Histogram>();
+  return *metric;
+}
+
+std::string Metrics::DumpText() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  for (auto &[name, metric] : counters_)
+    out << name << " " << metric->value() << '\n';
+  for (auto &[name, metric] : gauges_)
+    out << name << " " << metric->value() << '\n';
+  for (auto &[name, metric] : histograms_) {
+    out << name << " count=" << metric->count()
+        << " p50=" << ToMicroseconds(metric->Percentile(0.5))
+        << "us p99=" << ToMicroseconds(metric->Percentile(0.99))
+        << "us max=" << ToMicroseconds(metric->max()) << "us\n";
+  }
+  return out.str();
+}
+
+std::string Metrics::DumpJson() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << "{\"counters\":{";
+  const char *separator = "";
+  for (auto &[name, metric] : counters_) {
+    out << separator << '"' << name << "\":" << metric->value();
+    separator = ",";
+  }
+  out << "},\"gauges\":{";
+  separator = "";
+  for (auto &[name, metric] : gauges_) {
+    out << separator << '"' << name << "\":" << metric->value();
+    separator = ",";
+  }
+  out << "},\"histograms_us\":{";
+  separator = "";
+  for (auto &[name, metric] : histograms_) {
+    out << separator << '"' << name << "\":{\"count\":" << metric->count()
+        << ",\"p50\":" << ToMicroseconds(metric->Percentile(0.5))
+        << ",\"p99\":" << ToMicroseconds(metric->Percentile(0.99))
+        << ",\"max\":" << ToMicroseconds(metric->max()) << '}';
+    separator = ",";
+  }
+  out << "}}";
+  return out.str();
+}
+
+void Metrics::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &[name, metric] : counters_)
+    metric->Reset();
+  for (auto &[name, metric] : histograms_)
+    metric->Reset();
+}
+
+void Metrics::StartPeriodicDump(std::chrono::seconds interval, bool is_json) {
+  if (interval.count() <= 0)
+    return;
+  // Dumps go to stdout, apart from the log on stderr, and may be longer
+  // than a log line.
+  std::thread([this, interval, is_json]() {
+    while (true) {
+      std::this_thread::sleep_for(interval);
+      std::string dump = is_json ? DumpJson() + "\n" : DumpText() + "\n";
+      std::fwrite(dump.data(), 1, dump.size(), stdout);
+      std::fflush(stdout);
+    }
+  }).detach();
+}
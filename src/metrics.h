@@ -0,0 +1,111 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class Counter {
+public:
+  void Increment(std::uint64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+  std::uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+  void Reset() { value_.store(0, std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::uint64_t> value_{0};
+};
+
+class Gauge {
+public:
+  void Set(std::int64_t value) {
+    value_.store(value, std::memory_order_relaxed);
+  }
+  void Add(std::int64_t delta) {
+    value_.fetch_add(delta, std::memory_order_relaxed);
+  }
+  std::int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::int64_t> value_{0};
+};
+
+// Latency histogram in nanoseconds with HDR-style log-linear buckets: every
+// power of two is split into 16 sub-buckets, so a reported percentile is
+// within 1/16 of the true value. Recording is wait-free.
+class Histogram {
+public:
+  void Record(std::chrono::nanoseconds latency);
+  std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  // Value at quantile `q` in [0, 1], in nanoseconds.
+  std::uint64_t Percentile(double q) const;
+  // Records that race with Reset() may survive it.
+  void Reset();
+
+private:
+  static constexpr int kSubBucketBits = 4;
+  static constexpr std::size_t kSubBuckets = std::size_t(1) << kSubBucketBits;
+  static constexpr std::size_t kBuckets =
+      (64 - kSubBucketBits + 1) * kSubBuckets;
+  static std::size_t BucketOf(std::uint64_t value);
+  static std::uint64_t LowestValueOf(std::size_t bucket);
+  std::array<std::atomic<std::uint64_t>, kBuckets> buckets_{};
+  std::atomic<std::uint64_t> count_{0};
+  std::atomic<std::uint64_t> max_{0};
+};
+
+// Records the time from construction to destruction.
+class ScopedLatency {
+public:
+  explicit ScopedLatency(Histogram &histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency() {
+    histogram_.Record(std::chrono::steady_clock::now() - start_);
+  }
+  ScopedLatency(const ScopedLatency &) = delete;
+  ScopedLatency &operator=(const ScopedLatency &) = delete;
+
+private:
+  Histogram &histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Process-wide registry of named metrics. Metrics are created on first use
+// and live until exit, so call sites can keep the returned reference in a
+// function-local static and skip the lookup on hot paths.
+class Metrics {
+public:
+  static Metrics &Instance();
+
+  Counter &counter(const std::string &name);
+  Gauge &gauge(const std::string &name);
+  Histogram &histogram(const std::string &name);
+
+  // Human readable, one metric per line; histograms in microseconds.
+  std::string DumpText();
+  std::string DumpJson();
+  // Writes DumpText() or DumpJson() to stdout every `interval` from a
+  // background thread.
+  void StartPeriodicDump(std::chrono::seconds interval, bool is_json);
+  // Zeroes counters and histograms, e.g. between benchmark runs. Gauges keep
+  // their value, they are not cumulative.
+  void Reset();
+
+private:
+  Metrics() = default;
+  std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<Counter>> counters_;
+  std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+  std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+};
+
+#endif // METRICS_H_
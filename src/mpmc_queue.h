@@ -0,0 +1,94 @@
+#ifndef MPMC_QUEUE_H_
+#define MPMC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue for any number of producers and consumers, after
+// Dmitry Vyukov's design. Every cell carries a sequence number that tells
+// whether it is free for the producer or filled for the consumer at a given
+// position, so each side claims a cell with one CAS on its own counter and
+// the two sides do not contend with each other.
+template <class T> class MpmcQueue {
+public:
+  // `capacity` is rounded up to a power of two.
+  explicit MpmcQueue(std::size_t capacity) {
+    std::size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    mask_ = size - 1;
+    cells_ = std::make_unique<Cell[]>(size);
+    for (std::size_t i = 0; i < size; ++i)
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  MpmcQueue(const MpmcQueue &) = delete;
+  MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+  // Returns false, leaving `value` alone, if the queue is full.
+  bool TryPush(T &value) {
+    std::size_t position = push_position_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[position & mask_];
+      std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      auto lag = static_cast<std::intptr_t>(sequence) -
+                 static_cast<std::intptr_t>(position);
+      if (lag == 0) {
+        if (push_position_.compare_exchange_weak(position, position + 1,
+                                                 std::memory_order_relaxed))
+          break;
+      } else if (lag < 0) {
+        return false;
+      } else {
+        position = push_position_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false if the queue is empty.
+  bool TryPop(T &value) {
+    std::size_t position = pop_position_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[position & mask_];
+      std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      auto lag = static_cast<std::intptr_t>(sequence) -
+                 static_cast<std::intptr_t>(position + 1);
+      if (lag == 0) {
+        if (pop_position_.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed))
+          break;
+      } else if (lag < 0) {
+        return false;
+      } else {
+        position = pop_position_.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(cell->value);
+    cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+  // the counters on their own cache lines, producers and consumers do not
+  // invalidate each other's
+  static constexpr std::size_t kCacheLine = 64;
+  std::unique_ptr<Cell[]> cells_;
+  std::size_t mask_;
+  alignas(kCacheLine) std::atomic<std::size_t> push_position_{0};
+  alignas(kCacheLine) std::atomic<std::size_t> pop_position_{0};
+};
+
+#endif // MPMC_QUEUE_H_
@@ -1,186 +1,497 @@
-#include "node.h"
-
-#include <iostream>
-#include <unordered_set>
-#include <vector>
-
-Node::Node(IConnectionMethodFactory &factory)
-    : factory_(factory),
-      connection_server_(factory.NewServer(*factory.GenerateAddress())),
-      connection_client_(factory.NewClient()) {
-  LOG(kINFO) << "Creating node...";
-  std::unique_ptr<IConnection> connection =
-      connection_client_->Connect(*factory.ControllerAddress(), 1000);
-  if (!connection) {
-    LOG(kDEBUG) << "Could not connect to controller!";
-    exit(1);
-  }
-  Message m;
-  m.client_role = role_;
-  m.type = MessageType::kNEW_CLIENT;
-  connection_server_->address_str().copy(m.addresses[0], kMaxAddressLength);
-  if (!connection->Write(m)) {
-    LOG(kDEBUG) << "Could not write message to the controller!";
-    exit(1);
-  }
-}
-
-void Node::Run() {
-  LOG(kINFO) << "Running node...";
-  while (true) {
-    switch (role_) {
-    case ClientRole::kCLIENT:
-      RunAsClient();
-      break;
-    case ClientRole::kSERVER:
-      RunAsServer();
-      SendTime();
-      break;
-    default:
-      LOG(kDEBUG) << "Node has incorrect role!";
-      return;
-    }
-  }
-}
-
-void Node::RunAsClient() {
-  std::unique_ptr<IConnection> connection =
-      connection_server_->WaitForConnection(10000);
-  if (!connection) {
-    exit(1);
-  }
-  Sleep(1000);
-  auto m = connection->Read();
-  connection->Close();
-  if (!m.is_succeed) {
-    LOG(kDEBUG) << "Client " << connection_server_->address_str()
-                << " read failed";
-    return;
-  }
-  switch (m.client_role) {
-  case ClientRole::kCONTROLLER: {
-    if (m.type != MessageType::kSET_SERVER) {
-      LOG(kDEBUG) << "Client " << connection_server_->address_str()
-                  << " got incorrect message from controller!";
-      return;
-    }
-    LOG(kINFO) << "Becoming server...";
-    for (int i = 0; i < m.addresses_count; ++i) {
-      clients_.emplace(m.addresses[i]);
-    }
-    role_ = ClientRole::kSERVER;
-    last_time_sending_ = Clock::now();
-    return;
-  } break;
-
-  case ClientRole::kSERVER: {
-    if (m.type != MessageType::kNEW_TIME) {
-      LOG(kDEBUG) << "Protocol error: client "
-                  << connection_server_->address_str()
-                  << " got incorrect message from server";
-      return;
-    }
-    LOG(kINFO) << "Got new time: "
-               << SerializeTimePoint(m.time, "UTC: %Y-%m-%d %H:%M:%S");
-  } break;
-
-  default:
-    LOG(kDEBUG) << "Client " << connection_server_->address_str()
-                << " got message from incorrect node!";
-  }
-}
-
-void Node::SendTime() {
-  if (role_ != ClientRole::kSERVER)
-    return;
-
-  using namespace std::chrono_literals;
-  auto chrono_now = Clock::now();
-  if (chrono_now - last_time_sending_ > 1s) {
-    LOG(kINFO) << "Sending time...";
-    last_time_sending_ = chrono_now;
-
-    Message m;
-    m.client_role = role_;
-    m.type = MessageType::kNEW_TIME;
-    m.time = Clock::now();
-
-    std::vector<decltype(clients_)::iterator> clients_to_delete;
-    for (auto it = clients_.begin(); it != clients_.end(); ++it) {
-      if (*it == connection_server_->address_str())
-        continue;
-      std::unique_ptr<IAddress> client_address = factory_.NewAddress(*it);
-      LOG(kINFO) << "Attempt to connect to " << client_address->raw();
-      std::unique_ptr<IConnection> client_connection =
-          connection_client_->Connect(*client_address, 100);
-      if (!client_connection) {
-        clients_to_delete.push_back(it);
-        continue;
-      }
-      if (!client_connection->Write(m)) {
-        clients_to_delete.push_back(it);
-      }
-      client_connection->Close();
-    }
-
-    for (auto it : clients_to_delete)
-      clients_.erase(it);
-
-    LOG(kINFO) << "Attempt to connect to the controller";
-    std::unique_ptr<IConnection> controller_connection =
-        connection_client_->Connect(*factory_.ControllerAddress(), 100);
-    if (!controller_connection) {
-      if (++attempts_to_connect_controller >
-          kMaxAttemptsToConnectToController) {
-        exit(1);
-      } else {
-        std::cout << "Could not connect to the controller. Attempt "
-                  << attempts_to_connect_controller << '\\'
-                  << kMaxAttemptsToConnectToController;
-        return;
-      }
-    }
-    if (!controller_connection->Write(m)) {
-      if (++attempts_to_connect_controller > 6) {
-        exit(1);
-      } else {
-        std::cout << "Could not write to the controller. Attempt "
-                  << attempts_to_connect_controller << '\\'
-                  << kMaxAttemptsToConnectToController;
-        return;
-      }
-    }
-    attempts_to_connect_controller = 0;
-  }
-}
-
-void Node::RunAsServer() {
-  std::unique_ptr<IConnection> connection =
-      connection_server_->WaitForConnection(1000);
-  if (!connection) {
-    return;
-  }
-  Message m = connection->Read();
-  if (!m.is_succeed) {
-    LOG(kDEBUG) << "Server " << connection_server_->address_str()
-                << " read failed!";
-    return;
-  }
-  switch (m.client_role) {
-  case ClientRole::kCONTROLLER: {
-    if (m.type != MessageType::kNEW_CLIENT) {
-      LOG(kDEBUG) << "Server " << connection_server_->address_str()
-                  << " got incorrect message from controller!";
-      return;
-    }
-    clients_.emplace(m.addresses[0]);
-    return;
-  } break;
-
-  default:
-    LOG(kDEBUG) << "Protocol error: server "
-                << connection_server_->address_str()
-                << " got message from incorrect node!";
-    return;
-  }
-}
+#include "node.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "connection_pool.h"
+#include "metrics.h"
+
+Node::Node(IConnectionMethodFactory &factory, TimePublication publication)
+    : factory_(factory), clients_(&factory),
+      connection_server_(factory.NewServer(*factory.GenerateAddress())),
+      connection_client_(
+          std::make_unique<PooledClient>(factory.NewClient())),
+      loop_(nullptr, nullptr),
+      subscribers_(*connection_client_, kBroadcastWorkers, kTimePeriod,
+                   [this](NodeId id) {
+                     loop_.Post([this, id] { OnEvicted(id); });
+                   }),
+      reader_(*connection_server_,
+              [this](std::unique_ptr<IConnection> connection) {
+                ServeConnection(*connection);
+                connection->Close();
+              }),
+      peer_io_(1), publication_(publication) {
+  LOG(kINFO) << "Creating node...";
+  if (publication_ == TimePublication::kSHARED_MEMORY) {
+#ifdef __linux__
+    // one slot per cluster, named after its controller
+    std::string cluster = factory.ControllerAddress()->raw();
+    std::replace(cluster.begin(), cluster.end(), '/', '-');
+    if (cluster.front() != '-')
+      cluster.insert(0, "-");
+    time_slot_ = TimeSlot::Open("task7-time" + cluster);
+    if (!time_slot_)
+      exit(1);
+    time_watcher_ = std::thread(&Node::WatchTimeSlot, this);
+#else
+    LOG(kERRORS) << "Shared memory time publication is not supported";
+    exit(1);
+#endif
+  }
+  std::unique_ptr<IConnection> connection =
+      connection_client_->Connect(*factory.ControllerAddress(), 1000);
+  if (!connection) {
+    LOG(kDEBUG) << "Could not connect to controller!";
+    exit(1);
+  }
+  Message m;
+  m.client_role = role_;
+  m.type = MessageType::kNEW_CLIENT;
+  m.addresses.push_back(connection_server_->address_str());
+  if (!connection->Write(m)) {
+    LOG(kDEBUG) << "Could not write message to the controller!";
+    exit(1);
+  }
+}
+
+Node::~Node() {
+  is_stopped_ = true;
+  if (time_watcher_.joinable())
+    time_watcher_.join();
+  if (heartbeat_thread_.joinable())
+    heartbeat_thread_.join();
+}
+
+void Node::Run() {
+  LOG(kINFO) << "Running node...";
+  ResetSilenceDeadline();
+  reader_thread_ = std::thread([this] { reader_.Run(); });
+  loop_.Run();
+  reader_.Stop();
+  reader_thread_.join();
+}
+
+void Node::Stop() {
+  is_stopped_ = true;
+  loop_.Stop();
+}
+
+void Node::ResetSilenceDeadline() {
+  reader_.Cancel(silence_deadline_);
+  // the server hears only from the controller, which may have nothing to say
+  if (role_ == ClientRole::kSERVER)
+    return;
+  silence_deadline_ = reader_.RunAfter(kMaxTimeSilence, [] {
+    LOG(kDEBUG) << "Nothing heard from the cluster, giving up";
+    exit(1);
+  });
+}
+
+void Node::ResetControllerDeadline() {
+  loop_.Cancel(controller_deadline_);
+  controller_deadline_ = loop_.RunAfter(kMaxControllerSilence, [] {
+    LOG(kERRORS) << "Lost the controller, giving up";
+    exit(1);
+  });
+}
+
+void Node::ServeConnection(IConnection &connection) {
+  ResetSilenceDeadline();
+  Message &m = received_;
+  connection.Read(m, kReadTimeout);
+  TimePoint received_at = Clock::now();
+  // a membership transfer continues on the same connection
+  if (m.is_succeed && !ReadChunked(connection, m))
+    m.is_succeed = false;
+  if (!m.is_succeed) {
+    LOG(kDEBUG) << "Node " << connection_server_->address_str()
+                << " read failed";
+    return;
+  }
+  // any node answers, the client asked whoever it believes is the server
+  if (m.type == MessageType::kTIME_REQUEST) {
+    ReplyTime(connection, m, received_at);
+    return;
+  }
+  if (m.type == MessageType::kNEW_TIME && role_ != ClientRole::kSERVER &&
+      (m.client_role == ClientRole::kSERVER ||
+       m.client_role == ClientRole::kRELAY)) {
+    ReportTime(m.time);
+    if (m.node_id != kNoNode && !m.addresses.empty())
+      SampleClock(m.node_id, m.addresses[0]);
+    // only a relay has more to do with it
+    if (role_ != ClientRole::kRELAY)
+      return;
+  }
+  loop_.Post([this, m = std::move(m)]() mutable { OnMessage(m); });
+}
+
+void Node::OnMessage(Message &m) {
+  if (role_ == ClientRole::kSERVER)
+    HandleAsServer(m);
+  else
+    HandleAsClient(m);
+}
+
+void Node::HandleAsClient(Message &m) {
+  switch (m.client_role) {
+  case ClientRole::kCONTROLLER: {
+    // reading it was the answer
+    if (m.type == MessageType::kPROBE)
+      return;
+    if (m.type == MessageType::kSET_RELAY) {
+      SetRelayChildren(m);
+      return;
+    }
+    if (m.type != MessageType::kSET_SERVER) {
+      LOG(kDEBUG) << "Client " << connection_server_->address_str()
+                  << " got incorrect message from controller!";
+      return;
+    }
+    LOG(kINFO) << "Becoming server...";
+    id_ = m.node_id;
+    ApplyMembership(m);
+    BecomeServer();
+    return;
+  } break;
+
+  case ClientRole::kSERVER:
+  case ClientRole::kRELAY: {
+    if (m.type != MessageType::kNEW_TIME) {
+      LOG(kDEBUG) << "Protocol error: client "
+                  << connection_server_->address_str()
+                  << " got incorrect message from server";
+      return;
+    }
+    // reported and sampled on reader_ already
+    if (role_ == ClientRole::kRELAY) {
+      m.client_role = ClientRole::kRELAY;
+      Broadcast(m);
+    }
+  } break;
+
+  default:
+    LOG(kDEBUG) << "Client " << connection_server_->address_str()
+                << " got message from incorrect node!";
+  }
+}
+
+void Node::HandleAsServer(Message &m) {
+  switch (m.client_role) {
+  case ClientRole::kCONTROLLER: {
+    if (m.type == MessageType::kPROBE)
+      return;
+    if (m.type == MessageType::kSET_RELAY) {
+      SetRelayChildren(m);
+      return;
+    }
+    if (m.type != MessageType::kSET_SERVER &&
+        m.type != MessageType::kMEMBERSHIP_DELTA) {
+      LOG(kDEBUG) << "Server " << connection_server_->address_str()
+                  << " got incorrect message from controller!";
+      return;
+    }
+    ApplyMembership(m);
+    return;
+  } break;
+
+  default:
+    LOG(kDEBUG) << "Protocol error: server "
+                << connection_server_->address_str()
+                << " got message from incorrect node!";
+    return;
+  }
+}
+
+void Node::BecomeServer() {
+  role_ = ClientRole::kSERVER;
+  reader_.Post([this] { ResetSilenceDeadline(); });
+  ResetControllerDeadline();
+  loop_.RunEvery(kTimePeriod, [this] { SendTime(); });
+  heartbeat_thread_ = std::thread(&Node::SendHeartbeats, this);
+  // the clients missed a tick while the old server was being replaced
+  loop_.Post([this] { SendTime(); });
+}
+
+void Node::ReportTime(TimePoint time) {
+  static Histogram &delivery_latency =
+      Metrics::Instance().histogram("node.time_delivery");
+  static Counter &ticks_received =
+      Metrics::Instance().counter("node.ticks_received");
+  auto now = Clock::now();
+  // on the server's clock once it was measured
+  now += std::chrono::duration_cast<Clock::duration>(
+      std::chrono::nanoseconds(clock_offset_));
+  delivery_latency.Record(now - time);
+  ticks_received.Increment();
+  LOG(kINFO) << "Got new time: "
+             << SerializeTimePoint(time, "UTC: %Y-%m-%d %H:%M:%S");
+}
+
+void Node::ReplyTime(IConnection &connection, const Message &request,
+                     TimePoint received_at) {
+  Message m;
+  m.client_role = role_;
+  m.type = MessageType::kTIME_RESPONSE;
+  m.origin_time = request.time;
+  m.receive_time = received_at;
+  m.time = Clock::now();
+  if (!connection.Write(m))
+    LOG(kDEBUG) << "Could not answer a time request";
+}
+
+void Node::SampleClock(NodeId server, const std::string &address) {
+  auto now = EventLoop::SteadyClock::now();
+  if (server != clock_source_) {
+    // Another server, another clock. Clients start at a random phase, so
+    // that they do not all ask at the first tick.
+    clock_source_ = server;
+    clock_filter_.Clear();
+    clock_offset_ = 0;
+    next_clock_sample_ = now + kClockSampleInterval * RandomNumber() / 10000;
+  }
+  if (now < next_clock_sample_)
+    return;
+  next_clock_sample_ = now + kClockSampleInterval;
+  peer_io_.Submit([this, server, address] { RequestTime(server, address); });
+}
+
+void Node::RequestTime(NodeId server, const std::string &address) {
+  static Histogram &round_trip =
+      Metrics::Instance().histogram("node.clock_round_trip");
+  std::unique_ptr<IConnection> connection = connection_client_->Connect(
+      *factory_.NewAddress(address), kClockSampleTimeout);
+  if (!connection) {
+    LOG(kDEBUG) << "Could not connect to " << address << " for its time";
+    return;
+  }
+  Message request;
+  request.client_role = role_;
+  request.type = MessageType::kTIME_REQUEST;
+  // the ack comes with the answer, t4 must not wait for it
+  connection->set_ack_window(2);
+  request.time = Clock::now();
+  Message response;
+  if (connection->Write(request))
+    response = connection->Read(kClockSampleTimeout);
+  TimePoint t4 = Clock::now();
+  connection->set_ack_window(1);
+  connection->Close();
+  if (!response.is_succeed || response.type != MessageType::kTIME_RESPONSE ||
+      response.origin_time != request.time) {
+    LOG(kDEBUG) << "Could not read the time of " << address;
+    return;
+  }
+  ClockSample sample =
+      MeasureClock(request.time, response.receive_time, response.time, t4);
+  round_trip.Record(sample.delay);
+  LOG(kINFO) << "Clock of " << address << ": offset "
+             << sample.offset.count() << " ns, round trip "
+             << sample.delay.count() << " ns";
+  reader_.Post([this, server, sample] { AddClockSample(server, sample); });
+}
+
+void Node::AddClockSample(NodeId server, const ClockSample &sample) {
+  static Gauge &offset = Metrics::Instance().gauge("node.clock_offset_ns");
+  // another server took over while it was measured
+  if (server != clock_source_)
+    return;
+  clock_filter_.Add(sample);
+  clock_offset_ = clock_filter_.best().offset.count();
+  offset.Set(clock_offset_);
+}
+
+void Node::WatchTimeSlot() {
+#ifdef __linux__
+  // what was published before we joined is not news
+  std::uint32_t version = time_slot_->version();
+  while (!is_stopped_) {
+    if (!time_slot_->WaitForChange(version, 1000))
+      continue;
+    TimePoint time;
+    if (time_slot_->Read(time, version) && role_ != ClientRole::kSERVER) {
+      ReportTime(time);
+      reader_.Post([this] { ResetSilenceDeadline(); });
+    }
+  }
+#endif
+}
+
+void Node::SendHeartbeats() {
+  auto next_at = EventLoop::SteadyClock::now();
+  while (!is_stopped_) {
+    SendHeartbeat();
+    // one that took long is not made up for with a burst
+    next_at = std::max(next_at + kHeartbeatInterval,
+                       EventLoop::SteadyClock::now());
+    std::this_thread::sleep_until(next_at);
+  }
+}
+
+void Node::SendHeartbeat() {
+  Message m;
+  m.client_role = ClientRole::kSERVER;
+  m.type = MessageType::kHEARTBEAT;
+  m.node_id = id_;
+  m.addresses.push_back(connection_server_->address_str());
+  m.epoch = applied_epoch_;
+  std::unique_ptr<IConnection> connection =
+      connection_client_->Connect(*factory_.ControllerAddress(), 100);
+  if (!connection || !connection->Write(m))
+    LOG(kDEBUG) << "Could not send a heartbeat to the controller";
+}
+
+void Node::SendTime() {
+  if (role_ != ClientRole::kSERVER)
+    return;
+
+  static Histogram &tick_latency =
+      Metrics::Instance().histogram("node.send_time");
+  static Gauge &clients_count = Metrics::Instance().gauge("node.clients");
+  // shared with the broadcast, records once both are done
+  auto latency = std::make_shared<ScopedLatency>(tick_latency);
+  LOG(kINFO) << "Sending time...";
+
+  Message m;
+  m.client_role = role_;
+  m.type = MessageType::kNEW_TIME;
+  m.time = Clock::now();
+  m.epoch = applied_epoch_;
+  // lets clients sample our clock, and the controller tell us from a
+  // server it replaced
+  m.node_id = id_;
+  m.addresses.push_back(connection_server_->address_str());
+
+  if (publication_ == TimePublication::kSHARED_MEMORY) {
+#ifdef __linux__
+    time_slot_->Publish(m.time);
+#endif
+  } else {
+    Broadcast(m, latency);
+  }
+  clients_count.Set(clients_.size());
+
+  peer_io_.Submit([this, m]() mutable { ReportTick(m); });
+}
+
+void Node::ReportTick(Message &m) {
+  LOG(kINFO) << "Attempt to connect to the controller";
+  std::unique_ptr<IConnection> controller_connection =
+      connection_client_->Connect(*factory_.ControllerAddress(), 100);
+  if (!controller_connection) {
+    LOG(kERRORS) << "Could not connect to the controller";
+    return;
+  }
+  // The controller may be busy writing to us, so do not wait for its ack
+  // before the next report. For this write only, the connection is cached
+  // and heartbeats and reports that reuse it wait for theirs.
+  controller_connection->set_ack_window(kControllerAckWindow);
+  bool is_written = controller_connection->Write(m);
+  controller_connection->set_ack_window(1);
+  if (!is_written) {
+    LOG(kERRORS) << "Could not write to the controller";
+    return;
+  }
+  loop_.Post([this] { ResetControllerDeadline(); });
+}
+
+void Node::ApplyMembership(const Message &m) {
+  if (m.node_ids.size() != m.addresses.size()) {
+    LOG(kDEBUG) << "Server " << connection_server_->address_str()
+                << " got a malformed membership update";
+    return;
+  }
+  if (m.type == MessageType::kSET_SERVER) {
+    clients_.Clear();
+    for (std::size_t i = 0; i < m.node_ids.size(); ++i)
+      clients_.Insert(m.node_ids[i], m.addresses[i]);
+    applied_epoch_ = m.epoch;
+    return;
+  }
+  // A delta holds the net state of every node it names, so it also
+  // applies on top of any epoch past its base.
+  if (m.base_epoch > applied_epoch_ || m.epoch <= applied_epoch_) {
+    LOG(kDEBUG) << "Server " << connection_server_->address_str()
+                << " skipped membership delta " << m.base_epoch << ".."
+                << m.epoch << " at epoch " << applied_epoch_;
+    return;
+  }
+  for (std::size_t i = 0; i < m.node_ids.size(); ++i)
+    clients_.Insert(m.node_ids[i], m.addresses[i]);
+  for (NodeId id : m.removed_ids)
+    clients_.Erase(id);
+  applied_epoch_ = m.epoch;
+}
+
+void Node::Broadcast(const Message &m,
+                     std::shared_ptr<ScopedLatency> latency) {
+  SubscriberQueues::Targets targets;
+  auto add = [&](const Member &member) {
+    if (member.id != id_ && member.resolved)
+      targets.push_back(&member);
+  };
+  if (is_relaying_) {
+    targets.reserve(relay_children_.size());
+    for (auto &child : relay_children_)
+      add(child);
+  } else {
+    targets.reserve(clients_.size());
+    clients_.ForEach(add);
+  }
+  LOG(kINFO) << "Broadcasting to " << targets.size() << " clients";
+  subscribers_.Publish(targets, m, std::move(latency));
+}
+
+void Node::OnEvicted(NodeId id) {
+  static Counter &evicted_clients =
+      Metrics::Instance().counter("node.evicted_clients");
+  evicted_clients.Increment();
+  if (is_relaying_) {
+    ReportUnreachable({id});
+    return;
+  }
+  clients_.Erase(id);
+}
+
+void Node::ReportUnreachable(const std::vector<NodeId> &children) {
+  // not retried on the next tick, the controller assigns the new children
+  relay_children_.erase(
+      std::remove_if(relay_children_.begin(), relay_children_.end(),
+                     [&](const Member &child) {
+                       return std::find(children.begin(), children.end(),
+                                        child.id) != children.end();
+                     }),
+      relay_children_.end());
+  Message m;
+  m.client_role = role_;
+  m.type = MessageType::kMEMBERSHIP_DELTA;
+  m.removed_ids = children;
+  peer_io_.Submit([this, m]() mutable {
+    std::unique_ptr<IConnection> connection =
+        connection_client_->Connect(*factory_.ControllerAddress(), 100);
+    if (!connection || !connection->Write(m))
+      LOG(kDEBUG) << "Could not report unreachable children to the "
+                     "controller";
+  });
+}
+
+void Node::SetRelayChildren(const Message &m) {
+  is_relaying_ = true;
+  relay_children_.clear();
+  if (m.node_ids.size() != m.addresses.size()) {
+    LOG(kDEBUG) << "Node " << connection_server_->address_str()
+                << " got a malformed relay assignment";
+  } else {
+    // resolved once per assignment, not once per tick
+    relay_children_.reserve(m.node_ids.size());
+    for (std::size_t i = 0; i < m.node_ids.size(); ++i)
+      relay_children_.push_back(Member{
+          m.node_ids[i], m.addresses[i], factory_.NewAddress(m.addresses[i])});
+  }
+  if (role_ != ClientRole::kSERVER)
+    role_ = relay_children_.empty() ? ClientRole::kCLIENT : ClientRole::kRELAY;
+  LOG(kDEBUG) << "Node " << connection_server_->address_str() << " relays to "
+              << relay_children_.size() << " children";
+}
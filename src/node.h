@@ -1,35 +1,156 @@
-#ifndef NODE_H_
-#define NODE_H_
-
-#include <unordered_set>
-
-#include "common.h"
-#include "i_connection_method.h"
-#include "log.h"
-
-class Node {
-public:
-  Node(IConnectionMethodFactory &factory);
-  Node(Node &&) = delete;
-  Node(const Node &) = delete;
-  Node &operator=(Node &&) = delete;
-  Node &operator=(const Node &) = delete;
-
-  void Run();
-
-private:
-  void RunAsClient();
-  void RunAsServer();
-  void SendTime();
-  ClientRole role_ = ClientRole::kCLIENT;
-  IConnectionMethodFactory &factory_;
-  // should be used only by server
-  std::unordered_set<std::string> clients_;
-  int attempts_to_connect_controller = 0;
-  static const int kMaxAttemptsToConnectToController = 6;
-  std::unique_ptr<IServer> connection_server_;
-  std::unique_ptr<IClient> connection_client_;
-  TimePoint last_time_sending_;
-};
-
+#ifndef NODE_H_
+#define NODE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "event_loop.h"
+#include "i_connection_method.h"
+#include "log.h"
+#include "membership.h"
+#include "metrics.h"
+#include "subscriber_queues.h"
+#include "thread_pool.h"
+#include "time_slot.h"
+#include "time_sync.h"
+
+// How the server hands each tick to the clients.
+enum class TimePublication {
+  // one connection and write per client
+  kCONNECTIONS,
+  // one write to a shared memory slot that clients watch, see time_slot.h;
+  // nodes must share a host
+  kSHARED_MEMORY
+};
+
+class Node {
+public:
+  Node(IConnectionMethodFactory &factory,
+       TimePublication publication = TimePublication::kCONNECTIONS);
+  ~Node();
+  Node(Node &&) = delete;
+  Node(const Node &) = delete;
+  Node &operator=(Node &&) = delete;
+  Node &operator=(const Node &) = delete;
+
+  void Run();
+  // Makes Run() return after the handler in progress. Lets several nodes
+  // share one process, as in the benchmark. Safe to call from any thread.
+  void Stop();
+  bool is_server() const { return role_ == ClientRole::kSERVER; }
+
+private:
+  // Runs on reader_. Answers time requests and takes ticks there, and posts
+  // the messages that are left to the loop.
+  void ServeConnection(IConnection &connection);
+  void OnMessage(Message &m);
+  void HandleAsClient(Message &m);
+  void HandleAsServer(Message &m);
+  void BecomeServer();
+  void SendTime();
+  // Runs on peer_io_. Re-arms the controller deadline once the controller
+  // took the tick `m`.
+  void ReportTick(Message &m);
+  // Applies a kSET_SERVER snapshot or a kMEMBERSHIP_DELTA to clients_.
+  void ApplyMembership(const Message &m);
+  // Queues `m` to every client, or to the relay children once the
+  // controller arranged a relay tree, see subscriber_queues.h. Returns at
+  // once; `latency`, if any, is recorded once all of them took or skipped it.
+  void Broadcast(const Message &m,
+                 std::shared_ptr<ScopedLatency> latency = nullptr);
+  // Runs on the loop for a subscriber that kept failing to take ticks.
+  void OnEvicted(NodeId id);
+  // Tells the controller about children that did not take a tick.
+  void ReportUnreachable(const std::vector<NodeId> &children);
+  // Takes the children a kSET_RELAY names.
+  void SetRelayChildren(const Message &m);
+  void ReportTime(TimePoint time);
+  // Answers a kTIME_REQUEST that arrived at `received_at`.
+  void ReplyTime(IConnection &connection, const Message &request,
+                 TimePoint received_at);
+  // Measures the clock of the server that sent a tick, now and then. Runs on
+  // reader_, the exchange on peer_io_, which posts the sample back.
+  void SampleClock(NodeId server, const std::string &address);
+  void RequestTime(NodeId server, const std::string &address);
+  void AddClockSample(NodeId server, const ClockSample &sample);
+  void WatchTimeSlot();
+  // Keep the controller's failure detector fed while the node is the
+  // server. They run on heartbeat_thread_, neither a busy loop nor a slow
+  // peer holds them up.
+  void SendHeartbeats();
+  void SendHeartbeat();
+  // Re-arm the deadlines after which a client that heard nothing, or a
+  // server that could not reach the controller, gives up. The first runs on
+  // reader_, the second on the loop.
+  void ResetSilenceDeadline();
+  void ResetControllerDeadline();
+  // read by other threads through is_server()
+  std::atomic<ClientRole> role_{ClientRole::kCLIENT};
+  std::atomic<bool> is_stopped_{false};
+  IConnectionMethodFactory &factory_;
+  // assigned by the controller, known once the node became server
+  NodeId id_ = kNoNode;
+  // should be used only by server; resolves, ticks allocate no addresses
+  MembershipTable clients_;
+  // controller epoch clients_ is at, reported back with every tick
+  std::atomic<std::uint64_t> applied_epoch_{0};
+  // set once the controller sends kSET_RELAY, then ticks go to
+  // relay_children_ only, also from the server
+  bool is_relaying_ = false;
+  std::vector<Member> relay_children_;
+  static constexpr std::size_t kBroadcastWorkers = 16;
+  // how often the server publishes the time
+  static constexpr std::chrono::milliseconds kTimePeriod{1000};
+  static constexpr std::size_t kControllerAckWindow = 4;
+  std::unique_ptr<IServer> connection_server_;
+  std::unique_ptr<IClient> connection_client_;
+  // Membership, relaying and the server role live on it. It does no
+  // blocking I/O: connections are read on reader_, the node's own requests
+  // go out on peer_io_.
+  EventLoop loop_;
+  // after loop_, its workers post to the loop until they are joined
+  SubscriberQueues subscribers_;
+  // Reads the connections on reader_thread_, one after another, so that
+  // messages reach the loop in the order they arrived. Ticks, clock samples
+  // and the silence deadline of a client live on it.
+  EventLoop reader_;
+  // Writes to the controller and clock samples, one thread keeps the
+  // controller's messages in order.
+  ThreadPool peer_io_;
+  // a client without news for that long assumes the cluster is gone
+  static constexpr std::chrono::seconds kMaxTimeSilence{10};
+  // six ticks the controller did not take
+  static constexpr std::chrono::seconds kMaxControllerSilence{6};
+  // how often a client measures the server's clock, and how long it waits
+  static constexpr std::chrono::seconds kClockSampleInterval{10};
+  static constexpr int kClockSampleTimeout = 100;
+  ClockFilter clock_filter_;
+  // its best offset in ns, for ReportTime() on other threads; 0 while empty
+  std::atomic<std::int64_t> clock_offset_{0};
+  // server clock_filter_ holds samples of, and when to take the next one
+  NodeId clock_source_ = kNoNode;
+  EventLoop::SteadyClock::time_point next_clock_sample_{};
+  // read into by ServeConnection(), its vectors keep their capacity unless
+  // the message is handed on to the loop
+  Message received_;
+  EventLoop::TimerId silence_deadline_ = 0;
+  EventLoop::TimerId controller_deadline_ = 0;
+  TimePublication publication_;
+#ifdef __linux__
+  std::unique_ptr<TimeSlot> time_slot_;
+#endif
+  // reads time_slot_ while the node is a client
+  std::thread time_watcher_;
+  // runs reader_ while Run() runs the loop
+  std::thread reader_thread_;
+  // started by BecomeServer()
+  std::thread heartbeat_thread_;
+};
+
 #endif // NODE_H_
\ No newline at end of file
@@ -1,150 +1,308 @@
-#include "pipe.h"
-
-#include <algorithm>
-#include <random>
-#include <string>
-
-#include "common.h"
-
-static const std::string kPipePrefix = "\\\\.\\pipe\\";
-
-// PipeName
-
-PipeName::PipeName(std::string name) {
-  if (name.size() <= kPipePrefix.size() ||
-      std::string(name.c_str(), kPipePrefix.size()) != kPipePrefix) {
-    name_ = NewName(std::move(name));
-  } else {
-    name_ = std::move(name);
-  }
-}
-
-PipeName::PipeName(const IAddress &address) : PipeName(address.raw()) {}
-
-std::string PipeName::NewName(std::string raw_name) {
-  if (raw_name.empty()) {
-    return kPipePrefix + std::to_string(RandomNumber());
-  } else if (raw_name[0] == '\\' && raw_name.size() > 1) {
-    return kPipePrefix + raw_name.substr(1, raw_name.size() - 1);
-  } else {
-    return kPipePrefix + raw_name;
-  }
-}
-
-// PipeConnection
-
-PipeConnection::PipeConnection(HANDLE handle, bool is_server)
-    : handle_(handle), is_server_(is_server) {}
-
-PipeConnection::~PipeConnection() { Close(); }
-
-bool PipeConnection::Write(Message &message) {
-  DWORD bytes_written = 0;
-  if (!WriteFile(handle_, &message, sizeof(Message), &bytes_written, nullptr)) {
-    WriteLastErrorMessage("PipeConnection::Write");
-    return false;
-  }
-  return true;
-}
-
-Message PipeConnection::Read() {
-  Message message;
-  DWORD bytes_read = 0;
-  OVERLAPPED overlapped{};
-  bool is_succeed = true;
-  if (!ReadFile(handle_, &message, sizeof(Message), &bytes_read, &overlapped) &&
-      GetLastError() != ERROR_IO_PENDING) {
-    WriteLastErrorMessage("PipeConnection::Read::ReadFile");
-    is_succeed = false;
-  }
-  if (!GetOverlappedResult(handle_, &overlapped, &bytes_read, true)) {
-    WriteLastErrorMessage("PipeConnection::Read::GetOverlappedResult");
-    is_succeed = false;
-  }
-  message.is_succeed = is_succeed;
-  return message;
-}
-
-void PipeConnection::Close() {
-  if (is_server_) {
-    DisconnectNamedPipe(handle_);
-  } else {
-    // Assure that data was read by server
-    Sleep(10);
-    FlushFileBuffers(handle_);
-    CloseHandle(handle_);
-  }
-}
-
-// PipeServer
-
-PipeServer::PipeServer(const IAddress &pipe_name) : pipe_name_(pipe_name) {
-  handle_ = CreateNamedPipeA(pipe_name_,
-                             FILE_FLAG_FIRST_PIPE_INSTANCE |
-                                 PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED,
-                             PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE,
-                             PIPE_UNLIMITED_INSTANCES, sizeof(Message),
-                             sizeof(Message), 0, nullptr);
-  if (handle_ == INVALID_HANDLE_VALUE) {
-    WriteLastErrorMessage("PipeServer::CreateNamedPipe", pipe_name_);
-    exit(1);
-  }
-}
-
-PipeServer::~PipeServer() { CloseHandle(handle_); }
-
-std::unique_ptr<IConnection> PipeServer::WaitForConnection(int timeout) {
-  HANDLE connection_event = CreateEventA(nullptr, false, false, nullptr);
-  if (!connection_event) {
-    WriteLastErrorMessage("PipeServer::WaitForConnection::CreateEvent",
-                          pipe_name_);
-    return nullptr;
-  }
-  OVERLAPPED overlapped{};
-  overlapped.hEvent = connection_event;
-  ConnectNamedPipe(handle_, &overlapped);
-  switch (GetLastError()) {
-  // no client is ready
-  case ERROR_IO_PENDING: {
-    DWORD status = WaitForSingleObject(overlapped.hEvent, timeout);
-    switch (status) {
-    case WAIT_FAILED:
-      WriteLastErrorMessage(
-          "PipeServer::WaitForConnection::WaitForSingleObject", pipe_name_);
-      return nullptr;
-    case WAIT_TIMEOUT:
-      // std::cerr << pipe_name_ << " timeout" << std::endl;
-      return nullptr;
-    case WAIT_OBJECT_0:
-      return std::make_unique<PipeConnection>(handle_, true);
-    }
-  }
-  // client is already connected
-  case ERROR_PIPE_CONNECTED:
-    return std::make_unique<PipeConnection>(handle_, true);
-  default:
-    WriteLastErrorMessage("PipeServer::WaitForConnection::ConnectNamedPipe",
-                          pipe_name_);
-    return nullptr;
-  }
-}
-
-// PipeClient
-
-std::unique_ptr<IConnection> PipeClient::Connect(const IAddress &address,
-                                                 int timeout) {
-  std::string address_string = address.raw();
-  const char *const pipe_name = address_string.data();
-  if (!WaitNamedPipeA(pipe_name, timeout)) {
-    WriteLastErrorMessage("PipeClient::Connect::WaitNamedPipe", pipe_name);
-    return nullptr;
-  }
-  HANDLE pipe_handle =
-      CreateFileA(pipe_name, GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
-                  FILE_ATTRIBUTE_NORMAL, nullptr);
-  if (pipe_handle == INVALID_HANDLE_VALUE) {
-    WriteLastErrorMessage("PipeClient::Connect::CreateFile", pipe_name);
-    return nullptr;
-  }
-  return std::make_unique<PipeConnection>(pipe_handle, false);
-}
+#include "pipe.h"
+
+#ifdef _WIN32
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "wire_format.h"
+
+static const std::string kPipePrefix = "\\\\.\\pipe\\";
+
+// PipeName
+
+PipeName::PipeName(std::string name) {
+  if (name.size() <= kPipePrefix.size() ||
+      std::string(name.c_str(), kPipePrefix.size()) != kPipePrefix) {
+    name_ = NewName(std::move(name));
+  } else {
+    name_ = std::move(name);
+  }
+}
+
+PipeName::PipeName(const IAddress &address) : PipeName(address.raw()) {}
+
+std::string PipeName::NewName(std::string raw_name) {
+  if (raw_name.empty()) {
+    return kPipePrefix + std::to_string(RandomNumber());
+  } else if (raw_name[0] == '\\' && raw_name.size() > 1) {
+    return kPipePrefix + raw_name.substr(1, raw_name.size() - 1);
+  } else {
+    return kPipePrefix + raw_name;
+  }
+}
+
+// PipeConnection
+
+PipeConnection::PipeConnection(HANDLE handle, bool is_server,
+                               bool *is_in_use)
+    : handle_(handle), is_server_(is_server), is_in_use_(is_in_use),
+      event_(CreateEventA(nullptr, true, false, nullptr)) {
+  if (!event_)
+    WriteLastErrorMessage("PipeConnection::CreateEvent");
+}
+
+PipeConnection::~PipeConnection() {
+  Close();
+  if (event_)
+    CloseHandle(event_);
+}
+
+bool PipeConnection::Complete(OVERLAPPED &overlapped, DWORD &bytes,
+                              int timeout) {
+  if (WaitForSingleObject(event_, timeout < 0 ? INFINITE
+                                             : static_cast<DWORD>(timeout)) ==
+      WAIT_TIMEOUT) {
+    CancelIo(handle_);
+    // wait for the cancellation, the OVERLAPPED lives on our stack
+    GetOverlappedResult(handle_, &overlapped, &bytes, true);
+    return false;
+  }
+  return GetOverlappedResult(handle_, &overlapped, &bytes, true);
+}
+
+bool PipeConnection::SendFrame(const FramePart *parts, std::size_t count) {
+  if (!event_)
+    return false;
+  // a pipe message is one WriteFile(), so the parts are gathered first
+  const char *data = parts[0].data;
+  std::size_t size = parts[0].size;
+  if (count > 1) {
+    send_buffer_.clear();
+    for (std::size_t i = 0; i < count; ++i)
+      send_buffer_.insert(send_buffer_.end(), parts[i].data,
+                          parts[i].data + parts[i].size);
+    data = send_buffer_.data();
+    size = send_buffer_.size();
+  }
+  OVERLAPPED overlapped{};
+  overlapped.hEvent = event_;
+  DWORD bytes_written = 0;
+  if ((!WriteFile(handle_, data, static_cast<DWORD>(size), &bytes_written,
+                  &overlapped) &&
+       GetLastError() != ERROR_IO_PENDING) ||
+      !Complete(overlapped, bytes_written, -1)) {
+    WriteLastErrorMessage("PipeConnection::SendFrame");
+    return false;
+  }
+  return true;
+}
+
+bool PipeConnection::ReceiveFrame(std::vector<char> &buffer, std::size_t &size,
+                                  int timeout) {
+  if (!event_)
+    return false;
+  // once per buffer, the frames that follow fit
+  if (buffer.size() < kMaxFrameSize)
+    buffer.resize(kMaxFrameSize);
+  OVERLAPPED overlapped{};
+  overlapped.hEvent = event_;
+  DWORD bytes_read = 0;
+  if (!ReadFile(handle_, buffer.data(), static_cast<DWORD>(buffer.size()),
+                &bytes_read, &overlapped) &&
+      GetLastError() != ERROR_IO_PENDING) {
+    WriteLastErrorMessage("PipeConnection::ReceiveFrame::ReadFile");
+    return false;
+  }
+  if (!Complete(overlapped, bytes_read, timeout)) {
+    if (GetLastError() != ERROR_OPERATION_ABORTED)
+      WriteLastErrorMessage("PipeConnection::ReceiveFrame");
+    return false;
+  }
+  size = bytes_read;
+  return true;
+}
+
+void PipeConnection::Close() {
+  if (handle_ == INVALID_HANDLE_VALUE)
+    return;
+  // Nothing to wait for: Write() returned after the peer acknowledged the
+  // data, unless the caller chose a larger ack window.
+  if (is_server_) {
+    DisconnectNamedPipe(handle_);
+    // the instance may listen for the next peer now
+    if (is_in_use_)
+      *is_in_use_ = false;
+  } else {
+    CloseHandle(handle_);
+  }
+  handle_ = INVALID_HANDLE_VALUE;
+}
+
+// PipeServer
+
+PipeServer::PipeServer(const IAddress &pipe_name, std::size_t instances)
+    : pipe_name_(pipe_name) {
+  // one wait slot is taken by the interrupt event
+  instances = std::min<std::size_t>(std::max<std::size_t>(instances, 1),
+                                    MAXIMUM_WAIT_OBJECTS - 1);
+  interrupt_event_ = CreateEventA(nullptr, false, false, nullptr);
+  if (!interrupt_event_) {
+    WriteLastErrorMessage("PipeServer::CreateEvent", pipe_name_);
+    exit(1);
+  }
+  for (std::size_t i = 0; i < instances; ++i) {
+    auto instance = std::make_unique<Instance>();
+    // the first instance claims the name, so two servers cannot share it
+    DWORD open_mode = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED;
+    if (i == 0)
+      open_mode |= FILE_FLAG_FIRST_PIPE_INSTANCE;
+    instance->handle = CreateNamedPipeA(
+        pipe_name_, open_mode, PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE,
+        PIPE_UNLIMITED_INSTANCES, kMaxFrameSize, kMaxFrameSize, 0, nullptr);
+    if (instance->handle == INVALID_HANDLE_VALUE) {
+      WriteLastErrorMessage("PipeServer::CreateNamedPipe", pipe_name_);
+      exit(1);
+    }
+    instance->event = CreateEventA(nullptr, true, false, nullptr);
+    if (!instance->event) {
+      WriteLastErrorMessage("PipeServer::CreateEvent", pipe_name_);
+      exit(1);
+    }
+    instances_.push_back(std::move(instance));
+  }
+}
+
+PipeServer::~PipeServer() {
+  for (auto &instance : instances_) {
+    if (instance->is_listening)
+      CancelIo(instance->handle);
+    CloseHandle(instance->event);
+    CloseHandle(instance->handle);
+  }
+  CloseHandle(interrupt_event_);
+}
+
+void PipeServer::Listen(Instance &instance) {
+  instance.overlapped = OVERLAPPED{};
+  instance.overlapped.hEvent = instance.event;
+  ConnectNamedPipe(instance.handle, &instance.overlapped);
+  switch (GetLastError()) {
+  // no client is ready
+  case ERROR_IO_PENDING:
+    instance.is_listening = true;
+    break;
+  // client is already connected
+  case ERROR_PIPE_CONNECTED:
+    instance.is_connected = true;
+    break;
+  // client connected and went away before we noticed, reset the instance
+  case ERROR_NO_DATA:
+    DisconnectNamedPipe(instance.handle);
+    break;
+  default:
+    WriteLastErrorMessage("PipeServer::Listen::ConnectNamedPipe", pipe_name_);
+  }
+}
+
+void PipeServer::CollectConnected() {
+  for (auto &instance : instances_) {
+    if (!instance->is_listening)
+      continue;
+    DWORD bytes = 0;
+    if (GetOverlappedResult(instance->handle, &instance->overlapped, &bytes,
+                            false)) {
+      instance->is_listening = false;
+      instance->is_connected = true;
+    } else if (GetLastError() != ERROR_IO_INCOMPLETE) {
+      WriteLastErrorMessage("PipeServer::GetOverlappedResult", pipe_name_);
+      instance->is_listening = false;
+      DisconnectNamedPipe(instance->handle);
+    }
+  }
+}
+
+std::unique_ptr<IConnection> PipeServer::WaitForConnection(int timeout) {
+  auto connections = WaitForConnections(timeout, 1);
+  if (connections.empty())
+    return nullptr;
+  return std::move(connections.front());
+}
+
+std::vector<std::unique_ptr<IConnection>>
+PipeServer::WaitForConnections(int timeout, std::size_t max_count) {
+  std::vector<std::unique_ptr<IConnection>> connections;
+  auto take_connected = [&]() {
+    for (auto &instance : instances_) {
+      if (connections.size() >= max_count)
+        break;
+      if (!instance->is_connected)
+        continue;
+      instance->is_connected = false;
+      instance->is_in_use = true;
+      connections.push_back(std::make_unique<PipeConnection>(
+          instance->handle, true, &instance->is_in_use));
+    }
+  };
+
+  // instances returned by closed connections start listening again
+  for (auto &instance : instances_) {
+    if (!instance->is_in_use && !instance->is_listening &&
+        !instance->is_connected)
+      Listen(*instance);
+  }
+  CollectConnected();
+  take_connected();
+  if (!connections.empty() || max_count == 0)
+    return connections;
+
+  std::vector<HANDLE> events{interrupt_event_};
+  for (auto &instance : instances_) {
+    if (instance->is_listening)
+      events.push_back(instance->event);
+  }
+  if (events.size() == 1) {
+    // every instance is busy with a peer
+    return connections;
+  }
+  DWORD wait_time = timeout < 0 ? INFINITE : static_cast<DWORD>(timeout);
+  DWORD status = WaitForMultipleObjects(static_cast<DWORD>(events.size()),
+                                        events.data(), false, wait_time);
+  switch (status) {
+  case WAIT_FAILED:
+    WriteLastErrorMessage(
+        "PipeServer::WaitForConnections::WaitForMultipleObjects", pipe_name_);
+    return connections;
+  case WAIT_TIMEOUT:
+  case WAIT_OBJECT_0:
+    // interrupted
+    return connections;
+  default:
+    CollectConnected();
+    take_connected();
+    return connections;
+  }
+}
+
+// PipeClient
+
+std::unique_ptr<IConnection> PipeClient::Connect(const IAddress &address,
+                                                 int timeout) {
+  std::string address_string = address.raw();
+  const char *const pipe_name = address_string.data();
+  if (!WaitNamedPipeA(pipe_name, timeout)) {
+    WriteLastErrorMessage("PipeClient::Connect::WaitNamedPipe", pipe_name);
+    return nullptr;
+  }
+  // acknowledgements come back over the same pipe
+  HANDLE pipe_handle = CreateFileA(
+      pipe_name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+  if (pipe_handle == INVALID_HANDLE_VALUE) {
+    WriteLastErrorMessage("PipeClient::Connect::CreateFile", pipe_name);
+    return nullptr;
+  }
+  DWORD read_mode = PIPE_READMODE_MESSAGE;
+  if (!SetNamedPipeHandleState(pipe_handle, &read_mode, nullptr, nullptr)) {
+    WriteLastErrorMessage("PipeClient::Connect::SetNamedPipeHandleState",
+                          pipe_name);
+    CloseHandle(pipe_handle);
+    return nullptr;
+  }
+  return std::make_unique<PipeConnection>(pipe_handle, false);
+}
+
+#endif // _WIN32
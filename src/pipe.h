@@ -1,80 +1,132 @@
-#ifndef PIPE_H_
-#define PIPE_H_
-
-#include <string>
-
-#include "i_connection_method.h"
-#include "log.h"
-
-class PipeName : public IAddress {
-public:
-  PipeName(std::string name);
-  PipeName(const IAddress &address);
-  const std::string &raw() const override { return name_; }
-  operator const char * const() const { return name_.c_str(); }
-
-private:
-  static std::string NewName(std::string raw_name = "");
-  std::string name_;
-};
-
-class PipeConnection : public IConnection {
-public:
-  explicit PipeConnection(HANDLE handle, bool is_server);
-  ~PipeConnection() override;
-
-  bool Write(Message &message) override;
-  Message Read() override;
-  void Close() override;
-  bool is_server() const override { return is_server_; }
-
-private:
-  HANDLE handle_;
-  bool is_server_;
-};
-
-class PipeServer : public IServer {
-public:
-  explicit PipeServer(const IAddress &pipe_name = PipeName(""));
-  ~PipeServer() override;
-  PipeServer(const PipeServer &) = delete;
-  PipeServer &operator=(const PipeServer &) = delete;
-  PipeServer(PipeServer &&) = delete;
-  PipeServer &operator=(PipeServer &&) = delete;
-
-  std::unique_ptr<IConnection> WaitForConnection(int timeout) override;
-
-  const IAddress &address() const override { return pipe_name_; }
-  const std::string &address_str() const override { return pipe_name_.raw(); }
-
-private:
-  PipeName pipe_name_;
-  HANDLE handle_;
-};
-
-class PipeClient : public IClient {
-public:
-  std::unique_ptr<IConnection> Connect(const IAddress &address,
-                                       int timeout) override;
-};
-
-class PipeFactory : public IConnectionMethodFactory {
-public:
-  std::unique_ptr<IAddress> GenerateAddress() override {
-    return std::make_unique<PipeName>("");
-  }
-  std::unique_ptr<IAddress> NewAddress(std::string address) override {
-    return std::make_unique<PipeName>(address);
-  }
-  std::unique_ptr<IServer> NewServer(const IAddress &address) override {
-    return std::make_unique<PipeServer>(address);
-  }
-  std::unique_ptr<IClient> NewClient() override {
-    return std::make_unique<PipeClient>();
-  }
-  std::unique_ptr<IAddress> ControllerAddress() override {
-    return NewAddress("\\\\.\\pipe\\controller");
-  }
-};
-
-#endif // PIPE_H_
+#ifndef PIPE_H_
+#define PIPE_H_
+
+#ifdef _WIN32
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "framed_connection.h"
+#include "i_connection_method.h"
+#include "log.h"
+
+class PipeName : public IAddress {
+public:
+  PipeName(std::string name);
+  PipeName(const IAddress &address);
+  const std::string &raw() const override { return name_; }
+  operator const char * const() const { return name_.c_str(); }
+
+private:
+  static std::string NewName(std::string raw_name = "");
+  std::string name_;
+};
+
+class PipeConnection : public FramedConnection {
+public:
+  // `is_in_use` is the flag of the server instance the handle belongs to,
+  // Close() clears it to give the instance back.
+  explicit PipeConnection(HANDLE handle, bool is_server,
+                          bool *is_in_use = nullptr);
+  ~PipeConnection() override;
+
+  PipeConnection(const PipeConnection &) = delete;
+  PipeConnection &operator=(const PipeConnection &) = delete;
+
+  void Close() override;
+  bool is_server() const override { return is_server_; }
+
+protected:
+  bool SendFrame(const FramePart *parts, std::size_t count) override;
+  bool ReceiveFrame(std::vector<char> &buffer, std::size_t &size,
+                    int timeout) override;
+
+private:
+  // Waits up to `timeout` ms for an overlapped operation, cancels it on
+  // timeout.
+  bool Complete(OVERLAPPED &overlapped, DWORD &bytes, int timeout);
+  HANDLE handle_;
+  bool is_server_;
+  bool *is_in_use_;
+  HANDLE event_;
+  // reused to gather the parts of a frame
+  std::vector<char> send_buffer_;
+};
+
+// Keeps several pipe instances listening, so that more than one peer can be
+// connected at a time and a burst of peers is accepted in one call.
+class PipeServer : public IServer {
+public:
+  static constexpr std::size_t kDefaultInstances = 8;
+  explicit PipeServer(const IAddress &pipe_name = PipeName(""),
+                      std::size_t instances = kDefaultInstances);
+  ~PipeServer() override;
+  PipeServer(const PipeServer &) = delete;
+  PipeServer &operator=(const PipeServer &) = delete;
+  PipeServer(PipeServer &&) = delete;
+  PipeServer &operator=(PipeServer &&) = delete;
+
+  std::unique_ptr<IConnection> WaitForConnection(int timeout) override;
+  std::vector<std::unique_ptr<IConnection>>
+  WaitForConnections(int timeout, std::size_t max_count) override;
+  void Interrupt() override { SetEvent(interrupt_event_); }
+
+  const IAddress &address() const override { return pipe_name_; }
+  const std::string &address_str() const override { return pipe_name_.raw(); }
+
+private:
+  struct Instance {
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    HANDLE event = nullptr;
+    OVERLAPPED overlapped{};
+    // ConnectNamedPipe is pending
+    bool is_listening = false;
+    // a peer is connected and waits to be handed out
+    bool is_connected = false;
+    // handed out as a PipeConnection
+    bool is_in_use = false;
+  };
+  void Listen(Instance &instance);
+  void CollectConnected();
+  PipeName pipe_name_;
+  // OVERLAPPED must not move while an operation is pending
+  std::vector<std::unique_ptr<Instance>> instances_;
+  // auto reset, set by Interrupt()
+  HANDLE interrupt_event_ = nullptr;
+};
+
+class PipeClient : public IClient {
+public:
+  std::unique_ptr<IConnection> Connect(const IAddress &address,
+                                       int timeout) override;
+};
+
+class PipeFactory : public IConnectionMethodFactory {
+public:
+  explicit PipeFactory(
+      std::size_t server_instances = PipeServer::kDefaultInstances)
+      : server_instances_(server_instances) {}
+  std::unique_ptr<IAddress> GenerateAddress() override {
+    return std::make_unique<PipeName>("");
+  }
+  std::unique_ptr<IAddress> NewAddress(std::string address) override {
+    return std::make_unique<PipeName>(address);
+  }
+  std::unique_ptr<IServer> NewServer(const IAddress &address) override {
+    return std::make_unique<PipeServer>(address, server_instances_);
+  }
+  std::unique_ptr<IClient> NewClient() override {
+    return std::make_unique<PipeClient>();
+  }
+  std::unique_ptr<IAddress> ControllerAddress() override {
+    return NewAddress("\\\\.\\pipe\\controller");
+  }
+
+private:
+  std::size_t server_instances_;
+};
+
+#endif // _WIN32
+
+#endif // PIPE_H_
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "relay_tree.h"
+
+#include <algorithm>
+
+std::vector<RelayTree::Assignment>
+RelayTree::Update(const MembershipTable &members, NodeId root) {
+  std::size_t size = members.size();
+  std::size_t root_position = members.position(root);
+  // tree position to table position, with the root and position 0 swapped
+  auto member = [&](std::size_t position) {
+    if (position == 0)
+      return members.at(root_position).id;
+    if (position == root_position)
+      return members.at(0).id;
+    return members.at(position).id;
+  };
+
+  std::vector<Assignment> changes;
+  std::unordered_map<NodeId, std::vector<NodeId>> children;
+  for (std::size_t parent = 0; fanout_ != 0 && parent * fanout_ + 1 < size;
+       ++parent) {
+    std::size_t first = parent * fanout_ + 1;
+    std::size_t last = std::min(first + fanout_, size);
+    std::vector<NodeId> &assigned = children[member(parent)];
+    for (std::size_t child = first; child < last; ++child)
+      assigned.push_back(member(child));
+    auto previous = children_.find(member(parent));
+    if (previous == children_.end() || previous->second != assigned)
+      changes.emplace_back(member(parent), assigned);
+  }
+  // Former relays that are still members become leaves; the departed need
+  // no word.
+  for (auto &[id, previous] : children_) {
+    if (children.count(id) == 0 && members.Contains(id))
+      changes.emplace_back(id, std::vector<NodeId>{});
+  }
+  children_ = std::move(children);
+  return changes;
+}
@@ -0,0 +1,39 @@
+#ifndef RELAY_TREE_H_
+#define RELAY_TREE_H_
+
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "membership.h"
+
+// Arranges the members into a k-ary dissemination tree rooted at the
+// server: the server sends each tick to `fanout` relays, every relay to its
+// `fanout` children, and so on, so a tick reaches N nodes in log_k(N) hops
+// with at most k sends per node.
+//
+// The tree is the members' positions in the table laid out as a heap, with
+// the server swapped to the top. A join appends a leaf and a leave moves the
+// last member into the hole, so a change reassigns the children of only a
+// few nodes.
+class RelayTree {
+public:
+  // A node and its new children; none if it stopped relaying.
+  using Assignment = std::pair<NodeId, std::vector<NodeId>>;
+
+  explicit RelayTree(std::size_t fanout) : fanout_(fanout) {}
+
+  // Lays out `members` under `root` and returns the nodes whose children
+  // changed since the previous call. `root` must be a member.
+  std::vector<Assignment> Update(const MembershipTable &members, NodeId root);
+  // Makes the next Update() reassign every node.
+  void Clear() { children_.clear(); }
+
+private:
+  std::size_t fanout_;
+  // as last returned by Update()
+  std::unordered_map<NodeId, std::vector<NodeId>> children_;
+};
+
+#endif // RELAY_TREE_H_
@@ -0,0 +1,506 @@
+#include "shm.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "wire_format.h"
+
+// Byte ring with free running positions. A frame is a u32 length followed by
+// the frame itself, both may wrap around the end of `data`.
+struct ShmRing {
+  static constexpr std::uint64_t kCapacity = 128 * 1024;
+  // bytes consumed, written by the reader only
+  alignas(64) std::atomic<std::uint64_t> head{0};
+  // bytes produced, written by the writer only
+  alignas(64) std::atomic<std::uint64_t> tail{0};
+  // set by the reader before it sleeps on its eventfd
+  alignas(64) std::atomic<std::uint32_t> is_reader_waiting{0};
+  alignas(64) char data[kCapacity];
+};
+
+namespace {
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                  std::atomic<std::uint32_t>::is_always_lock_free,
+              "ring positions are shared between processes");
+static_assert(kMaxFrameSize + sizeof(std::uint32_t) <= ShmRing::kCapacity,
+              "a ring must hold the largest frame");
+
+// Layout of the shared memory of one connection.
+struct ShmRings {
+  ShmRing to_server;
+  ShmRing to_client;
+};
+
+const std::uint32_t kHandshakeFds = 3;
+
+void CopyToRing(ShmRing &ring, std::uint64_t position, const char *source,
+                std::size_t size) {
+  std::size_t offset = position % ShmRing::kCapacity;
+  std::size_t first = std::min<std::size_t>(size, ShmRing::kCapacity - offset);
+  std::memcpy(ring.data + offset, source, first);
+  std::memcpy(ring.data, source + first, size - first);
+}
+
+void CopyFromRing(const ShmRing &ring, std::uint64_t position, char *target,
+                  std::size_t size) {
+  std::size_t offset = position % ShmRing::kCapacity;
+  std::size_t first = std::min<std::size_t>(size, ShmRing::kCapacity - offset);
+  std::memcpy(target, ring.data + offset, first);
+  std::memcpy(target + first, ring.data, size - first);
+}
+
+bool HasFrame(const ShmRing &ring) {
+  return ring.tail.load(std::memory_order_acquire) !=
+         ring.head.load(std::memory_order_relaxed);
+}
+
+// Copies the parts of a frame into the ring back to back. Returns false if
+// there is no room for the frame.
+bool WriteToRing(ShmRing &ring, const FramePart *parts, std::size_t count) {
+  std::uint64_t head = ring.head.load(std::memory_order_acquire);
+  std::uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  std::uint32_t length = 0;
+  for (std::size_t i = 0; i < count; ++i)
+    length += static_cast<std::uint32_t>(parts[i].size);
+  std::uint64_t size = sizeof(length) + length;
+  if (ShmRing::kCapacity - (tail - head) < size)
+    return false;
+  CopyToRing(ring, tail, reinterpret_cast<const char *>(&length),
+             sizeof(length));
+  std::uint64_t offset = tail + sizeof(length);
+  for (std::size_t i = 0; i < count; ++i) {
+    CopyToRing(ring, offset, parts[i].data, parts[i].size);
+    offset += parts[i].size;
+  }
+  ring.tail.store(tail + size, std::memory_order_release);
+  return true;
+}
+
+// Returns false if the ring is empty, or sets `is_corrupt` if the peer wrote
+// garbage.
+bool ReadFromRing(ShmRing &ring, std::vector<char> &buffer, std::size_t &size,
+                  bool &is_corrupt) {
+  std::uint64_t tail = ring.tail.load(std::memory_order_acquire);
+  std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+  if (tail == head)
+    return false;
+  std::uint32_t length;
+  if (tail - head < sizeof(length)) {
+    is_corrupt = true;
+    return false;
+  }
+  CopyFromRing(ring, head, reinterpret_cast<char *>(&length), sizeof(length));
+  if (length > kMaxFrameSize || tail - head < sizeof(length) + length) {
+    is_corrupt = true;
+    return false;
+  }
+  if (buffer.size() < length)
+    buffer.resize(length);
+  CopyFromRing(ring, head + sizeof(length), buffer.data(), length);
+  size = length;
+  ring.head.store(head + sizeof(length) + length, std::memory_order_release);
+  return true;
+}
+
+void Signal(int event) {
+  std::uint64_t one = 1;
+  // a full counter already wakes the reader
+  if (write(event, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    WriteLastErrorMessage("Shm::Signal::write");
+}
+
+void ClearSignal(int event) {
+  std::uint64_t count;
+  if (read(event, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    WriteLastErrorMessage("Shm::ClearSignal::read");
+}
+
+// The rendezvous socket carries nothing after the handshake, so any event on
+// it means hang-up.
+bool IsHungUp(int socket) {
+  pollfd peer{socket, POLLIN, 0};
+  return poll(&peer, 1, 0) != 0;
+}
+
+void StopWaiting(ShmRing &ring) {
+  ring.is_reader_waiting.store(0, std::memory_order_relaxed);
+}
+
+// Announces that the reader is about to sleep. The fence pairs with the one
+// in ShmConnection::SendFrame: either the writer sees the flag and signals,
+// or the reader sees the frame on the check that follows.
+void StartWaiting(ShmRing &ring) {
+  ring.is_reader_waiting.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+} // namespace
+
+// ShmEndpoint
+
+void ShmEndpoint::Close() {
+  if (memory)
+    munmap(memory, size);
+  for (int fd : {socket, in_event, out_event}) {
+    if (fd >= 0)
+      close(fd);
+  }
+  *this = ShmEndpoint{};
+}
+
+// ShmConnection
+
+ShmConnection::ShmConnection(ShmEndpoint endpoint, ShmServer *server)
+    : endpoint_(endpoint), server_(server) {}
+
+ShmConnection::~ShmConnection() { Close(); }
+
+bool ShmConnection::SendFrame(const FramePart *parts, std::size_t count) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(kAckTimeout);
+  while (!WriteToRing(*endpoint_.out, parts, count)) {
+    // the reader is a whole ring behind, let it catch up
+    if (is_peer_gone() || std::chrono::steady_clock::now() >= deadline) {
+      LOG(kDEBUG) << "ShmConnection::SendFrame: peer does not read";
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (endpoint_.out->is_reader_waiting.load(std::memory_order_relaxed))
+    Signal(endpoint_.out_event);
+  return true;
+}
+
+bool ShmConnection::ReceiveFrame(std::vector<char> &buffer, std::size_t &size,
+                                 int timeout) {
+  ShmRing &ring = *endpoint_.in;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  bool is_corrupt = false;
+  while (true) {
+    for (int spin = 0; spin < kSpinCount; ++spin) {
+      if (ReadFromRing(ring, buffer, size, is_corrupt))
+        return true;
+      if (is_corrupt) {
+        LOG(kDEBUG) << "ShmConnection::ReceiveFrame: malformed ring";
+        return false;
+      }
+    }
+    StartWaiting(ring);
+    if (HasFrame(ring)) {
+      StopWaiting(ring);
+      continue;
+    }
+    pollfd fds[] = {{endpoint_.in_event, POLLIN, 0},
+                    {endpoint_.socket, POLLIN, 0}};
+    int remaining = static_cast<int>(std::max<std::chrono::milliseconds::rep>(
+        0, std::chrono::duration_cast<std::chrono::milliseconds>(
+               deadline - std::chrono::steady_clock::now())
+               .count()));
+    int status = poll(fds, 2, timeout < 0 ? -1 : remaining);
+    StopWaiting(ring);
+    if (status < 0 && errno == EINTR)
+      continue;
+    if (status < 0) {
+      WriteLastErrorMessage("ShmConnection::ReceiveFrame::poll");
+      return false;
+    }
+    if (fds[0].revents)
+      ClearSignal(endpoint_.in_event);
+    // frames written before a hang-up or the timeout are still delivered
+    if (status == 0 || fds[1].revents) {
+      if (ReadFromRing(ring, buffer, size, is_corrupt))
+        return true;
+      if (fds[1].revents)
+        LOG(kDEBUG) << "ShmConnection::ReceiveFrame: peer closed connection";
+      return false;
+    }
+  }
+}
+
+bool ShmConnection::is_peer_gone() const { return IsHungUp(endpoint_.socket); }
+
+void ShmConnection::Close() {
+  if (endpoint_.socket < 0)
+    return;
+  if (server_ && is_healthy()) {
+    server_->Park(endpoint_);
+    endpoint_ = ShmEndpoint{};
+  } else {
+    endpoint_.Close();
+  }
+}
+
+// ShmServer
+
+ShmServer::ShmServer(const IAddress &address, int backlog)
+    : address_(address), fd_(ListenUnixSocket(address_.raw(), backlog)) {
+  if (fd_ < 0)
+    exit(1);
+}
+
+ShmServer::~ShmServer() {
+  for (auto &endpoint : idle_)
+    endpoint.Close();
+  close(fd_);
+  unlink(address_);
+}
+
+void ShmServer::Park(ShmEndpoint endpoint) {
+  if (idle_.size() >= kMaxIdleConnections) {
+    endpoint.Close();
+    return;
+  }
+  // the client signals from now on, frames that are already there are found
+  // by WaitForConnections() before it polls
+  StartWaiting(*endpoint.in);
+  idle_.push_back(endpoint);
+}
+
+bool ShmServer::Handshake(int fd, ShmEndpoint &endpoint) {
+  pollfd peer{fd, POLLIN, 0};
+  if (poll(&peer, 1, kHandshakeTimeout) <= 0) {
+    LOG(kDEBUG) << "ShmServer: " << address_.raw() << ": no handshake";
+    return false;
+  }
+  std::uint32_t size = 0;
+  iovec payload{&size, sizeof(size)};
+  alignas(cmsghdr) char control[CMSG_SPACE(kHandshakeFds * sizeof(int))] = {};
+  msghdr header{};
+  header.msg_iov = &payload;
+  header.msg_iovlen = 1;
+  header.msg_control = control;
+  header.msg_controllen = sizeof(control);
+  ssize_t bytes_read;
+  do {
+    bytes_read = recvmsg(fd, &header, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+  } while (bytes_read < 0 && errno == EINTR);
+  if (bytes_read <= 0) {
+    LOG(kDEBUG) << "ShmServer: " << address_.raw() << ": no handshake";
+    return false;
+  }
+  // every fd that came along is ours to close, also when the rest is wrong
+  int fds[kHandshakeFds];
+  std::size_t fd_count = 0;
+  bool is_malformed = (header.msg_flags & MSG_CTRUNC) != 0;
+  for (cmsghdr *fds_header = CMSG_FIRSTHDR(&header); fds_header;
+       fds_header = CMSG_NXTHDR(&header, fds_header)) {
+    if (fds_header->cmsg_level != SOL_SOCKET ||
+        fds_header->cmsg_type != SCM_RIGHTS) {
+      is_malformed = true;
+      continue;
+    }
+    std::size_t count = (fds_header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (std::size_t i = 0; i < count; ++i) {
+      int received;
+      std::memcpy(&received, CMSG_DATA(fds_header) + i * sizeof(int),
+                  sizeof(received));
+      if (fd_count < kHandshakeFds) {
+        fds[fd_count++] = received;
+      } else {
+        close(received);
+        is_malformed = true;
+      }
+    }
+  }
+  if (is_malformed || fd_count != kHandshakeFds) {
+    LOG(kDEBUG) << "ShmServer: " << address_.raw() << ": malformed handshake";
+    for (std::size_t i = 0; i < fd_count; ++i)
+      close(fds[i]);
+    return false;
+  }
+  struct stat memory_stat {};
+  void *memory = MAP_FAILED;
+  if (bytes_read == sizeof(size) && size == sizeof(ShmRings) &&
+      fstat(fds[0], &memory_stat) == 0 &&
+      static_cast<std::size_t>(memory_stat.st_size) >= size) {
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  }
+  close(fds[0]);
+  if (memory == MAP_FAILED) {
+    LOG(kDEBUG) << "ShmServer: " << address_.raw() << ": bad shared memory";
+    close(fds[1]);
+    close(fds[2]);
+    return false;
+  }
+  auto *rings = static_cast<ShmRings *>(memory);
+  endpoint.socket = fd;
+  endpoint.memory = memory;
+  endpoint.size = size;
+  endpoint.in = &rings->to_server;
+  endpoint.out = &rings->to_client;
+  endpoint.in_event = fds[1];
+  endpoint.out_event = fds[2];
+  return true;
+}
+
+std::unique_ptr<IConnection> ShmServer::WaitForConnection(int timeout) {
+  auto connections = WaitForConnections(timeout, 1);
+  if (connections.empty())
+    return nullptr;
+  return std::move(connections.front());
+}
+
+std::vector<std::unique_ptr<IConnection>>
+ShmServer::WaitForConnections(int timeout, std::size_t max_count) {
+  std::vector<std::unique_ptr<IConnection>> connections;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  std::vector<pollfd> fds;
+  bool is_interrupted = false;
+  while (connections.empty() && max_count > 0) {
+    // Parked connections with a frame in the ring. A handed out connection
+    // is parked again at the back, so busy peers cannot starve the others.
+    for (std::size_t i = 0;
+         i < idle_.size() && connections.size() < max_count;) {
+      if (!HasFrame(*idle_[i].in)) {
+        ++i;
+        continue;
+      }
+      StopWaiting(*idle_[i].in);
+      connections.push_back(std::make_unique<ShmConnection>(idle_[i], this));
+      idle_.erase(idle_.begin() + i);
+    }
+    if (!connections.empty() || is_interrupted)
+      break;
+
+    fds.assign(1, pollfd{fd_, POLLIN, 0});
+    for (auto &endpoint : idle_) {
+      fds.push_back(pollfd{endpoint.in_event, POLLIN, 0});
+      fds.push_back(pollfd{endpoint.socket, POLLIN, 0});
+    }
+    fds.push_back(pollfd{interrupt_.fd(), POLLIN, 0});
+    int remaining = static_cast<int>(std::max<std::chrono::milliseconds::rep>(
+        0, std::chrono::duration_cast<std::chrono::milliseconds>(
+               deadline - std::chrono::steady_clock::now())
+               .count()));
+    int status = poll(fds.data(), fds.size(), timeout < 0 ? -1 : remaining);
+    if (status < 0 && errno == EINTR)
+      continue;
+    if (status < 0) {
+      WriteLastErrorMessage("ShmServer::WaitForConnections::poll", address_);
+      break;
+    }
+    if (status == 0) {
+      break;
+    }
+    // still hands out what is ready
+    if (fds.back().revents) {
+      interrupt_.Drain();
+      is_interrupted = true;
+    }
+
+    // Signalled connections are handed out at the top of the loop; those
+    // whose peer is gone are dropped. Walk backwards to keep indices valid.
+    for (std::size_t i = idle_.size(); i-- > 0;) {
+      const pollfd &event = fds[1 + 2 * i];
+      const pollfd &hang_up = fds[2 + 2 * i];
+      if (event.revents)
+        ClearSignal(idle_[i].in_event);
+      if (hang_up.revents && !HasFrame(*idle_[i].in)) {
+        idle_[i].Close();
+        idle_.erase(idle_.begin() + i);
+      }
+    }
+
+    // Drain the listen backlog, so a burst of peers is accepted in one call.
+    while ((fds[0].revents & POLLIN) && connections.size() < max_count) {
+      int connection_fd = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (connection_fd < 0) {
+        // backlog is empty or another waiter took the pending connection
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          WriteLastErrorMessage("ShmServer::WaitForConnections::accept",
+                                address_);
+        break;
+      }
+      ShmEndpoint endpoint;
+      if (!Handshake(connection_fd, endpoint)) {
+        close(connection_fd);
+        continue;
+      }
+      connections.push_back(std::make_unique<ShmConnection>(endpoint, this));
+    }
+  }
+  return connections;
+}
+
+// ShmClient
+
+std::unique_ptr<IConnection> ShmClient::Connect(const IAddress &address,
+                                                int timeout) {
+  UnixSocketAddress path(address);
+  ShmEndpoint endpoint;
+  int memory_fd = -1;
+  auto fail = [&](const char *proc_name) -> std::unique_ptr<IConnection> {
+    WriteLastErrorMessage(proc_name, path);
+    if (memory_fd >= 0)
+      close(memory_fd);
+    endpoint.Close();
+    return nullptr;
+  };
+
+  endpoint.socket = ConnectUnixSocket(path.raw(), timeout);
+  if (endpoint.socket < 0)
+    return nullptr;
+  memory_fd = memfd_create("task7-shm", MFD_CLOEXEC);
+  if (memory_fd < 0)
+    return fail("ShmClient::Connect::memfd_create");
+  if (ftruncate(memory_fd, sizeof(ShmRings)) != 0)
+    return fail("ShmClient::Connect::ftruncate");
+  void *memory = mmap(nullptr, sizeof(ShmRings), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, memory_fd, 0);
+  if (memory == MAP_FAILED)
+    return fail("ShmClient::Connect::mmap");
+  endpoint.memory = memory;
+  endpoint.size = sizeof(ShmRings);
+  // default initialization leaves the ring data untouched, so pages are only
+  // faulted in as the rings fill
+  auto *rings = new (memory) ShmRings;
+  endpoint.in = &rings->to_client;
+  endpoint.out = &rings->to_server;
+  endpoint.in_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  endpoint.out_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (endpoint.in_event < 0 || endpoint.out_event < 0)
+    return fail("ShmClient::Connect::eventfd");
+
+  // the server reads `to_server` and signals `to_client`
+  int fds[kHandshakeFds] = {memory_fd, endpoint.out_event, endpoint.in_event};
+  std::uint32_t size = sizeof(ShmRings);
+  iovec payload{&size, sizeof(size)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+  msghdr header{};
+  header.msg_iov = &payload;
+  header.msg_iovlen = 1;
+  header.msg_control = control;
+  header.msg_controllen = sizeof(control);
+  cmsghdr *fds_header = CMSG_FIRSTHDR(&header);
+  fds_header->cmsg_level = SOL_SOCKET;
+  fds_header->cmsg_type = SCM_RIGHTS;
+  fds_header->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(fds_header), fds, sizeof(fds));
+  ssize_t bytes_written;
+  do {
+    bytes_written = sendmsg(endpoint.socket, &header, MSG_NOSIGNAL);
+  } while (bytes_written < 0 && errno == EINTR);
+  if (bytes_written != sizeof(size))
+    return fail("ShmClient::Connect::sendmsg");
+  close(memory_fd);
+  return std::make_unique<ShmConnection>(endpoint);
+}
+
+#endif // __linux__
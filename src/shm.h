@@ -0,0 +1,130 @@
+#ifndef SHM_H_
+#define SHM_H_
+
+#ifdef __linux__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "framed_connection.h"
+#include "i_connection_method.h"
+#include "unix_socket.h"
+
+// Shared memory transport for processes on one host.
+//
+// The client creates a memfd with one single-producer/single-consumer ring
+// per direction and an eventfd per direction, and passes them to the server
+// over a unix socket with SCM_RIGHTS. After that frames go through the rings
+// only: a reader spins briefly on an empty ring and then sleeps on its
+// eventfd, which the writer signals only if the reader said it is sleeping.
+// The rendezvous socket stays open to notice the peer going away.
+
+struct ShmRing;
+
+// One end of a connection. Plain handles, released by Close().
+struct ShmEndpoint {
+  int socket = -1;
+  void *memory = nullptr;
+  std::size_t size = 0;
+  ShmRing *in = nullptr;
+  ShmRing *out = nullptr;
+  // signalled by the peer after it wrote to `in`
+  int in_event = -1;
+  // signalled by us after writing to `out`
+  int out_event = -1;
+  void Close();
+};
+
+class ShmServer;
+
+class ShmConnection : public FramedConnection {
+public:
+  explicit ShmConnection(ShmEndpoint endpoint, ShmServer *server = nullptr);
+  ~ShmConnection() override;
+  ShmConnection(const ShmConnection &) = delete;
+  ShmConnection &operator=(const ShmConnection &) = delete;
+
+  void Close() override;
+  bool is_server() const override { return server_ != nullptr; }
+  bool is_reusable() const override { return !server_; }
+
+protected:
+  bool SendFrame(const FramePart *parts, std::size_t count) override;
+  bool ReceiveFrame(std::vector<char> &buffer, std::size_t &size,
+                    int timeout) override;
+
+private:
+  // Iterations a reader polls an empty ring before it goes to sleep.
+  static constexpr int kSpinCount = 1000;
+  bool is_peer_gone() const;
+  ShmEndpoint endpoint_;
+  // server that accepted this connection, it takes the rings back on Close()
+  ShmServer *server_;
+};
+
+// Listens on a unix socket for rendezvous. Accepted connections are parked
+// after Close() like in UnixSocketServer, and their eventfds are polled for
+// the next message.
+class ShmServer : public IServer {
+public:
+  explicit ShmServer(const IAddress &address,
+                     int backlog = UnixSocketServer::kDefaultBacklog);
+  ~ShmServer() override;
+  ShmServer(const ShmServer &) = delete;
+  ShmServer &operator=(const ShmServer &) = delete;
+
+  std::unique_ptr<IConnection> WaitForConnection(int timeout) override;
+  std::vector<std::unique_ptr<IConnection>>
+  WaitForConnections(int timeout, std::size_t max_count) override;
+  void Interrupt() override { interrupt_.Notify(); }
+
+  const IAddress &address() const override { return address_; }
+  const std::string &address_str() const override { return address_.raw(); }
+
+private:
+  friend class ShmConnection;
+  static constexpr std::size_t kMaxIdleConnections = 512;
+  static constexpr int kHandshakeTimeout = 100;
+  void Park(ShmEndpoint endpoint);
+  bool Handshake(int fd, ShmEndpoint &endpoint);
+  UnixSocketAddress address_;
+  int fd_;
+  std::vector<ShmEndpoint> idle_;
+  SelfPipe interrupt_;
+};
+
+class ShmClient : public IClient {
+public:
+  std::unique_ptr<IConnection> Connect(const IAddress &address,
+                                       int timeout) override;
+};
+
+class ShmFactory : public IConnectionMethodFactory {
+public:
+  explicit ShmFactory(int backlog = UnixSocketServer::kDefaultBacklog)
+      : backlog_(backlog) {}
+  std::unique_ptr<IAddress> GenerateAddress() override {
+    return std::make_unique<UnixSocketAddress>("");
+  }
+  std::unique_ptr<IAddress> NewAddress(std::string address) override {
+    return std::make_unique<UnixSocketAddress>(address);
+  }
+  std::unique_ptr<IServer> NewServer(const IAddress &address) override {
+    return std::make_unique<ShmServer>(address, backlog_);
+  }
+  std::unique_ptr<IClient> NewClient() override {
+    return std::make_unique<ShmClient>();
+  }
+  // not the unix socket controller, which speaks another protocol
+  std::unique_ptr<IAddress> ControllerAddress() override {
+    return NewAddress("shm-controller");
+  }
+
+private:
+  int backlog_;
+};
+
+#endif // __linux__
+
+#endif // SHM_H_
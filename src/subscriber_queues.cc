@@ -0,0 +1,187 @@
+#include "subscriber_queues.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "log.h"
+#include "wire_format.h"
+
+struct SubscriberQueues::Payload {
+  EncodedMessage encoded;
+  bool is_tick = false;
+  std::shared_ptr<ScopedLatency> latency;
+};
+
+struct SubscriberQueues::Subscriber {
+  Subscriber(NodeId id, std::shared_ptr<const IAddress> address)
+      : id(id), address(std::move(address)) {}
+  const NodeId id;
+  const std::shared_ptr<const IAddress> address;
+  // publication it was last a target of, for Publish() only
+  std::uint64_t publication = 0;
+  std::mutex mutex;
+  std::deque<std::shared_ptr<const Payload>> control;
+  std::shared_ptr<const Payload> tick;
+  // a worker is on it, or about to be
+  bool is_scheduled = false;
+  bool is_evicted = false;
+  // sends in a row that failed
+  unsigned failures = 0;
+  // kept between sends if the transport allows; used by the worker serving
+  // the subscriber, or under the lock while none is
+  std::unique_ptr<IConnection> connection;
+};
+
+SubscriberQueues::SubscriberQueues(IClient &client, std::size_t workers,
+                                   std::chrono::milliseconds send_deadline,
+                                   EvictHandler on_evicted)
+    : client_(client), send_deadline_(send_deadline),
+      on_evicted_(std::move(on_evicted)), pool_(workers) {}
+
+void SubscriberQueues::Publish(const Targets &targets, const Message &message,
+                               std::shared_ptr<ScopedLatency> latency) {
+  static Counter &coalesced_ticks =
+      Metrics::Instance().counter("node.coalesced_ticks");
+  auto payload = std::make_shared<Payload>();
+  if (!EncodeMessage(message, payload->encoded)) {
+    LOG(kERRORS) << "SubscriberQueues: message is too large";
+    return;
+  }
+  payload->is_tick = message.type == MessageType::kNEW_TIME;
+  payload->latency = std::move(latency);
+  ++publication_;
+  for (const Member *target : targets) {
+    std::shared_ptr<Subscriber> &entry = subscribers_[target->id];
+    if (!entry || entry->address != target->resolved) {
+      // resolved anew, a worker may still be sending to the old address
+      if (entry) {
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        Evict(*entry);
+      }
+      entry = std::make_shared<Subscriber>(target->id, target->resolved);
+    }
+    entry->publication = publication_;
+    Subscriber &subscriber = *entry;
+    std::unique_lock<std::mutex> lock(subscriber.mutex);
+    if (subscriber.is_evicted)
+      continue;
+    if (payload->is_tick) {
+      if (subscriber.tick)
+        coalesced_ticks.Increment();
+      subscriber.tick = payload;
+    } else if (subscriber.control.size() < kMaxControl) {
+      subscriber.control.push_back(payload);
+    } else {
+      LOG(kDEBUG) << "Queue of subscriber " << subscriber.id << " overflowed";
+      Evict(subscriber);
+      lock.unlock();
+      on_evicted_(subscriber.id);
+      continue;
+    }
+    if (subscriber.is_scheduled)
+      continue;
+    subscriber.is_scheduled = true;
+    lock.unlock();
+    pool_.Submit([this, entry] { Drain(entry); });
+  }
+  // members that left, a worker may still hold them
+  for (auto it = subscribers_.begin(); it != subscribers_.end();) {
+    if (it->second->publication == publication_) {
+      ++it;
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(it->second->mutex);
+      Evict(*it->second);
+    }
+    it = subscribers_.erase(it);
+  }
+}
+
+void SubscriberQueues::Drain(const std::shared_ptr<Subscriber> &subscriber) {
+  static Counter &failed_sends =
+      Metrics::Instance().counter("node.failed_sends");
+  std::unique_lock<std::mutex> lock(subscriber->mutex);
+  while (!subscriber->is_evicted &&
+         (!subscriber->control.empty() || subscriber->tick)) {
+    // control messages first, the tick may be replaced meanwhile
+    std::shared_ptr<const Payload> payload;
+    if (!subscriber->control.empty())
+      payload = subscriber->control.front();
+    else
+      payload = std::move(subscriber->tick);
+    lock.unlock();
+    bool is_sent = Send(*subscriber, payload->encoded);
+    lock.lock();
+    // forgotten meanwhile
+    if (subscriber->is_evicted)
+      break;
+    if (is_sent) {
+      subscriber->failures = 0;
+      if (!subscriber->control.empty() &&
+          subscriber->control.front() == payload)
+        subscriber->control.pop_front();
+      continue;
+    }
+    failed_sends.Increment();
+    if (++subscriber->failures < kMaxFailures)
+      break;
+    LOG(kDEBUG) << "Subscriber " << subscriber->id << " failed "
+                << subscriber->failures << " sends in a row";
+    Evict(*subscriber);
+    lock.unlock();
+    on_evicted_(subscriber->id);
+    return;
+  }
+  if (subscriber->is_evicted)
+    subscriber->connection.reset();
+  // the next publication schedules it again
+  subscriber->is_scheduled = false;
+}
+
+bool SubscriberQueues::Send(Subscriber &subscriber,
+                            const EncodedMessage &message) {
+  using SteadyClock = std::chrono::steady_clock;
+  auto expires_at = SteadyClock::now() + send_deadline_;
+  // A kept connection may have broken since the last send. If it failed
+  // before anything went out, it is dialed again once, like PooledClient
+  // does.
+  bool is_kept = static_cast<bool>(subscriber.connection);
+  while (true) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        expires_at - SteadyClock::now());
+    if (!subscriber.connection && remaining.count() > 0) {
+      subscriber.connection = client_.Connect(
+          *subscriber.address,
+          static_cast<int>(std::min<std::chrono::milliseconds::rep>(
+              kConnectTimeout, remaining.count())));
+      remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          expires_at - SteadyClock::now());
+    }
+    IConnection *connection = subscriber.connection.get();
+    if (!connection || remaining.count() <= 0)
+      return false;
+    connection->set_ack_timeout(static_cast<int>(remaining.count()));
+    bool is_sent = connection->Write(message);
+    connection->set_ack_timeout(-1);
+    if (is_sent && connection->is_reusable())
+      return true;
+    bool is_redialed = !is_sent && is_kept && !connection->is_last_write_sent();
+    connection->Close();
+    subscriber.connection.reset();
+    if (!is_redialed)
+      return is_sent;
+    is_kept = false;
+  }
+}
+
+void SubscriberQueues::Evict(Subscriber &subscriber) {
+  subscriber.is_evicted = true;
+  // a worker serving it drops the connection itself
+  if (!subscriber.is_scheduled)
+    subscriber.connection.reset();
+  subscriber.control.clear();
+  subscriber.tick.reset();
+}
@@ -0,0 +1,81 @@
+#ifndef SUBSCRIBER_QUEUES_H_
+#define SUBSCRIBER_QUEUES_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "i_connection_method.h"
+#include "membership.h"
+#include "metrics.h"
+#include "thread_pool.h"
+
+// Outbound queue per subscriber of a publisher, served by a bounded worker
+// pool. One worker at a time serves a subscriber, so a slow one holds up
+// itself and one worker, not the ticks of the others.
+//
+// A queue holds at most one tick: a kNEW_TIME replaces the one still
+// waiting, so a lagging subscriber gets the newest time and skips the rest.
+// Any other message goes to a short FIFO that is served first and in order.
+// A queue thus holds at most kMaxControl messages and a tick, and the
+// encoded bytes of a message are shared by all its subscribers.
+//
+// A subscriber keeps its connection between messages, so that a tick costs
+// no dial, no lookup in PooledClient and no allocation per subscriber.
+// Connecting and writing a message must take less than `send_deadline`,
+// normally the tick period, so that a subscriber that stopped reading holds
+// its worker for one period at most.
+//
+// A tick that could not be sent is dropped, the next one is newer; a
+// control message is tried again with the next publication. A subscriber
+// counts as gone only after kMaxFailures sends in a row failed, or once its
+// FIFO overflows; its queue is dropped then and `on_evicted` told.
+class SubscriberQueues {
+public:
+  using Targets = std::vector<const Member *>;
+  // Gets the id of an evicted subscriber, on any thread.
+  using EvictHandler = std::function<void(NodeId)>;
+  static constexpr unsigned kMaxFailures = 3;
+  static constexpr std::size_t kMaxControl = 16;
+
+  SubscriberQueues(IClient &client, std::size_t workers,
+                   std::chrono::milliseconds send_deadline,
+                   EvictHandler on_evicted);
+  SubscriberQueues(const SubscriberQueues &) = delete;
+  SubscriberQueues &operator=(const SubscriberQueues &) = delete;
+
+  // Queues `message` for every target, which must be resolved. Subscribers
+  // that are no longer targets, or whose address was resolved anew, are
+  // forgotten with what they had queued.
+  // `latency`, if any, is recorded once every subscriber took or skipped the
+  // message. From one thread at a time.
+  void Publish(const Targets &targets, const Message &message,
+               std::shared_ptr<ScopedLatency> latency = nullptr);
+
+private:
+  struct Payload;
+  struct Subscriber;
+  // Sends what `subscriber` has queued, until nothing is left or a send
+  // failed.
+  void Drain(const std::shared_ptr<Subscriber> &subscriber);
+  // Writes to `subscriber` within send_deadline_, over the connection it
+  // kept from the last send if there is one.
+  bool Send(Subscriber &subscriber, const EncodedMessage &message);
+  // Drops the queue of `subscriber` for good. Under its lock.
+  void Evict(Subscriber &subscriber);
+  static constexpr int kConnectTimeout = 100;
+  IClient &client_;
+  std::chrono::milliseconds send_deadline_;
+  EvictHandler on_evicted_;
+  // touched by Publish() only
+  std::unordered_map<NodeId, std::shared_ptr<Subscriber>> subscribers_;
+  std::uint64_t publication_ = 0;
+  // last, its workers use the rest until they are joined
+  ThreadPool pool_;
+};
+
+#endif // SUBSCRIBER_QUEUES_H_
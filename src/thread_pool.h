@@ -0,0 +1,32 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed number of worker threads serving a FIFO of tasks.
+class ThreadPool {
+public:
+  explicit ThreadPool(std::size_t threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void Submit(std::function<void()> task);
+  std::size_t size() const { return workers_.size(); }
+
+private:
+  void WorkerLoop();
+  std::mutex mutex_;
+  std::condition_variable has_task_;
+  std::deque<std::function<void()>> tasks_;
+  bool is_stopping_ = false;
+  std::vector<std::thread> workers_;
+};
+
+#endif // THREAD_POOL_H_
@@ -0,0 +1,159 @@
+#include "time_slot.h"
+
+#ifdef __linux__
+
+#include <atomic>
+#include <climits>
+#include <ctime>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Zero filled memory is a valid empty slot.
+struct TimeSlotData {
+  // odd while the time is written, also the futex word readers sleep on
+  std::atomic<std::uint32_t> sequence;
+  std::atomic<std::uint32_t> waiters;
+  std::atomic<std::int64_t> time_ns;
+};
+
+namespace {
+// A writer holds the odd sequence for a few stores. One holding it longer
+// died mid-update, or stopped, and the next writer takes the slot over.
+constexpr auto kWriterTimeout = std::chrono::milliseconds(100);
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free &&
+                  std::atomic<std::int64_t>::is_always_lock_free,
+              "the slot is shared between processes");
+
+// Not FUTEX_PRIVATE_FLAG, the word is shared between processes.
+long Futex(std::atomic<std::uint32_t> &word, int operation,
+           std::uint32_t value, const timespec *timeout) {
+  return syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word),
+                 operation, value, timeout, nullptr, 0);
+}
+} // namespace
+
+std::unique_ptr<TimeSlot> TimeSlot::Open(const std::string &name) {
+  std::string object_name = "/" + name;
+  int fd = shm_open(object_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    WriteLastErrorMessage("TimeSlot::Open::shm_open", object_name.c_str());
+    return nullptr;
+  }
+  // Growing keeps what another node may have published already.
+  struct stat slot_stat {};
+  if (fstat(fd, &slot_stat) != 0 ||
+      (static_cast<std::size_t>(slot_stat.st_size) < sizeof(TimeSlotData) &&
+       ftruncate(fd, sizeof(TimeSlotData)) != 0)) {
+    WriteLastErrorMessage("TimeSlot::Open::ftruncate", object_name.c_str());
+    close(fd);
+    return nullptr;
+  }
+  void *memory = mmap(nullptr, sizeof(TimeSlotData), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    WriteLastErrorMessage("TimeSlot::Open::mmap", object_name.c_str());
+    return nullptr;
+  }
+  return std::unique_ptr<TimeSlot>(
+      new TimeSlot(static_cast<TimeSlotData *>(memory)));
+}
+
+TimeSlot::~TimeSlot() { munmap(data_, sizeof(TimeSlotData)); }
+
+void TimeSlot::Publish(TimePoint time) {
+  // Taking the odd sequence with a CAS keeps the slot consistent even if two
+  // nodes believe they are the server.
+  std::uint32_t sequence = data_->sequence.load(std::memory_order_relaxed);
+  std::uint32_t stuck = sequence;
+  auto deadline = std::chrono::steady_clock::now() + kWriterTimeout;
+  while (true) {
+    if ((sequence & 1) == 0) {
+      if (data_->sequence.compare_exchange_weak(sequence, sequence + 1,
+                                                std::memory_order_acquire)) {
+        ++sequence;
+        break;
+      }
+      continue;
+    }
+    if (sequence != stuck) {
+      stuck = sequence;
+      deadline = std::chrono::steady_clock::now() + kWriterTimeout;
+    } else if (std::chrono::steady_clock::now() >= deadline) {
+      // stays odd, so readers keep waiting until we publish
+      if (data_->sequence.compare_exchange_strong(sequence, sequence + 2,
+                                                  std::memory_order_acquire)) {
+        LOG(kDEBUG) << "TimeSlot: took over from a stuck writer";
+        sequence += 2;
+        break;
+      }
+      continue;
+    }
+    std::this_thread::yield();
+    sequence = data_->sequence.load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  data_->time_ns.store(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          time.time_since_epoch())
+          .count(),
+      std::memory_order_relaxed);
+  // skip zero on wrap around, it means "nothing published"
+  std::uint32_t published = sequence + 1 == 0 ? 2 : sequence + 1;
+  // fails if we were taken for stuck, the new writer publishes instead
+  if (!data_->sequence.compare_exchange_strong(sequence, published,
+                                               std::memory_order_release))
+    return;
+  // pairs with the increment in WaitForChange()
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (data_->waiters.load(std::memory_order_relaxed) != 0)
+    Futex(data_->sequence, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+bool TimeSlot::Read(TimePoint &time, std::uint32_t &version) const {
+  auto deadline = std::chrono::steady_clock::now() + kWriterTimeout;
+  while (true) {
+    std::uint32_t before = data_->sequence.load(std::memory_order_acquire);
+    if (before == 0 ||
+        ((before & 1) != 0 && std::chrono::steady_clock::now() >= deadline)) {
+      version = before;
+      return false;
+    }
+    if ((before & 1) != 0) {
+      std::this_thread::yield();
+      continue;
+    }
+    std::int64_t time_ns = data_->time_ns.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (data_->sequence.load(std::memory_order_relaxed) != before)
+      continue;
+    time = TimePoint(std::chrono::duration_cast<Clock::duration>(
+        std::chrono::nanoseconds(time_ns)));
+    version = before;
+    return true;
+  }
+}
+
+std::uint32_t TimeSlot::version() const {
+  return data_->sequence.load(std::memory_order_acquire) & ~1u;
+}
+
+bool TimeSlot::WaitForChange(std::uint32_t version, int timeout) {
+  if (data_->sequence.load(std::memory_order_acquire) != version)
+    return true;
+  data_->waiters.fetch_add(1, std::memory_order_seq_cst);
+  timespec relative{timeout / 1000, (timeout % 1000) * 1000000L};
+  // returns at once if the sequence moved since the check above
+  Futex(data_->sequence, FUTEX_WAIT, version, &relative);
+  data_->waiters.fetch_sub(1, std::memory_order_relaxed);
+  return data_->sequence.load(std::memory_order_acquire) != version;
+}
+
+#endif // __linux__
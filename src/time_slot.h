@@ -0,0 +1,46 @@
+#ifndef TIME_SLOT_H_
+#define TIME_SLOT_H_
+
+#ifdef __linux__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "common.h"
+
+struct TimeSlotData;
+
+// Latest time published by the server, in a named shared memory object that
+// every node on the host maps. The server writes each tick once, whatever the
+// number of clients; clients read it under a seqlock and sleep on a futex
+// until it changes. A writer that stops mid-update holds the slot only until
+// the next one publishes.
+class TimeSlot {
+public:
+  // Maps the slot `name`, creating it if needed. Nodes of one cluster must
+  // use the same name. Returns nullptr after logging the error.
+  static std::unique_ptr<TimeSlot> Open(const std::string &name);
+  ~TimeSlot();
+  TimeSlot(const TimeSlot &) = delete;
+  TimeSlot &operator=(const TimeSlot &) = delete;
+
+  void Publish(TimePoint time);
+  // Reads the latest time and the version it was published with. Returns
+  // false if nothing was published yet, or if a writer stopped mid-update
+  // and no other has taken the slot over; `version` is then the current one.
+  bool Read(TimePoint &time, std::uint32_t &version) const;
+  // Version of the latest time, 0 if none. Passed to WaitForChange().
+  std::uint32_t version() const;
+  // Waits up to `timeout` ms until a time newer than `version` is published.
+  bool WaitForChange(std::uint32_t version, int timeout);
+
+private:
+  explicit TimeSlot(TimeSlotData *data) : data_(data) {}
+  TimeSlotData *data_;
+};
+
+#endif // __linux__
+
+#endif // TIME_SLOT_H_
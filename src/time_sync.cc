@@ -0,0 +1,30 @@
+#include "time_sync.h"
+
+#include <algorithm>
+
+ClockSample MeasureClock(TimePoint t1, TimePoint t2, TimePoint t3,
+                         TimePoint t4) {
+  using std::chrono::nanoseconds;
+  ClockSample sample;
+  sample.offset = std::chrono::duration_cast<nanoseconds>((t2 - t1) +
+                                                          (t3 - t4)) /
+                  2;
+  // a clock step between the stamps can make it negative
+  sample.delay = std::max(
+      std::chrono::duration_cast<nanoseconds>((t4 - t1) - (t3 - t2)),
+      nanoseconds::zero());
+  return sample;
+}
+
+void ClockFilter::Add(const ClockSample &sample) {
+  samples_.push_back(sample);
+  if (samples_.size() > window_)
+    samples_.pop_front();
+}
+
+const ClockSample &ClockFilter::best() const {
+  return *std::min_element(samples_.begin(), samples_.end(),
+                           [](const ClockSample &a, const ClockSample &b) {
+                             return a.delay < b.delay;
+                           });
+}
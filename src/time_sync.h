@@ -0,0 +1,45 @@
+#ifndef TIME_SYNC_H_
+#define TIME_SYNC_H_
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+
+#include "common.h"
+
+// NTP-style clock measurement. The client stamps a kTIME_REQUEST with t1
+// when it sends it; the server answers with t2, when the request arrived,
+// and t3, when the answer left; the client notes t4 when it arrives. t1 and
+// t4 are read on the client's clock, t2 and t3 on the server's.
+
+struct ClockSample {
+  // server clock minus client clock, off by at most delay / 2
+  std::chrono::nanoseconds offset{};
+  // round trip on the network, the server's turnaround left out
+  std::chrono::nanoseconds delay{};
+};
+
+ClockSample MeasureClock(TimePoint t1, TimePoint t2, TimePoint t3,
+                         TimePoint t4);
+
+// Latest samples from one server. As in NTP's clock filter, the sample with
+// the shortest round trip is trusted: queueing only ever adds delay, and the
+// error bound of the offset shrinks with it.
+class ClockFilter {
+public:
+  static constexpr std::size_t kDefaultWindow = 8;
+  explicit ClockFilter(std::size_t window = kDefaultWindow)
+      : window_(window) {}
+
+  void Add(const ClockSample &sample);
+  void Clear() { samples_.clear(); }
+  bool empty() const { return samples_.empty(); }
+  // Must not be empty().
+  const ClockSample &best() const;
+
+private:
+  std::size_t window_;
+  std::deque<ClockSample> samples_;
+};
+
+#endif // TIME_SYNC_H_
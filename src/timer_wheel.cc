@@ -0,0 +1,208 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "common.h"
+
+namespace {
+std::uint64_t LowBits(int count) { return (std::uint64_t{1} << count) - 1; }
+
+int LowestBit(std::uint64_t value) {
+  int bit = 0;
+  while ((value & 1) == 0) {
+    value >>= 1;
+    ++bit;
+  }
+  return bit;
+}
+} // namespace
+
+TimerWheel::TimerWheel(SteadyClock::duration resolution,
+                       SteadyClock::time_point now)
+    : resolution_(resolution), origin_(now) {
+  for (auto &level : heads_)
+    level.fill(kNil);
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(SteadyClock::time_point due,
+                                         SteadyClock::duration period,
+                                         Task task) {
+  std::uint32_t index;
+  if (free_.empty()) {
+    index = static_cast<std::uint32_t>(timers_.size());
+    timers_.emplace_back();
+  } else {
+    index = free_.back();
+    free_.pop_back();
+  }
+  Timer &timer = timers_[index];
+  timer.due = due;
+  timer.expiry = ToTick(due);
+  timer.period = period;
+  timer.task = std::move(task);
+  ++size_;
+  Link(index, current_ + 1);
+  return (TimerId{timer.generation} << 32) | index;
+}
+
+void TimerWheel::Cancel(TimerId id) {
+  std::uint32_t index = static_cast<std::uint32_t>(id);
+  if (index >= timers_.size() || timers_[index].generation != id >> 32 ||
+      !timers_[index].is_linked)
+    return;
+  Unlink(index);
+  Release(index);
+}
+
+void TimerWheel::Advance(SteadyClock::time_point now) {
+  std::uint64_t target =
+      now <= origin_
+          ? 0
+          : static_cast<std::uint64_t>((now - origin_) / resolution_);
+  // ticks in between have nothing to run or move
+  for (std::uint64_t tick = NextEventTick(); tick <= target;
+       tick = NextEventTick())
+    Step(tick, now);
+  current_ = std::max(current_, target);
+}
+
+TimerWheel::SteadyClock::time_point TimerWheel::next_due() const {
+  std::uint64_t tick = NextEventTick();
+  if (tick == UINT64_MAX)
+    return SteadyClock::time_point::max();
+  return origin_ + resolution_ * static_cast<SteadyClock::rep>(tick);
+}
+
+std::uint64_t TimerWheel::ToTick(SteadyClock::time_point time) const {
+  if (time <= origin_)
+    return 0;
+  auto elapsed = time - origin_;
+  auto ticks = static_cast<std::uint64_t>(elapsed / resolution_);
+  return elapsed % resolution_ == SteadyClock::duration::zero() ? ticks
+                                                              : ticks + 1;
+}
+
+void TimerWheel::Link(std::uint32_t index, std::uint64_t earliest) {
+  Timer &timer = timers_[index];
+  std::uint64_t place = std::max(timer.expiry, earliest);
+  int level = kLevels - 1;
+  std::uint64_t top_end = current_ | LowBits(kLevelBits * kLevels);
+  if (place > top_end) {
+    // Beyond the reach of the wheel. Waits in the top level until it turns;
+    // if the turn ends right now, it waits for the first slot of the next.
+    place = top_end > current_ ? top_end : current_ + 1;
+  }
+  if (place <= top_end)
+    level = std::min(HighestBit(place ^ current_) / kLevelBits, kLevels - 1);
+  std::uint32_t slot = (place >> (kLevelBits * level)) & (kSlots - 1);
+
+  std::uint32_t &head = heads_[level][slot];
+  timer.prev = kNil;
+  timer.next = head;
+  if (head != kNil)
+    timers_[head].prev = index;
+  head = index;
+  occupied_[level] |= std::uint64_t{1} << slot;
+  timer.level = static_cast<std::uint8_t>(level);
+  timer.slot = static_cast<std::uint8_t>(slot);
+  timer.is_linked = true;
+}
+
+void TimerWheel::Unlink(std::uint32_t index) {
+  Timer &timer = timers_[index];
+  std::uint32_t &head = heads_[timer.level][timer.slot];
+  if (timer.prev != kNil)
+    timers_[timer.prev].next = timer.next;
+  else
+    head = timer.next;
+  if (timer.next != kNil)
+    timers_[timer.next].prev = timer.prev;
+  if (head == kNil)
+    occupied_[timer.level] &= ~(std::uint64_t{1} << timer.slot);
+  timer.is_linked = false;
+}
+
+void TimerWheel::Release(std::uint32_t index) {
+  Timer &timer = timers_[index];
+  // outdates the ids handed out for this entry
+  ++timer.generation;
+  timer.task = nullptr;
+  free_.push_back(index);
+  --size_;
+}
+
+std::uint64_t TimerWheel::NextEventTick() const {
+  std::uint64_t next = UINT64_MAX;
+  for (int level = 0; level < kLevels; ++level) {
+    if (occupied_[level] == 0)
+      continue;
+    int shift = kLevelBits * level;
+    std::uint32_t current_slot = (current_ >> shift) & (kSlots - 1);
+    std::uint64_t turn = current_ >> (shift + kLevelBits);
+    std::uint64_t later =
+        current_slot + 1 == kSlots
+            ? 0
+            : occupied_[level] & (~std::uint64_t{0} << (current_slot + 1));
+    // only the top level holds slots of the next turn
+    if (later == 0)
+      ++turn;
+    std::uint64_t slot = LowestBit(later != 0 ? later : occupied_[level]);
+    std::uint64_t tick =
+        (turn << (shift + kLevelBits)) | (slot << shift);
+    next = std::min(next, tick);
+  }
+  return next;
+}
+
+void TimerWheel::Step(std::uint64_t tick, SteadyClock::time_point now) {
+  // Timers of the slots that start at `tick` move down, those due at
+  // `tick` to the lowest level, which runs below.
+  current_ = tick;
+  for (int level = kLevels - 1; level > 0; --level) {
+    int shift = kLevelBits * level;
+    if ((tick & LowBits(shift)) != 0)
+      continue;
+    std::uint32_t slot = (tick >> shift) & (kSlots - 1);
+    std::uint32_t index = heads_[level][slot];
+    heads_[level][slot] = kNil;
+    occupied_[level] &= ~(std::uint64_t{1} << slot);
+    while (index != kNil) {
+      std::uint32_t next = timers_[index].next;
+      Link(index, tick);
+      index = next;
+    }
+  }
+  // Timers scheduled from now on are due after `tick`, none lands in the
+  // slot that runs.
+  std::uint32_t &head = heads_[0][tick & (kSlots - 1)];
+  while (head != kNil) {
+    std::uint32_t index = head;
+    Unlink(index);
+    Fire(index, now);
+  }
+}
+
+void TimerWheel::Fire(std::uint32_t index, SteadyClock::time_point now) {
+  Timer &timer = timers_[index];
+  if (timer.expiry > current_) {
+    // was beyond the reach of the wheel
+    Link(index, current_ + 1);
+    return;
+  }
+  if (timer.period == SteadyClock::duration::zero()) {
+    Task task = std::move(timer.task);
+    Release(index);
+    task();
+    return;
+  }
+  timer.due += timer.period;
+  // skips whole periods, so that the timer stays on its grid
+  if (timer.due <= now)
+    timer.due += timer.period * ((now - timer.due) / timer.period + 1);
+  timer.expiry = ToTick(timer.due);
+  Link(index, current_ + 1);
+  // from a copy, the task may cancel its own timer
+  Task task = timer.task;
+  task();
+}
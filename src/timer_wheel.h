@@ -0,0 +1,92 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Hierarchical timing wheel on the steady clock. Time is cut into ticks of
+// `resolution`; level L has kSlots slots of kSlots^L ticks each. A timer sits
+// on the lowest level whose slot span still covers its due time and moves
+// down a level whenever the wheel below completes a turn, so Schedule() and
+// Cancel() are O(1) whatever the number of timers, and Advance() costs one
+// step per occupied slot or turn rather than per tick.
+//
+// Timers never fire early: due times are rounded up to the next tick.
+// Not thread safe.
+class TimerWheel {
+public:
+  using SteadyClock = std::chrono::steady_clock;
+  using Task = std::function<void()>;
+  using TimerId = std::uint64_t;
+  static constexpr std::chrono::milliseconds kDefaultResolution{1};
+
+  explicit TimerWheel(SteadyClock::duration resolution = kDefaultResolution,
+                      SteadyClock::time_point now = SteadyClock::now());
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  // Runs `task` at `due`, then every `period` after it unless it is zero.
+  // Ids are never 0, which callers may use for "no timer".
+  // Periodic timers keep their cadence from the first due time, but skip the
+  // periods that passed while the wheel was not advanced.
+  TimerId Schedule(SteadyClock::time_point due, SteadyClock::duration period,
+                   Task task);
+  // Unknown, fired and cancelled ids are ignored. A task may cancel its own
+  // timer.
+  void Cancel(TimerId id);
+  // Runs the tasks due by `now`, in due order but for ties. Tasks may
+  // schedule and cancel timers.
+  void Advance(SteadyClock::time_point now);
+  // Time before which no task is due, later than now if nothing is due. It
+  // may be earlier than the next task, when timers only move down a level.
+  SteadyClock::time_point next_due() const;
+  bool empty() const { return size_ == 0; }
+  std::size_t size() const { return size_; }
+
+private:
+  static constexpr int kLevelBits = 6;
+  static constexpr std::uint32_t kSlots = 1u << kLevelBits;
+  // 2^30 ticks, twelve days at 1 ms; later timers wait at the top and are
+  // placed again once it turned
+  static constexpr int kLevels = 5;
+  static constexpr std::uint32_t kNil = UINT32_MAX;
+  struct Timer {
+    std::uint64_t expiry = 0;
+    SteadyClock::time_point due;
+    SteadyClock::duration period{};
+    Task task;
+    // starts at 1, so that ids are not 0
+    std::uint32_t generation = 1;
+    std::uint32_t prev = kNil;
+    std::uint32_t next = kNil;
+    std::uint8_t level = 0;
+    std::uint8_t slot = 0;
+    bool is_linked = false;
+  };
+  std::uint64_t ToTick(SteadyClock::time_point time) const;
+  // Places the timer by its expiry, but not before `earliest`.
+  void Link(std::uint32_t index, std::uint64_t earliest);
+  void Unlink(std::uint32_t index);
+  void Release(std::uint32_t index);
+  // Next tick that has something to run or to move down, current_ + 1 at
+  // the earliest.
+  std::uint64_t NextEventTick() const;
+  void Step(std::uint64_t tick, SteadyClock::time_point now);
+  void Fire(std::uint32_t index, SteadyClock::time_point now);
+  SteadyClock::duration resolution_;
+  SteadyClock::time_point origin_;
+  // last tick that was processed
+  std::uint64_t current_ = 0;
+  std::vector<Timer> timers_;
+  std::vector<std::uint32_t> free_;
+  std::array<std::array<std::uint32_t, kSlots>, kLevels> heads_;
+  // bit s is set while slot s of the level is not empty
+  std::array<std::uint64_t, kLevels> occupied_{};
+  std::size_t size_ = 0;
+};
+
+#endif // TIMER_WHEEL_H_
@@ -0,0 +1,373 @@
+#include "unix_socket.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "wire_format.h"
+
+static const std::string kSocketDirectory = "/tmp/task7/";
+
+namespace {
+bool MakeSocketAddress(const std::string &path, sockaddr_un &address) {
+  address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  path.copy(address.sun_path, path.size());
+  return true;
+}
+
+bool SetBlocking(int fd, bool is_blocking) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0)
+    return false;
+  flags = is_blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK;
+  return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+// A socket file left behind by a crashed process refuses connections; a live
+// one accepts them. Only the former may be removed.
+bool RemoveStaleSocket(const sockaddr_un &address) {
+  int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (probe < 0)
+    return false;
+  bool is_stale = connect(probe, reinterpret_cast<const sockaddr *>(&address),
+                          sizeof(address)) != 0 &&
+                  errno == ECONNREFUSED;
+  close(probe);
+  if (!is_stale) {
+    errno = EADDRINUSE;
+    return false;
+  }
+  return unlink(address.sun_path) == 0;
+}
+} // namespace
+
+int ListenUnixSocket(const std::string &path, int backlog) {
+  if (mkdir(kSocketDirectory.c_str(), 0700) != 0 && errno != EEXIST) {
+    WriteLastErrorMessage("ListenUnixSocket::mkdir", kSocketDirectory.c_str());
+    return -1;
+  }
+  sockaddr_un socket_address;
+  if (!MakeSocketAddress(path, socket_address)) {
+    WriteLastErrorMessage("ListenUnixSocket::MakeSocketAddress", path.c_str());
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    WriteLastErrorMessage("ListenUnixSocket::socket", path.c_str());
+    return -1;
+  }
+  auto bind_socket = [&]() {
+    return bind(fd, reinterpret_cast<const sockaddr *>(&socket_address),
+                sizeof(socket_address)) == 0;
+  };
+  if (!bind_socket() &&
+      !(errno == EADDRINUSE && RemoveStaleSocket(socket_address) &&
+        bind_socket())) {
+    WriteLastErrorMessage("ListenUnixSocket::bind", path.c_str());
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, backlog) != 0) {
+    WriteLastErrorMessage("ListenUnixSocket::listen", path.c_str());
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int ConnectUnixSocket(const std::string &path, int timeout) {
+  sockaddr_un socket_address;
+  if (!MakeSocketAddress(path, socket_address)) {
+    WriteLastErrorMessage("ConnectUnixSocket::MakeSocketAddress",
+                          path.c_str());
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    WriteLastErrorMessage("ConnectUnixSocket::socket", path.c_str());
+    return -1;
+  }
+  // Non-blocking connect() to a unix socket either completes at once or
+  // fails with EAGAIN while the listen backlog is full. A missing or dead
+  // peer is reported immediately, without waiting for the timeout.
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  while (connect(fd, reinterpret_cast<const sockaddr *>(&socket_address),
+                 sizeof(socket_address)) != 0) {
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN || std::chrono::steady_clock::now() >= deadline) {
+      WriteLastErrorMessage("ConnectUnixSocket::connect", path.c_str());
+      close(fd);
+      return -1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (!SetBlocking(fd, true)) {
+    WriteLastErrorMessage("ConnectUnixSocket::fcntl", path.c_str());
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// SelfPipe
+
+SelfPipe::SelfPipe() {
+  if (pipe2(fds_, O_NONBLOCK | O_CLOEXEC) != 0) {
+    WriteLastErrorMessage("SelfPipe::pipe2");
+    exit(1);
+  }
+}
+
+SelfPipe::~SelfPipe() {
+  close(fds_[0]);
+  close(fds_[1]);
+}
+
+void SelfPipe::Notify() {
+  // a full pipe already wakes the poller
+  char byte = 0;
+  while (write(fds_[1], &byte, 1) < 0 && errno == EINTR) {
+  }
+}
+
+void SelfPipe::Drain() {
+  char bytes[64];
+  while (read(fds_[0], bytes, sizeof(bytes)) > 0) {
+  }
+}
+
+// UnixSocketAddress
+
+UnixSocketAddress::UnixSocketAddress(std::string path) {
+  if (!path.empty() && path[0] == '/') {
+    path_ = std::move(path);
+  } else {
+    path_ = NewPath(std::move(path));
+  }
+}
+
+UnixSocketAddress::UnixSocketAddress(const IAddress &address)
+    : UnixSocketAddress(address.raw()) {}
+
+std::string UnixSocketAddress::NewPath(std::string raw_path) {
+  static std::atomic<int> generated_count{0};
+  if (raw_path.empty()) {
+    // pid keeps generated names unique between live processes on one host
+    return kSocketDirectory + "node-" + std::to_string(getpid()) + "-" +
+           std::to_string(generated_count++);
+  }
+  return kSocketDirectory + raw_path;
+}
+
+// UnixSocketConnection
+
+UnixSocketConnection::UnixSocketConnection(int fd, bool is_server,
+                                           UnixSocketServer *server)
+    : fd_(fd), is_server_(is_server), server_(server) {}
+
+UnixSocketConnection::~UnixSocketConnection() { Close(); }
+
+bool UnixSocketConnection::SendFrame(const FramePart *parts,
+                                     std::size_t count) {
+  // one datagram gathered from the parts
+  iovec vectors[kMaxFrameParts];
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    vectors[i].iov_base = const_cast<char *>(parts[i].data);
+    vectors[i].iov_len = parts[i].size;
+    size += parts[i].size;
+  }
+  msghdr header{};
+  header.msg_iov = vectors;
+  header.msg_iovlen = count;
+  ssize_t bytes_written;
+  do {
+    bytes_written = sendmsg(fd_, &header, MSG_NOSIGNAL);
+  } while (bytes_written < 0 && errno == EINTR);
+  if (bytes_written != static_cast<ssize_t>(size)) {
+    WriteLastErrorMessage("UnixSocketConnection::SendFrame");
+    return false;
+  }
+  return true;
+}
+
+bool UnixSocketConnection::ReceiveFrame(std::vector<char> &buffer,
+                                        std::size_t &size, int timeout) {
+  if (timeout >= 0) {
+    pollfd peer{fd_, POLLIN, 0};
+    int status;
+    do {
+      status = poll(&peer, 1, timeout);
+    } while (status < 0 && errno == EINTR);
+    if (status <= 0) {
+      if (status < 0)
+        WriteLastErrorMessage("UnixSocketConnection::ReceiveFrame::poll");
+      return false;
+    }
+  }
+  // once per buffer, the frames that follow fit
+  if (buffer.size() < kMaxFrameSize)
+    buffer.resize(kMaxFrameSize);
+  ssize_t bytes_read;
+  do {
+    // MSG_TRUNC reports the real size of a frame that did not fit
+    bytes_read = recv(fd_, buffer.data(), buffer.size(), MSG_TRUNC);
+  } while (bytes_read < 0 && errno == EINTR);
+  if (bytes_read < 0) {
+    WriteLastErrorMessage("UnixSocketConnection::ReceiveFrame::recv");
+    return false;
+  }
+  if (bytes_read == 0) {
+    LOG(kDEBUG) << "UnixSocketConnection::ReceiveFrame: peer closed connection";
+    return false;
+  }
+  if (static_cast<std::size_t>(bytes_read) > buffer.size()) {
+    LOG(kDEBUG) << "UnixSocketConnection::ReceiveFrame: frame is too large";
+    return false;
+  }
+  size = static_cast<std::size_t>(bytes_read);
+  return true;
+}
+
+void UnixSocketConnection::Close() {
+  if (fd_ < 0)
+    return;
+  if (server_ && is_healthy()) {
+    server_->Park(fd_);
+  } else {
+    close(fd_);
+  }
+  fd_ = -1;
+}
+
+// UnixSocketServer
+
+UnixSocketServer::UnixSocketServer(const IAddress &address, int backlog)
+    : address_(address), fd_(ListenUnixSocket(address_.raw(), backlog)) {
+  if (fd_ < 0)
+    exit(1);
+}
+
+UnixSocketServer::~UnixSocketServer() {
+  for (int fd : idle_fds_)
+    close(fd);
+  close(fd_);
+  unlink(address_);
+}
+
+void UnixSocketServer::Park(int fd) {
+  if (idle_fds_.size() >= kMaxIdleConnections) {
+    close(fd);
+    return;
+  }
+  idle_fds_.push_back(fd);
+}
+
+std::unique_ptr<IConnection> UnixSocketServer::WaitForConnection(int timeout) {
+  auto connections = WaitForConnections(timeout, 1);
+  if (connections.empty())
+    return nullptr;
+  return std::move(connections.front());
+}
+
+std::vector<std::unique_ptr<IConnection>>
+UnixSocketServer::WaitForConnections(int timeout, std::size_t max_count) {
+  std::vector<std::unique_ptr<IConnection>> connections;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  std::vector<pollfd> fds;
+  bool is_interrupted = false;
+  while (connections.empty() && max_count > 0 && !is_interrupted) {
+    fds.assign(1, pollfd{fd_, POLLIN, 0});
+    for (int fd : idle_fds_)
+      fds.push_back(pollfd{fd, POLLIN, 0});
+    fds.push_back(pollfd{interrupt_.fd(), POLLIN, 0});
+    int remaining = static_cast<int>(std::max<std::chrono::milliseconds::rep>(
+        0, std::chrono::duration_cast<std::chrono::milliseconds>(
+               deadline - std::chrono::steady_clock::now())
+               .count()));
+    int status = poll(fds.data(), fds.size(), timeout < 0 ? -1 : remaining);
+    if (status < 0 && errno == EINTR)
+      continue;
+    if (status < 0) {
+      WriteLastErrorMessage("UnixSocketServer::WaitForConnections::poll",
+                            address_);
+      break;
+    }
+    if (status == 0) {
+      break;
+    }
+    if (fds.back().revents) {
+      interrupt_.Drain();
+      is_interrupted = true;
+    }
+    fds.pop_back();
+
+    // Parked connections that got a message. A handed out socket is parked
+    // again at the back, so busy peers cannot starve the others.
+    for (std::size_t i = 1;
+         i < fds.size() && connections.size() < max_count; ++i) {
+      if (!fds[i].revents)
+        continue;
+      int connection_fd = fds[i].fd;
+      idle_fds_.erase(
+          std::find(idle_fds_.begin(), idle_fds_.end(), connection_fd));
+      char byte;
+      if (recv(connection_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0) {
+        connections.push_back(std::make_unique<UnixSocketConnection>(
+            connection_fd, true, this));
+      } else {
+        // the peer has closed its end
+        close(connection_fd);
+      }
+    }
+
+    // Drain the listen backlog, so a burst of peers is accepted in one call.
+    while ((fds[0].revents & POLLIN) && connections.size() < max_count) {
+      int connection_fd = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (connection_fd < 0) {
+        // backlog is empty or another waiter took the pending connection
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          WriteLastErrorMessage("UnixSocketServer::WaitForConnections::accept",
+                                address_);
+        break;
+      }
+      connections.push_back(
+          std::make_unique<UnixSocketConnection>(connection_fd, true, this));
+    }
+  }
+  return connections;
+}
+
+// UnixSocketClient
+
+std::unique_ptr<IConnection> UnixSocketClient::Connect(const IAddress &address,
+                                                       int timeout) {
+  int fd = ConnectUnixSocket(UnixSocketAddress(address).raw(), timeout);
+  if (fd < 0)
+    return nullptr;
+  return std::make_unique<UnixSocketConnection>(fd, false);
+}
+
+#endif // _WIN32
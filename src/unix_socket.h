@@ -0,0 +1,145 @@
+#ifndef UNIX_SOCKET_H_
+#define UNIX_SOCKET_H_
+
+#ifndef _WIN32
+
+#include <string>
+#include <vector>
+
+#include "framed_connection.h"
+#include "i_connection_method.h"
+#include "log.h"
+
+class UnixSocketAddress : public IAddress {
+public:
+  UnixSocketAddress(std::string path);
+  UnixSocketAddress(const IAddress &address);
+  const std::string &raw() const override { return path_; }
+  operator const char *() const { return path_.c_str(); }
+
+private:
+  static std::string NewPath(std::string raw_path = "");
+  std::string path_;
+};
+
+// Socket helpers shared with transports that rendezvous over a unix socket.
+// Both return -1 after logging the error.
+
+// Non-blocking listening SOCK_SEQPACKET socket bound to `path`. A socket file
+// left behind by a dead process is replaced.
+int ListenUnixSocket(const std::string &path, int backlog);
+// Blocking SOCK_SEQPACKET socket connected to `path`.
+int ConnectUnixSocket(const std::string &path, int timeout);
+
+// Pipe that a poll() loop watches besides its sockets, so that another
+// thread can make it return. Notifications are not lost if nobody polls.
+class SelfPipe {
+public:
+  SelfPipe();
+  ~SelfPipe();
+  SelfPipe(const SelfPipe &) = delete;
+  SelfPipe &operator=(const SelfPipe &) = delete;
+
+  int fd() const { return fds_[0]; }
+  void Notify();
+  // Empties the pipe after poll() reported it readable.
+  void Drain();
+
+private:
+  int fds_[2];
+};
+
+class UnixSocketServer;
+
+class UnixSocketConnection : public FramedConnection {
+public:
+  explicit UnixSocketConnection(int fd, bool is_server,
+                                UnixSocketServer *server = nullptr);
+  ~UnixSocketConnection() override;
+  UnixSocketConnection(const UnixSocketConnection &) = delete;
+  UnixSocketConnection &operator=(const UnixSocketConnection &) = delete;
+
+  void Close() override;
+  bool is_server() const override { return is_server_; }
+  bool is_reusable() const override { return !is_server_; }
+
+protected:
+  bool SendFrame(const FramePart *parts, std::size_t count) override;
+  bool ReceiveFrame(std::vector<char> &buffer, std::size_t &size,
+                    int timeout) override;
+
+private:
+  int fd_;
+  bool is_server_;
+  // server that accepted this connection, it takes the socket back on Close()
+  UnixSocketServer *server_;
+};
+
+// Listening SOCK_SEQPACKET socket. Message boundaries are kept by the kernel,
+// so one Write() on the client side is exactly one Read() on the server side.
+// Accepted connections are parked after Close() while the peer keeps them
+// open, and WaitForConnection() returns them again once the next message
+// arrives.
+class UnixSocketServer : public IServer {
+public:
+  // The kernel caps `backlog` at net.core.somaxconn.
+  static constexpr int kDefaultBacklog = 4096;
+  explicit UnixSocketServer(const IAddress &address = UnixSocketAddress(""),
+                            int backlog = kDefaultBacklog);
+  ~UnixSocketServer() override;
+  UnixSocketServer(const UnixSocketServer &) = delete;
+  UnixSocketServer &operator=(const UnixSocketServer &) = delete;
+  UnixSocketServer(UnixSocketServer &&) = delete;
+  UnixSocketServer &operator=(UnixSocketServer &&) = delete;
+
+  std::unique_ptr<IConnection> WaitForConnection(int timeout) override;
+  std::vector<std::unique_ptr<IConnection>>
+  WaitForConnections(int timeout, std::size_t max_count) override;
+  void Interrupt() override { interrupt_.Notify(); }
+
+  const IAddress &address() const override { return address_; }
+  const std::string &address_str() const override { return address_.raw(); }
+
+private:
+  friend class UnixSocketConnection;
+  static constexpr std::size_t kMaxIdleConnections = 512;
+  void Park(int fd);
+  UnixSocketAddress address_;
+  int fd_;
+  std::vector<int> idle_fds_;
+  SelfPipe interrupt_;
+};
+
+class UnixSocketClient : public IClient {
+public:
+  std::unique_ptr<IConnection> Connect(const IAddress &address,
+                                       int timeout) override;
+};
+
+class UnixSocketFactory : public IConnectionMethodFactory {
+public:
+  explicit UnixSocketFactory(int backlog = UnixSocketServer::kDefaultBacklog)
+      : backlog_(backlog) {}
+  std::unique_ptr<IAddress> GenerateAddress() override {
+    return std::make_unique<UnixSocketAddress>("");
+  }
+  std::unique_ptr<IAddress> NewAddress(std::string address) override {
+    return std::make_unique<UnixSocketAddress>(address);
+  }
+  std::unique_ptr<IServer> NewServer(const IAddress &address) override {
+    return std::make_unique<UnixSocketServer>(address, backlog_);
+  }
+  std::unique_ptr<IClient> NewClient() override {
+    return std::make_unique<UnixSocketClient>();
+  }
+  std::unique_ptr<IAddress> ControllerAddress() override {
+    return NewAddress("controller");
+  }
+
+private:
+  int backlog_;
+};
+
+#endif // _WIN32
+
+#endif // UNIX_SOCKET_H_
@@ -0,0 +1,270 @@
+#include "wire_format.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+namespace {
+void PutU8(std::vector<char> &frame, std::uint8_t value) {
+  frame.push_back(static_cast<char>(value));
+}
+
+void PutU16(std::vector<char> &frame, std::uint16_t value) {
+  PutU8(frame, value & 0xff);
+  PutU8(frame, value >> 8);
+}
+
+void PutU32At(std::vector<char> &frame, std::size_t offset,
+              std::uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    frame[offset + i] = static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+void PutU32(std::vector<char> &frame, std::uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    PutU8(frame, (value >> (8 * i)) & 0xff);
+}
+
+void PutU64(std::vector<char> &frame, std::uint64_t value) {
+  for (int i = 0; i < 8; ++i)
+    PutU8(frame, (value >> (8 * i)) & 0xff);
+}
+
+std::uint64_t GetLE(const char *data, int bytes) {
+  std::uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+    value |= std::uint64_t(static_cast<unsigned char>(data[i])) << (8 * i);
+  return value;
+}
+
+void PutTime(std::vector<char> &frame, FieldTag tag, TimePoint time) {
+  if (time == TimePoint{})
+    return;
+  auto nanoseconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          time.time_since_epoch())
+          .count();
+  PutU8(frame, static_cast<std::uint8_t>(tag));
+  PutU16(frame, 8);
+  PutU64(frame, static_cast<std::uint64_t>(nanoseconds));
+}
+
+bool GetTime(const char *value, std::size_t size, TimePoint &time) {
+  if (size != 8)
+    return false;
+  auto nanoseconds = static_cast<std::int64_t>(GetLE(value, 8));
+  time = TimePoint(std::chrono::duration_cast<Clock::duration>(
+      std::chrono::nanoseconds(nanoseconds)));
+  return true;
+}
+
+void PutField(std::vector<char> &frame, FieldTag tag, const char *data,
+              std::uint16_t size) {
+  PutU8(frame, static_cast<std::uint8_t>(tag));
+  PutU16(frame, size);
+  frame.insert(frame.end(), data, data + size);
+}
+
+// Packed into as few fields as their length allows, an id costs 4 bytes
+// instead of a field of its own.
+void PutIds(std::vector<char> &frame, FieldTag tag,
+            const std::vector<NodeId> &ids) {
+  const std::size_t kIdsPerField = UINT16_MAX / 4;
+  for (std::size_t first = 0; first < ids.size(); first += kIdsPerField) {
+    std::size_t count = std::min(ids.size() - first, kIdsPerField);
+    PutU8(frame, static_cast<std::uint8_t>(tag));
+    PutU16(frame, static_cast<std::uint16_t>(count * 4));
+    for (std::size_t i = first; i < first + count; ++i)
+      PutU32(frame, ids[i]);
+  }
+}
+
+bool GetIds(const char *value, std::size_t size, std::vector<NodeId> &ids) {
+  if (size % 4 != 0)
+    return false;
+  for (std::size_t offset = 0; offset < size; offset += 4)
+    ids.push_back(static_cast<NodeId>(GetLE(value + offset, 4)));
+  return true;
+}
+} // namespace
+
+namespace {
+// Appends every field that is set but the sequence number.
+bool EncodeFields(const Message &message, std::vector<char> &fields) {
+  PutTime(fields, FieldTag::kTIME, message.time);
+  PutTime(fields, FieldTag::kORIGIN_TIME, message.origin_time);
+  PutTime(fields, FieldTag::kRECEIVE_TIME, message.receive_time);
+  if (message.epoch != 0) {
+    PutU8(fields, static_cast<std::uint8_t>(FieldTag::kEPOCH));
+    PutU16(fields, 8);
+    PutU64(fields, message.epoch);
+  }
+  if (message.base_epoch != 0) {
+    PutU8(fields, static_cast<std::uint8_t>(FieldTag::kBASE_EPOCH));
+    PutU16(fields, 8);
+    PutU64(fields, message.base_epoch);
+  }
+  if (!message.text.empty()) {
+    if (message.text.size() > UINT16_MAX)
+      return false;
+    PutField(fields, FieldTag::kTEXT, message.text.data(),
+             static_cast<std::uint16_t>(message.text.size()));
+  }
+  for (auto &address : message.addresses) {
+    if (address.size() > kMaxAddressLength)
+      return false;
+    PutField(fields, FieldTag::kADDRESS, address.data(),
+             static_cast<std::uint16_t>(address.size()));
+  }
+  PutIds(fields, FieldTag::kNODE_IDS, message.node_ids);
+  PutIds(fields, FieldTag::kREMOVED_IDS, message.removed_ids);
+  if (message.node_id != kNoNode) {
+    PutU8(fields, static_cast<std::uint8_t>(FieldTag::kNODE_ID));
+    PutU16(fields, 4);
+    PutU32(fields, message.node_id);
+  }
+  return true;
+}
+
+void PutHeader(std::vector<char> &frame, std::uint8_t client_role,
+               std::uint8_t type, std::uint8_t flags) {
+  PutU8(frame, kWireVersion);
+  PutU8(frame, client_role);
+  PutU8(frame, type);
+  PutU8(frame, flags);
+  frame.resize(kFrameHeaderSize);
+}
+
+void PutSequence(std::vector<char> &frame, std::uint32_t sequence) {
+  PutU8(frame, static_cast<std::uint8_t>(FieldTag::kSEQUENCE));
+  PutU16(frame, 4);
+  PutU32(frame, sequence);
+}
+} // namespace
+
+bool EncodeMessage(const Message &message, std::vector<char> &frame) {
+  frame.clear();
+  PutHeader(frame, static_cast<std::uint8_t>(message.client_role),
+            static_cast<std::uint8_t>(message.type),
+            message.has_more ? kFlagHasMore : 0);
+  if (message.sequence != 0)
+    PutSequence(frame, message.sequence);
+  if (!EncodeFields(message, frame) || frame.size() > kMaxFrameSize)
+    return false;
+  PutU32At(frame, 4,
+           static_cast<std::uint32_t>(frame.size() - kFrameHeaderSize));
+  return true;
+}
+
+bool EncodeMessage(const Message &message, EncodedMessage &encoded) {
+  encoded.client_role = static_cast<std::uint8_t>(message.client_role);
+  encoded.type = static_cast<std::uint8_t>(message.type);
+  encoded.flags = message.has_more ? kFlagHasMore : 0;
+  encoded.fields.clear();
+  return EncodeFields(message, encoded.fields) &&
+         kFramePrefixSize + encoded.fields.size() <= kMaxFrameSize;
+}
+
+void EncodeFramePrefix(const EncodedMessage &encoded, std::uint32_t sequence,
+                       std::vector<char> &prefix) {
+  prefix.clear();
+  PutHeader(prefix, encoded.client_role, encoded.type, encoded.flags);
+  PutSequence(prefix, sequence);
+  PutU32At(prefix, 4,
+           static_cast<std::uint32_t>(prefix.size() - kFrameHeaderSize +
+                                      encoded.fields.size()));
+}
+
+bool DecodeMessage(const char *frame, std::size_t size, Message &message) {
+  if (size < kFrameHeaderSize ||
+      static_cast<std::uint8_t>(frame[0]) != kWireVersion)
+    return false;
+  std::size_t payload_size = GetLE(frame + 4, 4);
+  if (payload_size != size - kFrameHeaderSize)
+    return false;
+  message.client_role =
+      static_cast<ClientRole>(static_cast<std::uint8_t>(frame[1]));
+  message.type = static_cast<MessageType>(static_cast<std::uint8_t>(frame[2]));
+  message.has_more = (static_cast<std::uint8_t>(frame[3]) & kFlagHasMore) != 0;
+
+  const char *field = frame + kFrameHeaderSize;
+  const char *end = frame + size;
+  while (field != end) {
+    if (end - field < 3)
+      return false;
+    auto tag = static_cast<FieldTag>(static_cast<std::uint8_t>(field[0]));
+    std::size_t field_size = GetLE(field + 1, 2);
+    const char *value = field + 3;
+    if (static_cast<std::size_t>(end - value) < field_size)
+      return false;
+    switch (tag) {
+    case FieldTag::kTIME:
+      if (!GetTime(value, field_size, message.time))
+        return false;
+      break;
+    case FieldTag::kORIGIN_TIME:
+      if (!GetTime(value, field_size, message.origin_time))
+        return false;
+      break;
+    case FieldTag::kRECEIVE_TIME:
+      if (!GetTime(value, field_size, message.receive_time))
+        return false;
+      break;
+    case FieldTag::kSEQUENCE:
+      if (field_size != 4)
+        return false;
+      message.sequence = static_cast<std::uint32_t>(GetLE(value, 4));
+      break;
+    case FieldTag::kEPOCH:
+      if (field_size != 8)
+        return false;
+      message.epoch = GetLE(value, 8);
+      break;
+    case FieldTag::kBASE_EPOCH:
+      if (field_size != 8)
+        return false;
+      message.base_epoch = GetLE(value, 8);
+      break;
+    case FieldTag::kTEXT:
+      message.text.assign(value, field_size);
+      break;
+    case FieldTag::kADDRESS:
+      message.addresses.emplace_back(value, field_size);
+      break;
+    case FieldTag::kNODE_IDS:
+      if (!GetIds(value, field_size, message.node_ids))
+        return false;
+      break;
+    case FieldTag::kREMOVED_IDS:
+      if (!GetIds(value, field_size, message.removed_ids))
+        return false;
+      break;
+    case FieldTag::kNODE_ID:
+      if (field_size != 4)
+        return false;
+      message.node_id = static_cast<NodeId>(GetLE(value, 4));
+      break;
+    default:
+      // field from a newer peer
+      break;
+    }
+    field = value + field_size;
+  }
+  return true;
+}
+
+void ResetMessage(Message &message) {
+  std::vector<std::string> addresses = std::move(message.addresses);
+  std::vector<NodeId> node_ids = std::move(message.node_ids);
+  std::vector<NodeId> removed_ids = std::move(message.removed_ids);
+  std::string text = std::move(message.text);
+  message = Message{};
+  addresses.clear();
+  node_ids.clear();
+  removed_ids.clear();
+  text.clear();
+  message.addresses = std::move(addresses);
+  message.node_ids = std::move(node_ids);
+  message.removed_ids = std::move(removed_ids);
+  message.text = std::move(text);
+}
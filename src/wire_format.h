@@ -0,0 +1,71 @@
+#ifndef WIRE_FORMAT_H_
+#define WIRE_FORMAT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "i_connection_method.h"
+
+// Frame layout, integers are little-endian:
+//
+//   header  | u8 version | u8 role | u8 type | u8 flags | u32 length |
+//   payload | field ... |
+//   field   | u8 tag | u16 length | value |
+//
+// `length` in the header is the payload size. Only the fields that are set
+// in the Message are written, so a time tick is a few dozen bytes and an
+// address list is as long as its contents. Fields with unknown tags are
+// skipped, which lets newer peers add fields without bumping the version.
+
+// 2: members are sent by id, removals by id only
+const std::uint8_t kWireVersion = 2;
+const std::size_t kFrameHeaderSize = 8;
+const std::size_t kMaxFrameSize = 64 * 1024;
+
+// bits of the header flags, unknown bits are ignored
+const std::uint8_t kFlagHasMore = 0x01; // Message::has_more
+
+enum class FieldTag : std::uint8_t {
+  kTIME = 1,    // i64 nanoseconds since the epoch
+  kADDRESS = 2,  // one entry of Message::addresses
+  kSEQUENCE = 3, // u32 Message::sequence
+  kTEXT = 4,     // Message::text
+  kEPOCH = 5,           // u64 Message::epoch
+  kBASE_EPOCH = 6,      // u64 Message::base_epoch
+  kORIGIN_TIME = 8,     // i64 nanoseconds, Message::origin_time
+  kRECEIVE_TIME = 9,    // i64 nanoseconds, Message::receive_time
+  kNODE_IDS = 10,       // u32 entries of Message::node_ids, in order
+  kREMOVED_IDS = 11,    // u32 entries of Message::removed_ids, in order
+  kNODE_ID = 12,        // u32 Message::node_id
+};
+
+// Returns false if the message does not fit into kMaxFrameSize.
+bool EncodeMessage(const Message &message, std::vector<char> &frame);
+
+// A message encoded once to be written to many connections, e.g. a tick.
+// The sequence number differs per connection, so it is left out of
+// `fields`; each connection sends a prefix of the header and the sequence
+// field, then the shared fields as they are.
+struct EncodedMessage {
+  std::uint8_t client_role = 0;
+  std::uint8_t type = 0;
+  std::uint8_t flags = 0;
+  std::vector<char> fields;
+};
+
+// size of the prefix EncodeFramePrefix() writes
+const std::size_t kFramePrefixSize = kFrameHeaderSize + 7;
+
+// Same as above; `encoded` reuses its capacity.
+bool EncodeMessage(const Message &message, EncodedMessage &encoded);
+void EncodeFramePrefix(const EncodedMessage &encoded, std::uint32_t sequence,
+                       std::vector<char> &prefix);
+
+// Returns false on a truncated, oversized or foreign-version frame.
+// `message` must be empty, see ResetMessage().
+bool DecodeMessage(const char *frame, std::size_t size, Message &message);
+// Empties `message` for DecodeMessage(), keeping the capacity of its vectors.
+void ResetMessage(Message &message);
+
+#endif // WIRE_FORMAT_H_
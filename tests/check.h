@@ -0,0 +1,32 @@
+#ifndef TESTS_CHECK_H_
+#define TESTS_CHECK_H_
+
+#include <iostream>
+
+// Bare checks for the unit tests, so that they build without dependencies.
+// A failed CHECK reports itself and the test goes on; main() returns
+// CheckResult().
+
+inline int &CheckFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      std::cerr << __FILE__ << ':' << __LINE__ << ": CHECK(" #condition        \
+                << ") failed" << std::endl;                                    \
+      ++CheckFailures();                                                       \
+    }                                                                          \
+  } while (false)
+
+#define CHECK_EQ(lhs, rhs) CHECK((lhs) == (rhs))
+
+inline int CheckResult() {
+  if (CheckFailures() != 0)
+    std::cerr << CheckFailures() << " checks failed" << std::endl;
+  return CheckFailures() == 0 ? 0 : 1;
+}
+
+#endif // TESTS_CHECK_H_
@@ -0,0 +1,196 @@
+#include "controller_journal.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include "check.h"
+#include "membership.h"
+
+namespace {
+const std::string kPath = "controller_journal_test.journal";
+
+// size and checksum, then kind, epoch and id
+std::size_t RecordSize(const std::string &address) {
+  return 8 + 13 + address.size();
+}
+const std::size_t kMagicSize = 8;
+
+void RemoveJournal() {
+  std::remove(kPath.c_str());
+  std::filesystem::remove(kPath + ".new");
+}
+
+std::map<NodeId, std::string> ById(const std::vector<Member> &members) {
+  std::map<NodeId, std::string> by_id;
+  for (auto &member : members)
+    by_id.emplace(member.id, member.address);
+  return by_id;
+}
+
+// Flips a byte of the journal at `position`.
+void Corrupt(std::size_t position) {
+  std::fstream file(kPath, std::ios::in | std::ios::out | std::ios::binary);
+  file.seekg(static_cast<std::streamoff>(position));
+  char byte = 0;
+  file.get(byte);
+  file.seekp(static_cast<std::streamoff>(position));
+  file.put(static_cast<char>(byte ^ 0x5a));
+}
+
+// Records are replayed in order on open: joins, leaves, the server and the
+// highest id handed out.
+void TestReplay() {
+  RemoveJournal();
+  {
+    ControllerState state;
+    auto journal = ControllerJournal::Open(kPath, state);
+    CHECK(journal != nullptr);
+    CHECK(state.members.empty());
+    CHECK_EQ(state.last_id, kNoNode);
+    CHECK(journal->Join(1, 1, "a"));
+    CHECK(journal->Join(2, 2, "b"));
+    CHECK(journal->Join(3, 3, "c"));
+    CHECK(journal->Leave(4, 3));
+    CHECK(journal->SetServer(4, 2));
+    CHECK(journal->Flush());
+  }
+  ControllerState state;
+  auto journal = ControllerJournal::Open(kPath, state);
+  CHECK(journal != nullptr);
+  CHECK((ById(state.members) == std::map<NodeId, std::string>{{1, "a"},
+                                                              {2, "b"}}));
+  CHECK_EQ(state.epoch, 4u);
+  CHECK_EQ(state.server, 2u);
+  CHECK_EQ(state.server_epoch, 4u);
+  // 3 left, but must not be handed out again
+  CHECK_EQ(state.last_id, 3u);
+}
+
+// A record whose checksum does not match ends the journal; it and what
+// follows are dropped, and the next record takes its place.
+void TestTornRecord() {
+  RemoveJournal();
+  {
+    ControllerState state;
+    auto journal = ControllerJournal::Open(kPath, state);
+    CHECK(journal->Join(1, 1, "a"));
+    CHECK(journal->Join(2, 2, "bb"));
+    CHECK(journal->Join(3, 3, "ccc"));
+  }
+  // the last byte of "bb"
+  Corrupt(kMagicSize + RecordSize("a") + RecordSize("bb") - 1);
+  {
+    ControllerState state;
+    auto journal = ControllerJournal::Open(kPath, state);
+    CHECK(journal != nullptr);
+    CHECK((ById(state.members) == std::map<NodeId, std::string>{{1, "a"}}));
+    CHECK_EQ(state.epoch, 1u);
+    CHECK_EQ(state.last_id, 1u);
+    CHECK(journal->Join(2, 2, "d"));
+  }
+  ControllerState state;
+  auto journal = ControllerJournal::Open(kPath, state);
+  CHECK((ById(state.members) == std::map<NodeId, std::string>{{1, "a"},
+                                                              {2, "d"}}));
+  CHECK_EQ(state.epoch, 2u);
+}
+
+// Compact() keeps the members, the epochs, the server and the highest id,
+// and the compacted journal takes further records.
+void TestCompaction() {
+  RemoveJournal();
+  VersionedMembership members;
+  {
+    ControllerState state;
+    auto journal = ControllerJournal::Open(kPath, state);
+    for (int round = 0; round < 100; ++round) {
+      std::string address = "node-" + std::to_string(round);
+      NodeId id = members.Insert(address);
+      CHECK(journal->Join(members.epoch(), id, address));
+      // every other node leaves again, the last one too
+      if (round % 2 == 1) {
+        CHECK(members.Erase(id));
+        CHECK(journal->Leave(members.epoch(), id));
+      }
+    }
+    CHECK(journal->SetServer(7, 1));
+    CHECK(journal->Compact(members.table(), members.epoch(),
+                           members.last_id(), 1, 7));
+  }
+  std::map<NodeId, std::string> expected;
+  members.table().ForEach([&](const Member &member) {
+    expected.emplace(member.id, member.address);
+  });
+  {
+    ControllerState state;
+    auto journal = ControllerJournal::Open(kPath, state);
+    CHECK(journal != nullptr);
+    CHECK(ById(state.members) == expected);
+    CHECK_EQ(state.epoch, members.epoch());
+    CHECK_EQ(state.server, 1u);
+    CHECK_EQ(state.server_epoch, 7u);
+    // the node with the highest id left before the compaction
+    CHECK(!members.table().Contains(members.last_id()));
+    CHECK_EQ(state.last_id, members.last_id());
+
+    // restored, ids go on after the highest one, not after the live ones
+    VersionedMembership restored;
+    restored.Restore(state.members, state.epoch, state.last_id);
+    NodeId id = restored.Insert("late");
+    CHECK_EQ(id, members.last_id() + 1);
+    CHECK(journal->Join(restored.epoch(), id, "late"));
+    expected.emplace(id, "late");
+  }
+  ControllerState state;
+  auto journal = ControllerJournal::Open(kPath, state);
+  CHECK(ById(state.members) == expected);
+  CHECK_EQ(state.last_id, members.last_id() + 1);
+}
+
+// A compaction that cannot write its new file leaves the old journal in
+// place and taking records, and is not tried again right away.
+void TestFailedCompaction() {
+  RemoveJournal();
+  // the new file cannot be created over a directory
+  std::filesystem::create_directory(kPath + ".new");
+  VersionedMembership members;
+  {
+    ControllerState state;
+    auto journal = ControllerJournal::Open(kPath, state);
+    for (int round = 0; round < 1000; ++round) {
+      NodeId id = members.Insert("node");
+      CHECK(journal->Join(members.epoch(), id, "node"));
+      CHECK(members.Erase(id));
+      CHECK(journal->Leave(members.epoch(), id));
+    }
+    members.Insert("kept");
+    CHECK(journal->Join(members.epoch(), members.last_id(), "kept"));
+    CHECK(journal->is_compaction_due(members.table().size()));
+    CHECK(journal->Compact(members.table(), members.epoch(),
+                           members.last_id(), kNoNode, 0));
+    CHECK(!journal->is_compaction_due(members.table().size()));
+    CHECK(journal->SetServer(3, members.last_id()));
+    CHECK(journal->Flush());
+  }
+  ControllerState state;
+  auto journal = ControllerJournal::Open(kPath, state);
+  CHECK(journal != nullptr);
+  CHECK_EQ(state.members.size(), 1u);
+  CHECK_EQ(state.epoch, members.epoch());
+  CHECK_EQ(state.server, members.last_id());
+  CHECK_EQ(state.last_id, members.last_id());
+}
+} // namespace
+
+int main() {
+  TestReplay();
+  TestTornRecord();
+  TestCompaction();
+  TestFailedCompaction();
+  RemoveJournal();
+  return CheckResult();
+}
@@ -0,0 +1,76 @@
+#include "failure_detector.h"
+
+#include <cmath>
+
+#include "check.h"
+
+namespace {
+using namespace std::chrono_literals;
+using SteadyClock = FailureDetector::SteadyClock;
+
+const SteadyClock::time_point kOrigin{};
+
+// Feeds 200 heartbeats, alternately `interval` - `jitter` and `interval` +
+// `jitter` apart, and returns the time of the last one. The seeded history
+// is gone by then.
+SteadyClock::time_point Beat(FailureDetector &detector,
+                             SteadyClock::duration interval,
+                             SteadyClock::duration jitter) {
+  detector.Reset(kOrigin);
+  SteadyClock::time_point now = kOrigin;
+  for (int i = 0; i < 200; ++i) {
+    now += i % 2 == 0 ? interval - jitter : interval + jitter;
+    detector.Heartbeat(now);
+  }
+  return now;
+}
+
+bool IsNear(double value, double expected) {
+  return std::abs(value - expected) < 0.01;
+}
+
+// Phi grows with every interval the heartbeats stay away, and crosses the
+// default threshold between one and two missed intervals with the
+// controller's settings.
+void TestMissedIntervals() {
+  FailureDetector detector(100ms, 25ms);
+  SteadyClock::time_point last = Beat(detector, 100ms, 0ms);
+  // on time, as likely late as not
+  CHECK(IsNear(detector.Phi(last + 100ms), 0.301));
+  double previous = detector.Phi(last);
+  for (int missed = 1; missed <= 4; ++missed) {
+    double phi = detector.Phi(last + missed * 100ms);
+    CHECK(phi > previous);
+    previous = phi;
+  }
+  CHECK_EQ(detector.threshold(), FailureDetector::kDefaultThreshold);
+  CHECK(!detector.IsSuspected(last + 200ms));
+  CHECK(detector.IsSuspected(last + 250ms));
+  // a heartbeat clears the suspicion
+  detector.Heartbeat(last + 250ms);
+  CHECK(!detector.IsSuspected(last + 300ms));
+}
+
+// With perfectly regular heartbeats the deviation is the floor; once the
+// heartbeats spread more than that, the floor no longer matters.
+void TestMinDeviation() {
+  FailureDetector tight(100ms, 10ms);
+  FailureDetector loose(100ms, 50ms);
+  SteadyClock::time_point last = Beat(tight, 100ms, 0ms);
+  Beat(loose, 100ms, 0ms);
+  // one deviation late
+  CHECK(IsNear(loose.Phi(last + 150ms), 0.800));
+  // five deviations late
+  CHECK(IsNear(tight.Phi(last + 150ms), 7.300));
+
+  // a deviation of 50 ms from the heartbeats themselves
+  last = Beat(tight, 100ms, 50ms);
+  CHECK(IsNear(tight.Phi(last + 150ms), 0.800));
+}
+} // namespace
+
+int main() {
+  TestMissedIntervals();
+  TestMinDeviation();
+  return CheckResult();
+}
@@ -0,0 +1,72 @@
+#include "frame_pool.h"
+
+#include <memory>
+#include <vector>
+
+#include "check.h"
+#include "mpmc_queue.h"
+#include "wire_format.h"
+
+namespace {
+// Capacities round up to a power of two; a full queue refuses a push and
+// leaves the value alone; positions wrap around the cells in FIFO order.
+void TestQueue() {
+  CHECK_EQ(MpmcQueue<int>(1).capacity(), 2u);
+  CHECK_EQ(MpmcQueue<int>(5).capacity(), 8u);
+  CHECK_EQ(MpmcQueue<int>(8).capacity(), 8u);
+
+  MpmcQueue<std::unique_ptr<int>> queue(4);
+  std::unique_ptr<int> value;
+  CHECK(!queue.TryPop(value));
+  int next_pushed = 0;
+  int next_popped = 0;
+  // ten turns of the cells, half full and full in turn
+  for (int turn = 0; turn < 10; ++turn) {
+    std::size_t count = turn % 2 == 0 ? 2 : 4;
+    for (std::size_t i = 0; i < count; ++i) {
+      value = std::make_unique<int>(next_pushed++);
+      CHECK(queue.TryPush(value));
+      CHECK(!value);
+    }
+    if (count == 4) {
+      value = std::make_unique<int>(-1);
+      CHECK(!queue.TryPush(value));
+      CHECK(value && *value == -1);
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      CHECK(queue.TryPop(value));
+      CHECK(value && *value == next_popped);
+      ++next_popped;
+    }
+    CHECK(!queue.TryPop(value));
+  }
+}
+
+// Buffers come back empty with the capacity they were released with; the
+// pool keeps no more than its capacity nor buffers larger than a frame.
+void TestPool() {
+  FramePool pool(2);
+  CHECK_EQ(pool.Acquire().capacity(), 0u);
+
+  for (std::size_t size : {100, 200, 300}) {
+    std::vector<char> buffer(size, 'x');
+    pool.Release(std::move(buffer));
+  }
+  std::vector<char> first = pool.Acquire();
+  std::vector<char> second = pool.Acquire();
+  CHECK(first.empty() && first.capacity() >= 100);
+  CHECK(second.empty() && second.capacity() >= 200);
+  // the third did not fit
+  CHECK_EQ(pool.Acquire().capacity(), 0u);
+
+  pool.Release(std::vector<char>(kMaxFrameSize + 1));
+  pool.Release(std::vector<char>());
+  CHECK_EQ(pool.Acquire().capacity(), 0u);
+}
+} // namespace
+
+int main() {
+  TestQueue();
+  TestPool();
+  return CheckResult();
+}
@@ -0,0 +1,160 @@
+#include "membership.h"
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+
+#include "check.h"
+
+namespace {
+std::map<NodeId, std::string> Contents(const MembershipTable &table) {
+  std::map<NodeId, std::string> contents;
+  table.ForEach([&](const Member &member) {
+    contents.emplace(member.id, member.address);
+  });
+  return contents;
+}
+
+// Every member is found at its position, and nothing else is found.
+void CheckTable(const MembershipTable &table,
+                const std::map<NodeId, std::string> &expected) {
+  CHECK_EQ(table.size(), expected.size());
+  CHECK(Contents(table) == expected);
+  for (auto &[id, address] : expected) {
+    std::size_t position = table.position(id);
+    CHECK(position < table.size());
+    if (position < table.size())
+      CHECK(table.at(position).id == id &&
+            table.at(position).address == address);
+  }
+}
+
+// Random ids collide in the small table and form probe runs; erasing from
+// the middle of a run must leave the rest of it reachable. Checked against a
+// map as it goes.
+void TestEraseReinsertChains() {
+  std::mt19937 random(7);
+  MembershipTable table;
+  std::map<NodeId, std::string> expected;
+  std::vector<NodeId> ids;
+  for (int i = 0; i < 24; ++i)
+    ids.push_back(static_cast<NodeId>(random() | 1));
+  for (int step = 0; step < 20000; ++step) {
+    NodeId id = ids[random() % ids.size()];
+    std::string address = "node-" + std::to_string(step);
+    if (random() % 2 == 0) {
+      bool is_new = expected.emplace(id, address).second;
+      CHECK_EQ(table.Insert(id, address), is_new);
+    } else {
+      bool is_member = expected.erase(id) == 1;
+      CHECK_EQ(table.Erase(id), is_member);
+    }
+    CHECK_EQ(table.Contains(id), expected.count(id) == 1);
+    if (step % 16 == 0)
+      CheckTable(table, expected);
+  }
+  CheckTable(table, expected);
+  for (NodeId id : ids)
+    table.Erase(id);
+  CHECK(table.empty());
+  CHECK(!table.Contains(ids.front()));
+  CHECK(!table.Contains(kNoNode));
+}
+
+// What a server does with a kMEMBERSHIP_DELTA, see Node::ApplyMembership().
+void Apply(const Message &delta, MembershipTable &table) {
+  CHECK(delta.type == MessageType::kMEMBERSHIP_DELTA);
+  CHECK_EQ(delta.node_ids.size(), delta.addresses.size());
+  for (std::size_t i = 0; i < delta.node_ids.size(); ++i)
+    table.Insert(delta.node_ids[i], delta.addresses[i]);
+  for (NodeId id : delta.removed_ids)
+    table.Erase(id);
+}
+
+void Copy(const MembershipTable &from, MembershipTable &to) {
+  to.Clear();
+  from.ForEach(
+      [&](const Member &member) { to.Insert(member.id, member.address); });
+}
+
+// Every change moves the epoch by one; a delta from an epoch brings a copy
+// taken at it, or at any later epoch, up to date.
+void TestDeltaReplay() {
+  VersionedMembership members(nullptr, 64);
+  for (int i = 0; i < 10; ++i)
+    members.Insert("node-" + std::to_string(i));
+  CHECK_EQ(members.epoch(), 10u);
+  // no-ops leave the epoch alone
+  CHECK_EQ(members.Insert("node-0"), kNoNode);
+  CHECK(!members.Erase(1000));
+  CHECK_EQ(members.epoch(), 10u);
+
+  MembershipTable at_base;
+  Copy(members.table(), at_base);
+  std::uint64_t base = members.epoch();
+
+  NodeId first = members.Find("node-0");
+  CHECK(members.Erase(first));
+  // back under a new id
+  NodeId again = members.Insert("node-0");
+  CHECK(again != first);
+  MembershipTable in_between;
+  Copy(members.table(), in_between);
+  // joins and leaves again, it is in no copy
+  CHECK(members.Erase(members.Insert("short-lived")));
+  CHECK(members.Erase(members.Find("node-5")));
+  members.Insert("node-10");
+  CHECK_EQ(members.epoch(), base + 6);
+
+  Message delta;
+  CHECK(members.MakeDelta(base, delta));
+  CHECK_EQ(delta.base_epoch, base);
+  CHECK_EQ(delta.epoch, members.epoch());
+  // node-0 twice, short-lived, node-5 and node-10
+  CHECK_EQ(delta.node_ids.size() + delta.removed_ids.size(), 5u);
+  Apply(delta, at_base);
+  CheckTable(at_base, Contents(members.table()));
+  Apply(delta, in_between);
+  CheckTable(in_between, Contents(members.table()));
+
+  // up to date already
+  CHECK(members.MakeDelta(members.epoch(), delta));
+  CHECK(delta.node_ids.empty() && delta.removed_ids.empty());
+  // from the future
+  CHECK(!members.MakeDelta(members.epoch() + 1, delta));
+}
+
+// A snapshot is due once the log does not reach back to the base, or the
+// delta would name more nodes than the table holds.
+void TestSnapshotDue() {
+  VersionedMembership members(nullptr, 4);
+  for (int i = 0; i < 8; ++i)
+    members.Insert("node-" + std::to_string(i));
+  Message delta;
+  CHECK(members.MakeDelta(4, delta));
+  CHECK(!members.MakeDelta(3, delta));
+
+  VersionedMembership small(nullptr, 64);
+  NodeId id = small.Insert("a");
+  small.Insert("b");
+  CHECK(small.Erase(id));
+  CHECK(small.MakeDelta(2, delta));
+  // two nodes changed, one is left
+  CHECK(!small.MakeDelta(0, delta));
+
+  // after a restore the log is empty until the next change
+  small.Restore({}, 100, 7);
+  CHECK(!small.MakeDelta(99, delta));
+  CHECK(small.MakeDelta(100, delta));
+  CHECK_EQ(small.Insert("c"), 8u);
+  CHECK(small.MakeDelta(100, delta));
+}
+} // namespace
+
+int main() {
+  TestEraseReinsertChains();
+  TestDeltaReplay();
+  TestSnapshotDue();
+  return CheckResult();
+}
@@ -0,0 +1,86 @@
+#include "membership.h"
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+
+namespace {
+using InsertResult = ShardedMembership::InsertResult;
+
+std::multiset<std::string> Drained(ShardedMembership &members) {
+  std::multiset<std::string> drained;
+  members.Drain([&](const std::string &address) { drained.insert(address); });
+  return drained;
+}
+
+// The same with one shard, where every address shares a lock, and with
+// many.
+void TestInsertEraseDrain(std::size_t shards) {
+  ShardedMembership members(shards);
+  CHECK(members.Insert("a", 3) == InsertResult::kINSERTED);
+  CHECK(members.Insert("b", 3) == InsertResult::kINSERTED);
+  CHECK(members.Insert("a", 3) == InsertResult::kPRESENT);
+  CHECK(members.Insert("c", 3) == InsertResult::kINSERTED);
+  CHECK(members.Insert("d", 3) == InsertResult::kFULL);
+  // members are present, full or not
+  CHECK(members.Insert("c", 3) == InsertResult::kPRESENT);
+  CHECK_EQ(members.size(), 3u);
+
+  // an address that left before it was drained is not handed out
+  CHECK(members.Erase("b"));
+  CHECK(!members.Erase("b"));
+  CHECK(!members.Erase("unknown"));
+  CHECK_EQ(members.size(), 2u);
+  CHECK((Drained(members) == std::multiset<std::string>{"a", "c"}));
+  CHECK(Drained(members).empty());
+
+  // room again
+  CHECK(members.Insert("d", 3) == InsertResult::kINSERTED);
+  CHECK((Drained(members) == std::multiset<std::string>{"d"}));
+  CHECK_EQ(members.size(), 3u);
+}
+
+// Threads registering overlapping addresses: each address is inserted and
+// drained exactly once.
+void TestConcurrentInserts() {
+  const std::size_t kThreads = 4;
+  const std::size_t kAddresses = 1000;
+  ShardedMembership members;
+  std::vector<std::size_t> inserted(kThreads);
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      // every address twice, by two threads, in different orders
+      for (std::size_t i = 0; i < kAddresses / 2; ++i) {
+        std::size_t index = (t % 2 == 0 ? i : kAddresses / 2 - 1 - i) +
+                            (t / 2) * (kAddresses / 2);
+        if (members.Insert("node-" + std::to_string(index), SIZE_MAX) ==
+            InsertResult::kINSERTED)
+          ++inserted[t];
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  std::size_t total = 0;
+  for (std::size_t count : inserted)
+    total += count;
+  CHECK_EQ(total, kAddresses);
+  CHECK_EQ(members.size(), kAddresses);
+  std::multiset<std::string> drained = Drained(members);
+  CHECK_EQ(drained.size(), kAddresses);
+  CHECK_EQ(std::set<std::string>(drained.begin(), drained.end()).size(),
+           kAddresses);
+}
+} // namespace
+
+int main() {
+  TestInsertEraseDrain(1);
+  TestInsertEraseDrain(ShardedMembership::kDefaultShards);
+  TestConcurrentInserts();
+  return CheckResult();
+}
@@ -0,0 +1,204 @@
+#include "subscriber_queues.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "wire_format.h"
+
+namespace {
+using namespace std::chrono_literals;
+
+class FakeAddress : public IAddress {
+public:
+  explicit FakeAddress(std::string raw) : raw_(std::move(raw)) {}
+  const std::string &raw() const override { return raw_; }
+
+private:
+  std::string raw_;
+};
+
+// Takes every write of every connection. Writes wait while the client is
+// held, and fail while it is failing.
+class FakeClient : public IClient {
+public:
+  std::unique_ptr<IConnection> Connect(const IAddress &, int) override;
+
+  void Hold() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_held_ = true;
+  }
+  void Release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_held_ = false;
+    changed_.notify_all();
+  }
+  void set_failing(bool is_failing) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_failing_ = is_failing;
+  }
+  // Waits up to a second for `count` writes to have started.
+  bool WaitForWrites(std::size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, 1s, [&] { return writes_ >= count; });
+  }
+  std::size_t writes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return writes_;
+  }
+  // encoded fields of the messages written, in order
+  std::vector<std::vector<char>> written() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+  }
+
+  bool Write(const EncodedMessage &message) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++writes_;
+    changed_.notify_all();
+    changed_.wait(lock, [&] { return !is_held_; });
+    if (is_failing_)
+      return false;
+    written_.push_back(message.fields);
+    return true;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool is_held_ = false;
+  bool is_failing_ = false;
+  std::size_t writes_ = 0;
+  std::vector<std::vector<char>> written_;
+};
+
+class FakeConnection : public IConnection {
+public:
+  explicit FakeConnection(FakeClient &client) : client_(client) {}
+  bool Write(Message &) override { return false; }
+  bool Write(const EncodedMessage &message) override {
+    return client_.Write(message);
+  }
+  Message Read(int) override { return Message(); }
+  void Close() override {}
+  bool is_server() const override { return false; }
+
+private:
+  FakeClient &client_;
+};
+
+std::unique_ptr<IConnection> FakeClient::Connect(const IAddress &, int) {
+  return std::make_unique<FakeConnection>(*this);
+}
+
+Message Tick(int seconds) {
+  Message m;
+  m.type = MessageType::kNEW_TIME;
+  m.time = TimePoint(std::chrono::seconds(seconds));
+  return m;
+}
+
+Message Control(int epoch) {
+  Message m;
+  m.type = MessageType::kSET_RELAY;
+  m.epoch = epoch;
+  return m;
+}
+
+std::vector<char> Fields(const Message &message) {
+  EncodedMessage encoded;
+  EncodeMessage(message, encoded);
+  return encoded.fields;
+}
+
+// While a send is under way, further ticks replace each other and control
+// messages queue up; they go out first and in order, then the newest tick.
+void TestCoalescing() {
+  FakeClient client;
+  SubscriberQueues queues(client, 1, 1000ms, [](NodeId) { CHECK(false); });
+  Member member{1, "a", std::make_shared<FakeAddress>("a")};
+  SubscriberQueues::Targets targets{&member};
+
+  client.Hold();
+  queues.Publish(targets, Tick(1));
+  CHECK(client.WaitForWrites(1));
+  queues.Publish(targets, Tick(2));
+  queues.Publish(targets, Control(1));
+  queues.Publish(targets, Tick(3));
+  queues.Publish(targets, Control(2));
+  queues.Publish(targets, Tick(4));
+  client.Release();
+  CHECK(client.WaitForWrites(4));
+
+  std::vector<std::vector<char>> expected{Fields(Tick(1)), Fields(Control(1)),
+                                          Fields(Control(2)), Fields(Tick(4))};
+  // nothing else is on its way
+  std::this_thread::sleep_for(10ms);
+  CHECK(client.written() == expected);
+}
+
+// Publishes a tick, again until it was tried, since one published while the
+// previous send is still failing waits for the next publication.
+bool PublishUntilTried(SubscriberQueues &queues,
+                       const SubscriberQueues::Targets &targets,
+                       FakeClient &client, int seconds) {
+  std::size_t writes = client.writes();
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    queues.Publish(targets, Tick(seconds));
+    std::this_thread::sleep_for(1ms);
+    if (client.writes() > writes)
+      return true;
+  }
+  return false;
+}
+
+// A subscriber is evicted after kMaxFailures failed sends in a row, not
+// before; a send that went through starts the count over.
+void TestEviction() {
+  FakeClient client;
+  std::mutex mutex;
+  std::vector<NodeId> evicted;
+  SubscriberQueues queues(client, 1, 1000ms, [&](NodeId id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    evicted.push_back(id);
+  });
+  Member member{7, "a", std::make_shared<FakeAddress>("a")};
+  SubscriberQueues::Targets targets{&member};
+  auto evicted_ids = [&] {
+    std::lock_guard<std::mutex> lock(mutex);
+    return evicted;
+  };
+
+  client.set_failing(true);
+  for (unsigned i = 1; i < SubscriberQueues::kMaxFailures; ++i)
+    CHECK(PublishUntilTried(queues, targets, client, i));
+  client.set_failing(false);
+  CHECK(PublishUntilTried(queues, targets, client, 10));
+  // a tick that came after it goes out too
+  std::this_thread::sleep_for(10ms);
+  client.set_failing(true);
+  for (unsigned i = 1; i < SubscriberQueues::kMaxFailures; ++i)
+    CHECK(PublishUntilTried(queues, targets, client, 10 + i));
+  CHECK(evicted_ids().empty());
+
+  CHECK(PublishUntilTried(queues, targets, client, 20));
+  std::this_thread::sleep_for(10ms);
+  CHECK(evicted_ids() == std::vector<NodeId>{7});
+  // forgotten for good
+  std::size_t writes = client.writes();
+  queues.Publish(targets, Tick(21));
+  std::this_thread::sleep_for(10ms);
+  CHECK_EQ(client.writes(), writes);
+}
+} // namespace
+
+int main() {
+  TestCoalescing();
+  TestEviction();
+  return CheckResult();
+}
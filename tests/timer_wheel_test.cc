@@ -0,0 +1,102 @@
+#include "timer_wheel.h"
+
+#include <vector>
+
+#include "check.h"
+
+namespace {
+using namespace std::chrono_literals;
+using SteadyClock = TimerWheel::SteadyClock;
+
+const SteadyClock::time_point kOrigin{};
+
+// Timers on every level come down to level 0 and fire on their tick, in due
+// order, whether the wheel is advanced tick by tick or in one jump.
+void TestCascade() {
+  const std::vector<SteadyClock::duration> dues = {
+      5ms, 63ms, 64ms, 70ms, 4095ms, 4096ms, 5000ms, 300s, 2h};
+  for (bool is_jumping : {false, true}) {
+    TimerWheel wheel(1ms, kOrigin);
+    std::vector<std::size_t> fired;
+    for (std::size_t i = dues.size(); i-- > 0;)
+      wheel.Schedule(kOrigin + dues[i], 0ms,
+                     [&fired, i] { fired.push_back(i); });
+    CHECK_EQ(wheel.size(), dues.size());
+    if (is_jumping) {
+      wheel.Advance(kOrigin + dues.back());
+    } else {
+      for (std::size_t i = 0; i < dues.size(); ++i) {
+        wheel.Advance(kOrigin + dues[i] - 1ms);
+        CHECK_EQ(fired.size(), i);
+        wheel.Advance(kOrigin + dues[i]);
+        CHECK_EQ(fired.size(), i + 1);
+      }
+    }
+    CHECK_EQ(fired.size(), dues.size());
+    for (std::size_t i = 0; i < fired.size(); ++i)
+      CHECK_EQ(fired[i], i);
+    CHECK(wheel.empty());
+  }
+}
+
+// A periodic timer fires once per period. Advanced late, it fires once for
+// all the periods it missed and goes on from its grid, not from the time it
+// was late by.
+void TestPeriodic() {
+  TimerWheel wheel(1ms, kOrigin);
+  int runs = 0;
+  wheel.Schedule(kOrigin + 10ms, 10ms, [&] { ++runs; });
+  wheel.Advance(kOrigin + 9ms);
+  CHECK_EQ(runs, 0);
+  wheel.Advance(kOrigin + 10ms);
+  CHECK_EQ(runs, 1);
+  wheel.Advance(kOrigin + 20ms);
+  CHECK_EQ(runs, 2);
+  // 30 to 50 are late
+  wheel.Advance(kOrigin + 55ms);
+  CHECK_EQ(runs, 3);
+  CHECK(wheel.next_due() <= kOrigin + 60ms);
+  wheel.Advance(kOrigin + 59ms);
+  CHECK_EQ(runs, 3);
+  wheel.Advance(kOrigin + 60ms);
+  CHECK_EQ(runs, 4);
+  wheel.Advance(kOrigin + 70ms);
+  CHECK_EQ(runs, 5);
+  CHECK_EQ(wheel.size(), 1u);
+}
+
+void TestCancel() {
+  TimerWheel wheel(1ms, kOrigin);
+  int runs = 0;
+  TimerWheel::TimerId once =
+      wheel.Schedule(kOrigin + 100ms, 0ms, [&] { ++runs; });
+  TimerWheel::TimerId periodic = 0;
+  periodic = wheel.Schedule(kOrigin + 10ms, 10ms, [&] {
+    if (++runs == 3)
+      wheel.Cancel(periodic);
+  });
+  CHECK(once != 0 && periodic != 0 && once != periodic);
+  wheel.Cancel(once);
+  // a second time, and an id that was never handed out
+  wheel.Cancel(once);
+  wheel.Cancel(periodic + 1);
+  CHECK_EQ(wheel.size(), 1u);
+  for (auto now = kOrigin; now <= kOrigin + 100ms; now += 10ms)
+    wheel.Advance(now);
+  CHECK_EQ(runs, 3);
+  CHECK(wheel.empty());
+  CHECK(wheel.next_due() == SteadyClock::time_point::max());
+  // the slot is reused, the old id must not cancel the new timer
+  wheel.Schedule(kOrigin + 2s, 0ms, [&] { ++runs; });
+  wheel.Cancel(once);
+  wheel.Advance(kOrigin + 2s);
+  CHECK_EQ(runs, 4);
+}
+} // namespace
+
+int main() {
+  TestCascade();
+  TestPeriodic();
+  TestCancel();
+  return CheckResult();
+}